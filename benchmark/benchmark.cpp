@@ -0,0 +1,550 @@
+// Throughput benchmark of assetlib. Generates textures, meshes and environments of a few sizes and entropies, and
+// measures pack, save, load, info parse and unpack speed for every compression mode, together with the compression
+// ratio and the peak heap use of every case. Data is generated from a fixed seed, so runs are comparable.
+//
+// Usage: assetlib_benchmark [options]
+//   --json <path>     Also write the results as json to path. "-" writes the json to stdout instead of the table.
+//   --quick           Only the smallest size of every asset, for a fast sanity check.
+//   --filter <text>   Only run the cases whose name contains text, e.g. "texture" or "lz4hc".
+//   --repeat <n>      Times every step is run, the fastest run is reported. Defaults to 3.
+//   --threads <n>     Worker threads used to unpack. 0, the default, uses every hardware thread. Packing always runs on
+//                     the calling thread, since pack_texture and pack_mesh don't take an executor.
+//   --dir <path>      Directory the assets are saved to and loaded from. Defaults to the temporary directory.
+//
+// Cases are named after the requested compression mode. The stored mode can differ: Auto picks one, and incompressible
+// data is stored uncompressed. The table and the json report the stored mode.
+//
+// Throughput is in MB/s (10^6 bytes) of unpacked data, except for save and load which count the bytes of the file and
+// info parsing which counts the bytes of the metadata.
+
+#include <assetlib/asset_file.hpp>
+#include <assetlib/environment.hpp>
+#include <assetlib/mesh.hpp>
+#include <assetlib/texture.hpp>
+#include <assetlib/thread_pool.hpp>
+
+#include <json.hpp>
+#include <plib/stream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace assetlib;
+
+// Heap tracking. Every allocation is prefixed with its size and the start of the underlying block, placed right before
+// the aligned pointer. All forms of operator new are replaced, ScratchBuffer for example allocates with align_val_t.
+static std::atomic<uint64_t> heap_current{ 0 };
+static std::atomic<uint64_t> heap_peak{ 0 };
+// The operators are kept out of line, so GCC doesn't mistake the header offset for out of bounds accesses.
+constexpr size_t allocation_header = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+static_assert(allocation_header >= 2 * sizeof(void*), "The allocation header must hold the size and the block");
+
+#if defined(__GNUC__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCHMARK_NOINLINE __declspec(noinline)
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+BENCHMARK_NOINLINE static void* tracked_allocate(std::size_t size, std::size_t alignment) noexcept {
+	alignment = std::max(alignment, allocation_header);
+	// At least one alignment in front of the pointer for the header, and enough slack to align it
+	char* block = static_cast<char*>(std::malloc(size + 2 * alignment));
+	if (!block) return nullptr;
+	uintptr_t const aligned = (reinterpret_cast<uintptr_t>(block) + 2 * alignment - 1) & ~uintptr_t(alignment - 1);
+	char* ptr = reinterpret_cast<char*>(aligned);
+	std::memcpy(ptr - 2 * sizeof(void*), &size, sizeof(size));
+	std::memcpy(ptr - sizeof(void*), &block, sizeof(block));
+	uint64_t const current = heap_current.fetch_add(size) + size;
+	uint64_t peak = heap_peak.load();
+	while (current > peak && !heap_peak.compare_exchange_weak(peak, current)) {}
+	return ptr;
+}
+
+BENCHMARK_NOINLINE static void tracked_free(void* ptr) noexcept {
+	if (!ptr) return;
+	char const* header = static_cast<char*>(ptr);
+	size_t size;
+	void* block;
+	std::memcpy(&size, header - 2 * sizeof(void*), sizeof(size));
+	std::memcpy(&block, header - sizeof(void*), sizeof(block));
+	heap_current.fetch_sub(size);
+	std::free(block);
+}
+
+void* operator new(std::size_t size) {
+	void* ptr = tracked_allocate(size, allocation_header);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	void* ptr = tracked_allocate(size, static_cast<std::size_t>(alignment));
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+	return tracked_allocate(size, allocation_header);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept {
+	return tracked_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::nothrow_t const&) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { tracked_free(ptr); }
+
+// Peak resident memory of the whole process so far
+static uint64_t peak_rss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+struct Settings {
+	std::string json_path;
+	std::string filter;
+	bool quick = false;
+	uint32_t repeat = 3;
+	uint32_t threads = 0;
+	std::filesystem::path dir;
+};
+
+// How predictable the generated data is, from long runs of equal values to uniform noise
+enum class Entropy {
+	Low,
+	Medium,
+	High
+};
+
+static char const* entropy_name(Entropy entropy) {
+	switch (entropy) {
+	case Entropy::Low:
+		return "low";
+	case Entropy::Medium:
+		return "medium";
+	default:
+		return "high";
+	}
+}
+
+struct Result {
+	std::string asset;
+	std::string name;
+	// Mode the packed file was stored with
+	CompressionMode compression = CompressionMode::None;
+	uint64_t raw_bytes = 0;
+	uint64_t file_bytes = 0;
+	uint64_t metadata_bytes = 0;
+	double pack_seconds = 0.0;
+	double save_seconds = 0.0;
+	double load_seconds = 0.0;
+	double info_seconds = 0.0;
+	double unpack_seconds = 0.0;
+	uint64_t peak_heap = 0;
+};
+
+// The steps of a case. parse_info and unpack work on the loaded file. parse_info returns the mode the file was stored with.
+struct Operations {
+	std::function<AssetFile()> pack;
+	std::function<CompressionMode(AssetFile const&)> parse_info;
+	std::function<void(AssetFile const&)> unpack;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Fastest of repeat runs, in seconds
+template <typename Step>
+static double time_best(uint32_t repeat, Step const& step) {
+	double best = std::numeric_limits<double>::infinity();
+	for (uint32_t run = 0; run < repeat; ++run) {
+		Clock::time_point const start = Clock::now();
+		step();
+		best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+	}
+	return best;
+}
+
+static Result run_case(Settings const& settings, char const* asset, std::string const& name, uint64_t raw_bytes, Operations const& operations) {
+	Result result;
+	result.asset = asset;
+	result.name = name;
+	result.raw_bytes = raw_bytes;
+
+	uint64_t const heap_base = heap_current.load();
+	heap_peak.store(heap_base);
+
+	AssetFile file;
+	result.pack_seconds = time_best(settings.repeat, [&] { file = operations.pack(); });
+	result.file_bytes = asset_file_header_size + file.metadata_json.size() + file.binary_blob.size();
+	result.metadata_bytes = file.metadata_json.size();
+
+	std::string const path = (settings.dir / ("assetlib_benchmark_" + name + ".asset")).string();
+	result.save_seconds = time_best(settings.repeat, [&] {
+		plib::binary_output_stream out = plib::binary_output_stream::from_file(path);
+		save_binary_file(out, file);
+	});
+	file = AssetFile{};
+
+	AssetFile loaded;
+	result.load_seconds = time_best(settings.repeat, [&] {
+		loaded = AssetFile{};
+		plib::binary_input_stream in = plib::binary_input_stream::from_file(path);
+		load_binary_file(in, loaded);
+	});
+	std::filesystem::remove(path);
+
+	// A single parse is too short to time, so every run parses many times
+	constexpr uint32_t parses_per_run = 1000;
+	result.info_seconds = time_best(settings.repeat, [&] {
+		for (uint32_t i = 0; i < parses_per_run; ++i) operations.parse_info(loaded);
+	}) / parses_per_run;
+	result.compression = operations.parse_info(loaded);
+
+	result.unpack_seconds = time_best(settings.repeat, [&] { operations.unpack(loaded); });
+	result.peak_heap = heap_peak.load() - heap_base;
+	return result;
+}
+
+static CompressionMode const compression_modes[] = { CompressionMode::None, CompressionMode::LZ4, CompressionMode::LZ4HC, CompressionMode::Auto };
+static Entropy const entropies[] = { Entropy::Low, Entropy::Medium, Entropy::High };
+
+static bool selected(Settings const& settings, std::string const& name) {
+	return settings.filter.empty() || name.find(settings.filter) != std::string::npos;
+}
+
+static std::string case_name(char const* asset, std::string const& variant, Entropy entropy, CompressionMode compression) {
+	std::string name = std::string(asset) + "_" + variant + "_" + entropy_name(entropy) + "_" + compression_to_string(compression);
+	std::transform(name.begin(), name.end(), name.begin(), [](char c) { return char(std::tolower(static_cast<unsigned char>(c))); });
+	return name;
+}
+
+// RGBA8 texels: flat 32x32 tiles, smooth gradients with noise, or uniform noise
+static std::vector<uint8_t> generate_texels(uint32_t width, uint32_t height, Entropy entropy) {
+	std::mt19937 rng(width * 31 + height);
+	std::vector<uint8_t> texels(uint64_t(width) * height * 4);
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			uint8_t* texel = texels.data() + (uint64_t(y) * width + x) * 4;
+			uint32_t const noise = rng();
+			for (uint32_t c = 0; c < 4; ++c) {
+				uint32_t const gradient = (x * 255 / width + y * 255 / height * (c + 1)) / 2;
+				uint32_t const jitter = (noise >> (c * 8)) & 0xFF;
+				if (entropy == Entropy::Low) texel[c] = uint8_t(c == 3 ? 255 : (x / 32 + y / 32) * 16 * (c + 1));
+				else if (entropy == Entropy::Medium) texel[c] = uint8_t(std::clamp<int32_t>(int32_t(gradient) + int32_t(jitter % 17) - 8, 0, 255));
+				else texel[c] = uint8_t(jitter);
+			}
+		}
+	}
+	return texels;
+}
+
+static void benchmark_textures(Settings const& settings, Executor const& executor, std::vector<Result>& results) {
+	std::vector<uint32_t> sizes = { 256, 1024, 4096 };
+	if (settings.quick) sizes.resize(1);
+	for (uint32_t size : sizes) {
+		for (Entropy entropy : entropies) {
+			std::vector<uint8_t> texels;
+			for (CompressionMode compression : compression_modes) {
+				std::string const name = case_name("texture", "rgba8_" + std::to_string(size), entropy, compression);
+				if (!selected(settings, name)) continue;
+				if (texels.empty()) texels = generate_texels(size, size, entropy);
+
+				TextureInfo info;
+				info.format = TextureFormat::RGBA8;
+				info.colorspace = ColorSpace::sRGB;
+				info.compression = compression;
+				info.extents[0] = size;
+				info.extents[1] = size;
+				info.extents[2] = 1;
+				info.mip_levels = 1;
+				info.byte_size = texels.size();
+				std::vector<char> dst(texels.size());
+				Operations operations;
+				operations.pack = [&] { return pack_texture(info, texels.data()); };
+				operations.parse_info = [](AssetFile const& file) { return read_texture_info(file).compression; };
+				operations.unpack = [&](AssetFile const& file) { unpack_texture(read_texture_info(file), file, dst.data(), executor); };
+				results.push_back(run_case(settings, "texture", name, texels.size(), operations));
+			}
+		}
+	}
+}
+
+// A grid of quads: a flat plane, a smooth height field, or random vertices
+static void generate_grid(uint32_t size, Entropy entropy, std::vector<PNTV32Vertex>& vertices, std::vector<uint32_t>& indices) {
+	std::mt19937 rng(size);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	vertices.resize(uint64_t(size) * size);
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			PNTV32Vertex& vertex = vertices[uint64_t(y) * size + x];
+			float const u = float(x) / float(size - 1);
+			float const v = float(y) / float(size - 1);
+			float height = 0.0f;
+			if (entropy == Entropy::Medium) height = 0.1f * std::sin(u * 12.0f) * std::cos(v * 9.0f);
+			else if (entropy == Entropy::High) height = random(rng);
+			vertex.position[0] = u;
+			vertex.position[1] = height;
+			vertex.position[2] = v;
+			vertex.normal[1] = 1.0f;
+			vertex.tangent[0] = 1.0f;
+			if (entropy == Entropy::High) {
+				for (float& n : vertex.normal) n = random(rng);
+				for (float& t : vertex.tangent) t = random(rng);
+			}
+			vertex.uv[0] = u;
+			vertex.uv[1] = v;
+		}
+	}
+	indices.clear();
+	for (uint32_t y = 0; y + 1 < size; ++y) {
+		for (uint32_t x = 0; x + 1 < size; ++x) {
+			uint32_t const corner = y * size + x;
+			uint32_t const quad[6] = { corner, corner + size, corner + 1, corner + 1, corner + size, corner + size + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+static void benchmark_meshes(Settings const& settings, Executor const& executor, std::vector<Result>& results) {
+	// Grid sizes, from 4k to 1M vertices
+	std::vector<uint32_t> sizes = { 64, 256, 1024 };
+	if (settings.quick) sizes.resize(1);
+	for (uint32_t size : sizes) {
+		for (Entropy entropy : entropies) {
+			std::vector<PNTV32Vertex> vertices;
+			std::vector<uint32_t> indices;
+			for (CompressionMode compression : compression_modes) {
+				std::string const name = case_name("mesh", "pntv32_" + std::to_string(size * size), entropy, compression);
+				if (!selected(settings, name)) continue;
+				if (vertices.empty()) generate_grid(size, entropy, vertices, indices);
+
+				MeshInfo info;
+				info.format = VertexFormat::PNTV32;
+				info.compression = compression;
+				info.vertex_count = vertices.size();
+				info.index_count = indices.size();
+				info.index_bits = 32;
+				uint64_t const raw_bytes = vertices.size() * sizeof(PNTV32Vertex) + indices.size() * sizeof(uint32_t);
+				std::vector<PNTV32Vertex> dst_vertices(vertices.size());
+				std::vector<uint32_t> dst_indices(indices.size());
+				Operations operations;
+				operations.pack = [&] { return pack_mesh(info, vertices.data(), indices.data()); };
+				operations.parse_info = [](AssetFile const& file) { return read_mesh_info(file).compression; };
+				operations.unpack = [&](AssetFile const& file) { unpack_mesh(read_mesh_info(file), file, dst_vertices.data(), dst_indices.data(), executor); };
+				results.push_back(run_case(settings, "mesh", name, raw_bytes, operations));
+			}
+		}
+	}
+}
+
+// RGBA16F maps: a smooth sky gradient, a gradient with noise, or uniform noise
+static std::vector<char> generate_map(EnvironmentFormat format, uint64_t texels, uint32_t seed, Entropy entropy) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> random(0.0f, 1.0f);
+	std::vector<float> rgba(texels * 4);
+	for (uint64_t i = 0; i < texels; ++i) {
+		float const gradient = float(i) / float(texels);
+		for (uint32_t c = 0; c < 4; ++c) {
+			float value = gradient * (c + 1);
+			if (entropy == Entropy::Medium) value += 0.05f * random(rng);
+			else if (entropy == Entropy::High) value = 16.0f * random(rng);
+			rgba[i * 4 + c] = value;
+		}
+	}
+	std::vector<char> result(texels * environment_format_byte_size(format));
+	convert_environment_texels(format, rgba.data(), texels, result.data());
+	return result;
+}
+
+static void benchmark_environments(Settings const& settings, Executor const& executor, std::vector<Result>& results) {
+	// Width of the hdr map, which is half as high. The cube maps scale with it.
+	std::vector<uint32_t> sizes = { 512, 2048 };
+	if (settings.quick) sizes.resize(1);
+	for (uint32_t size : sizes) {
+		for (Entropy entropy : entropies) {
+			EnvironmentInfo info;
+			info.format = EnvironmentFormat::RGBA16F;
+			uint32_t const texel_size = environment_format_byte_size(info.format);
+			info.hdr_extents[0] = size;
+			info.hdr_extents[1] = size / 2;
+			info.hdr_bytes = uint64_t(size) * (size / 2) * texel_size;
+			info.irradiance_size = 32;
+			info.irradiance_bytes = 6 * 32 * 32 * texel_size;
+			info.specular_size = size / 4;
+			info.specular_mip_levels = 6;
+			info.specular_bytes = environment_specular_byte_size(info, EnvironmentLayout{});
+
+			std::vector<char> hdr, irradiance, specular;
+			for (CompressionMode compression : compression_modes) {
+				std::string const name = case_name("environment", "rgba16f_" + std::to_string(size), entropy, compression);
+				if (!selected(settings, name)) continue;
+				if (hdr.empty()) {
+					hdr = generate_map(info.format, info.hdr_bytes / texel_size, 1, entropy);
+					irradiance = generate_map(info.format, info.irradiance_bytes / texel_size, 2, entropy);
+					specular = generate_map(info.format, info.specular_bytes / texel_size, 3, entropy);
+				}
+
+				info.compression = compression;
+				uint64_t const raw_bytes = hdr.size() + irradiance.size() + specular.size();
+				std::vector<char> dst(raw_bytes);
+				Operations operations;
+				operations.pack = [&] { return pack_environment(info, hdr.data(), irradiance.data(), specular.data()); };
+				operations.parse_info = [](AssetFile const& file) { return read_environment_info(file).compression; };
+				operations.unpack = [&](AssetFile const& file) {
+					EnvironmentInfo const read = read_environment_info(file);
+					unpack_environment(read, file, dst.data(), dst.data() + read.hdr_bytes, dst.data() + read.hdr_bytes + read.irradiance_bytes, executor);
+				};
+				results.push_back(run_case(settings, "environment", name, raw_bytes, operations));
+			}
+		}
+	}
+}
+
+static double megabytes_per_second(uint64_t bytes, double seconds) {
+	return seconds > 0.0 ? double(bytes) / seconds / 1e6 : 0.0;
+}
+
+static void print_table(std::vector<Result> const& results) {
+	std::printf("%-40s %-8s %7s %10s %10s %10s %10s %10s %10s %10s\n", "case", "stored", "ratio", "pack", "save", "load", "info", "info us", "unpack", "heap MB");
+	for (Result const& result : results) {
+		std::printf("%-40s %-8s %7.3f %10.1f %10.1f %10.1f %10.1f %10.2f %10.1f %10.1f\n", result.name.c_str(),
+			compression_to_string(result.compression).c_str(),
+			double(result.file_bytes) / double(result.raw_bytes),
+			megabytes_per_second(result.raw_bytes, result.pack_seconds),
+			megabytes_per_second(result.file_bytes, result.save_seconds),
+			megabytes_per_second(result.file_bytes, result.load_seconds),
+			megabytes_per_second(result.metadata_bytes, result.info_seconds),
+			result.info_seconds * 1e6,
+			megabytes_per_second(result.raw_bytes, result.unpack_seconds),
+			double(result.peak_heap) / 1e6);
+	}
+	std::printf("throughput in MB/s, peak resident memory %.1f MB\n", double(peak_rss()) / 1e6);
+}
+
+static std::string version_string(uint32_t version) {
+	return std::to_string(major_version(version)) + "." + std::to_string(minor_version(version)) + "." + std::to_string(patch_version(version));
+}
+
+static std::string results_json(Settings const& settings, uint32_t threads, std::vector<Result> const& results) {
+	json::JSON json{};
+	json["schema"] = 1;
+	json["threads"] = threads;
+	json["repeat"] = settings.repeat;
+	json["quick"] = settings.quick;
+	json["versions"]["itex"] = version_string(itex_version);
+	json["versions"]["mesh"] = version_string(mesh_version);
+	json["versions"]["ienv"] = version_string(ienv_version);
+	json["peak_rss_bytes"] = peak_rss();
+	json["results"] = json::Array();
+	for (Result const& result : results) {
+		json::JSON entry{};
+		entry["asset"] = result.asset;
+		entry["name"] = result.name;
+		entry["compression"] = compression_to_string(result.compression);
+		entry["raw_bytes"] = result.raw_bytes;
+		entry["file_bytes"] = result.file_bytes;
+		entry["ratio"] = double(result.file_bytes) / double(result.raw_bytes);
+		entry["pack_mb_s"] = megabytes_per_second(result.raw_bytes, result.pack_seconds);
+		entry["save_mb_s"] = megabytes_per_second(result.file_bytes, result.save_seconds);
+		entry["load_mb_s"] = megabytes_per_second(result.file_bytes, result.load_seconds);
+		entry["info_parse_mb_s"] = megabytes_per_second(result.metadata_bytes, result.info_seconds);
+		entry["info_parse_us"] = result.info_seconds * 1e6;
+		entry["unpack_mb_s"] = megabytes_per_second(result.raw_bytes, result.unpack_seconds);
+		entry["peak_heap_bytes"] = result.peak_heap;
+		json["results"].append(entry);
+	}
+	return json.dump();
+}
+
+static bool parse_arguments(int argc, char** argv, Settings& settings) {
+	for (int i = 1; i < argc; ++i) {
+		std::string const argument = argv[i];
+		bool const has_value = i + 1 < argc;
+		if (argument == "--quick") {
+			settings.quick = true;
+		} else if (argument == "--json" && has_value) {
+			settings.json_path = argv[++i];
+		} else if (argument == "--filter" && has_value) {
+			settings.filter = argv[++i];
+		} else if (argument == "--repeat" && has_value) {
+			settings.repeat = std::max(std::atoi(argv[++i]), 1);
+		} else if (argument == "--threads" && has_value) {
+			settings.threads = std::max(std::atoi(argv[++i]), 0);
+		} else if (argument == "--dir" && has_value) {
+			settings.dir = argv[++i];
+		} else {
+			std::fprintf(stderr, "Unknown argument %s\n"
+				"Usage: assetlib_benchmark [--json <path>] [--quick] [--filter <text>] [--repeat <n>] [--threads <n>] [--dir <path>]\n", argument.c_str());
+			return false;
+		}
+	}
+	if (settings.dir.empty()) settings.dir = std::filesystem::temp_directory_path();
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Settings settings;
+	if (!parse_arguments(argc, argv, settings)) return 1;
+
+	ThreadPool pool(settings.threads);
+	Executor const executor = pool.executor();
+	std::vector<Result> results;
+	benchmark_textures(settings, executor, results);
+	benchmark_meshes(settings, executor, results);
+	benchmark_environments(settings, executor, results);
+
+	if (settings.json_path != "-") print_table(results);
+	if (settings.json_path.empty()) return 0;
+
+	std::string const json = results_json(settings, pool.thread_count(), results);
+	if (settings.json_path == "-") {
+		std::printf("%s\n", json.c_str());
+		return 0;
+	}
+	FILE* out = std::fopen(settings.json_path.c_str(), "wb");
+	if (!out) {
+		std::fprintf(stderr, "Could not open %s\n", settings.json_path.c_str());
+		return 1;
+	}
+	bool const ok = std::fwrite(json.data(), 1, json.size(), out) == json.size();
+	return std::fclose(out) == 0 && ok ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+// Batch cooker of assetlib. Packs every asset listed in a json manifest, spread over all cores, and keeps a content
+// addressed cache so that a recook only packs the assets whose inputs or settings changed.
+//
+// Usage: assetlib_cook <manifest> [options]
+//   --cache <dir>     Cache directory. Defaults to cache_dir from the manifest, or .cook_cache in the output directory.
+//   --threads <n>     Worker threads. 0, the default, uses every hardware thread.
+//   --force           Packs every asset again without looking at the cache. The results still go to the cache.
+//
+// Manifest, paths are relative to the directory of the manifest:
+// {
+//   "output_dir": "cooked",
+//   "cache_dir": "cooked/.cook_cache",
+//   "assets": [
+//     { "type": "texture", "output": "rock.itex", "input": "rock.rgba", "format": "RGBA8", "width": 1024, "height": 1024,
+//       "color_space": "sRGB", "mips": true, "mip_filter": "Kaiser", "encode": "BC7", "quality": "Normal",
+//       "compression": "LZ4", "compression_level": 0, "tile_size": 0 },
+//     { "type": "mesh", "output": "rock.mesh", "vertices": "rock.vtx", "indices": "rock.idx", "index_bits": 32,
+//       "vertex_format": "PNTV16N", "optimize": true, "max_meshlet_vertices": 64, "compression": "LZ4" },
+//     { "type": "environment", "output": "sky.ienv", "hdr": "sky.hdr", "irradiance": "sky_irradiance.bin",
+//       "specular": "sky_specular.bin", "format": "rgba16f", "hdr_width": 2048, "hdr_height": 1024, "irradiance_size": 32,
+//       "specular_size": 256, "specular_mip_levels": 9, "irradiance_storage": "Cubemap", "compression": "LZ4" }
+//   ]
+// }
+// Only type, output, the inputs and the extents are required. Inputs are raw data without any header:
+//   texture      Mip 0 in format, one of R8, RG8, RGB8 and RGBA8, rows tightly packed. mips generates the mip chain
+//                (default true), encode block compresses the result to BC1, BC3, BC4, BC5 or BC7.
+//   mesh         PNTV32 vertices, and indices of index_bits bits. Vertices are quantized to vertex_format.
+//   environment  RGBA32F texels of every map, converted to format. There is no irradiance input with "SH9" storage.
+//
+// The cache key of an asset is an XXH64 hash of its raw inputs, its settings in the manifest and the format version
+// of its type from versions.hpp. Cooked files are kept in the cache under their key, and cook_state.json in the cache
+// records the key every output was last cooked from. An asset is skipped if its output exists and was cooked from the
+// same key, and copied from the cache if an earlier cook or another output with the same key already packed it.
+
+#include <assetlib/asset_file.hpp>
+#include <assetlib/block_compression.hpp>
+#include <assetlib/environment.hpp>
+#include <assetlib/mesh.hpp>
+#include <assetlib/mesh_optimizer.hpp>
+#include <assetlib/mipmap.hpp>
+#include <assetlib/texture.hpp>
+#include <assetlib/thread_pool.hpp>
+#include <assetlib/versions.hpp>
+
+#include <json.hpp>
+#include <plib/stream.hpp>
+#include <xxhash.h>
+
+#include <bit>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace assetlib;
+
+// Part of every cache key. Bump when the cooker starts packing the same inputs differently.
+constexpr uint32_t cook_version = 1;
+
+struct Options {
+	std::filesystem::path manifest;
+	std::filesystem::path cache_dir;
+	uint32_t threads = 0;
+	bool force = false;
+};
+
+enum class CookResult {
+	Failed,
+	UpToDate,
+	FromCache,
+	Cooked
+};
+
+struct Asset {
+	json::JSON entry;
+	std::string type;
+	std::string output;
+	uint64_t key = 0;
+	CookResult result = CookResult::Failed;
+	std::string error;
+	double seconds = 0.0;
+};
+
+static void print_usage() {
+	std::printf("Usage: assetlib_cook <manifest> [--cache <dir>] [--threads <n>] [--force]\n");
+}
+
+static bool parse_options(int argc, char** argv, Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		bool const has_value = i + 1 < argc;
+		if (arg == "--cache" && has_value) {
+			options.cache_dir = argv[++i];
+		} else if (arg == "--threads" && has_value) {
+			options.threads = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--force") {
+			options.force = true;
+		} else if (!arg.starts_with("--") && options.manifest.empty()) {
+			options.manifest = arg;
+		} else {
+			return false;
+		}
+	}
+	return !options.manifest.empty();
+}
+
+static bool read_file(std::filesystem::path const& path, std::vector<char>& data) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) return false;
+	in.seekg(0, std::ios::end);
+	data.resize(static_cast<size_t>(in.tellg()));
+	in.seekg(0, std::ios::beg);
+	return static_cast<bool>(in.read(data.data(), data.size()));
+}
+
+static std::string key_to_string(uint64_t key) {
+	char result[17];
+	std::snprintf(result, sizeof(result), "%016" PRIx64, key);
+	return result;
+}
+
+// SimpleJSON only converts numbers that were written as the type asked for
+static double get_number(json::JSON& entry, char const* name, double fallback) {
+	if (!entry.hasKey(name)) return fallback;
+	json::JSON& value = entry[name];
+	if (value.JSONType() == json::JSON::Class::Floating) return value.ToFloat();
+	if (value.JSONType() == json::JSON::Class::Integral) return double(value.ToInt());
+	return fallback;
+}
+
+static uint32_t get_uint(json::JSON& entry, char const* name, uint32_t fallback) {
+	return static_cast<uint32_t>(get_number(entry, name, fallback));
+}
+
+static std::string get_string(json::JSON& entry, char const* name, std::string const& fallback) {
+	return entry.hasKey(name) ? entry[name].ToString() : fallback;
+}
+
+static bool get_bool(json::JSON& entry, char const* name, bool fallback) {
+	return entry.hasKey(name) ? entry[name].ToBool() : fallback;
+}
+
+static TextureFormat parse_texture_format(std::string const& format) {
+	char const* const names[] = { "R8", "RG8", "RGB8", "RGBA8", "BC1", "BC3", "BC4", "BC5", "BC7" };
+	TextureFormat const formats[] = { TextureFormat::R8, TextureFormat::RG8, TextureFormat::RGB8, TextureFormat::RGBA8,
+		TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC4, TextureFormat::BC5, TextureFormat::BC7 };
+	for (size_t i = 0; i < std::size(names); ++i) {
+		if (format == names[i]) return formats[i];
+	}
+	return TextureFormat::Unknown;
+}
+
+static VertexFormat parse_vertex_format(std::string const& format) {
+	if (format == "PNTV32") return VertexFormat::PNTV32;
+	if (format == "PNTV16N") return VertexFormat::PNTV16N;
+	if (format == "PNTV16H") return VertexFormat::PNTV16H;
+	return VertexFormat::Unknown;
+}
+
+static EnvironmentFormat parse_environment_format(std::string const& format) {
+	if (format == "rgba32f") return EnvironmentFormat::RGBA32F;
+	if (format == "rgba16f") return EnvironmentFormat::RGBA16F;
+	if (format == "rgb9e5") return EnvironmentFormat::RGB9E5;
+	if (format == "r11g11b10f") return EnvironmentFormat::R11G11B10F;
+	return EnvironmentFormat::Unknown;
+}
+
+// Manifest fields naming the input files of every asset type
+static std::vector<char const*> input_fields(std::string const& type, json::JSON& entry) {
+	if (type == "texture") return { "input" };
+	if (type == "mesh") return { "vertices", "indices" };
+	if (type == "environment") {
+		if (get_string(entry, "irradiance_storage", "Cubemap") == "SH9") return { "hdr", "specular" };
+		return { "hdr", "irradiance", "specular" };
+	}
+	return {};
+}
+
+static uint32_t format_version(std::string const& type) {
+	if (type == "texture") return itex_version;
+	if (type == "mesh") return mesh_version;
+	return ienv_version;
+}
+
+// Settings of the asset without the paths, so renaming or moving files doesn't invalidate the cache
+static std::string settings_string(json::JSON const& entry, std::vector<char const*> const& inputs) {
+	json::JSON settings = entry;
+	settings["output"] = "";
+	for (char const* field : inputs) settings[field] = "";
+	return settings.dump(0, "");
+}
+
+static uint64_t cache_key(std::string const& type, std::string const& settings, std::vector<std::vector<char>> const& inputs) {
+	XXH64_state_t* state = XXH64_createState();
+	XXH64_reset(state, 0);
+	uint32_t const versions[] = { cook_version, format_version(type) };
+	XXH64_update(state, versions, sizeof(versions));
+	XXH64_update(state, settings.data(), settings.size());
+	for (std::vector<char> const& input : inputs) {
+		// Sizes keep the boundaries between inputs part of the key
+		uint64_t const size = input.size();
+		XXH64_update(state, &size, sizeof(size));
+		XXH64_update(state, input.data(), input.size());
+	}
+	uint64_t const key = XXH64_digest(state);
+	XXH64_freeState(state);
+	return key;
+}
+
+static bool size_error(char const* input, size_t size, uint64_t expected, std::string& error) {
+	error = std::string(input) + " holds " + std::to_string(size) + " bytes, expected " + std::to_string(expected);
+	return false;
+}
+
+static bool cook_texture(json::JSON& entry, std::vector<std::vector<char>>& inputs, Executor const& executor, AssetFile& file, std::string& error) {
+	TextureInfo info{};
+	info.format = parse_texture_format(get_string(entry, "format", "RGBA8"));
+	if (info.format == TextureFormat::Unknown || is_block_compressed(info.format)) {
+		error = "format must be one of R8, RG8, RGB8 and RGBA8";
+		return false;
+	}
+	info.colorspace = get_string(entry, "color_space", "RGB") == "sRGB" ? ColorSpace::sRGB : ColorSpace::RGB;
+	info.extents[0] = get_uint(entry, "width", 0);
+	info.extents[1] = get_uint(entry, "height", 0);
+	info.mip_levels = 1;
+	info.byte_size = texture_mip_byte_size(info, 0);
+	info.compression = parse_compression_mode(get_string(entry, "compression", "LZ4"));
+	info.compression_level = get_uint(entry, "compression_level", 0);
+	info.tile_size = get_uint(entry, "tile_size", 0);
+	if (info.extents[0] == 0 || info.extents[1] == 0) {
+		error = "width and height are required";
+		return false;
+	}
+	if (inputs[0].size() != info.byte_size) return size_error("input", inputs[0].size(), info.byte_size, error);
+
+	std::vector<char> pixels = std::move(inputs[0]);
+	if (get_bool(entry, "mips", true)) {
+		MipSettings settings;
+		settings.filter = get_string(entry, "mip_filter", "Box") == "Kaiser" ? MipFilter::Kaiser : MipFilter::Box;
+		pixels = generate_mips(info, pixels.data(), settings, executor);
+	}
+	if (entry.hasKey("encode")) {
+		TextureFormat const format = parse_texture_format(entry["encode"].ToString());
+		if (!is_block_compressed(format)) {
+			error = "encode must be one of BC1, BC3, BC4, BC5 and BC7";
+			return false;
+		}
+		if (info.tile_size % 4 != 0) {
+			error = "tile_size of block compressed textures must be a multiple of 4";
+			return false;
+		}
+		std::string const quality = get_string(entry, "quality", "Normal");
+		BlockCompressionQuality const level = quality == "Fast" ? BlockCompressionQuality::Fast
+			: quality == "High" ? BlockCompressionQuality::High : BlockCompressionQuality::Normal;
+		pixels = encode_texture(info, pixels.data(), format, level, executor);
+	}
+	pack_texture(info, pixels.data(), file);
+	return true;
+}
+
+static bool cook_mesh(json::JSON& entry, std::vector<std::vector<char>>& inputs, AssetFile& file, std::string& error) {
+	MeshInfo info{};
+	info.index_bits = get_uint(entry, "index_bits", 32);
+	if (info.index_bits != 16 && info.index_bits != 32) {
+		error = "index_bits must be 16 or 32";
+		return false;
+	}
+	VertexFormat const format = parse_vertex_format(get_string(entry, "vertex_format", "PNTV32"));
+	if (format == VertexFormat::Unknown) {
+		error = "vertex_format must be one of PNTV32, PNTV16N and PNTV16H";
+		return false;
+	}
+	std::vector<char>& vertices = inputs[0];
+	std::vector<char>& indices = inputs[1];
+	uint32_t const index_size = info.index_bits / 8;
+	if (vertices.empty() || vertices.size() % sizeof(PNTV32Vertex) != 0) {
+		return size_error("vertices", vertices.size(), (vertices.size() / sizeof(PNTV32Vertex) + 1) * sizeof(PNTV32Vertex), error);
+	}
+	if (indices.empty() || indices.size() % (3 * index_size) != 0) {
+		return size_error("indices", indices.size(), (indices.size() / (3 * index_size) + 1) * 3 * index_size, error);
+	}
+	info.vertex_count = vertices.size() / sizeof(PNTV32Vertex);
+	info.index_count = indices.size() / index_size;
+	for (uint32_t i = 0; i < info.index_count; ++i) {
+		uint32_t index = 0;
+		std::memcpy(&index, indices.data() + uint64_t(i) * index_size, index_size);
+		if (index >= info.vertex_count) {
+			error = "index " + std::to_string(index) + " is out of range";
+			return false;
+		}
+	}
+	info.compression = parse_compression_mode(get_string(entry, "compression", "LZ4"));
+	info.compression_level = get_uint(entry, "compression_level", 0);
+	info.max_meshlet_vertices = get_uint(entry, "max_meshlet_vertices", 0);
+	info.max_meshlet_triangles = get_uint(entry, "max_meshlet_triangles", 0);
+
+	// Optimized while still PNTV32, so positions are available for the overdraw order
+	if (get_bool(entry, "optimize", false)) {
+		MeshOptimizeSettings settings;
+		settings.optimize_overdraw = get_bool(entry, "optimize_overdraw", false);
+		optimize_mesh(info, vertices.data(), indices.data(), settings);
+	}
+	if (format != VertexFormat::PNTV32) {
+		info.format = format;
+		std::vector<char> quantized(uint64_t(info.vertex_count) * vertex_byte_size(format));
+		quantize_vertices(info, reinterpret_cast<PNTV32Vertex const*>(vertices.data()), quantized.data());
+		vertices = std::move(quantized);
+	}
+	pack_mesh(info, vertices.data(), indices.data(), file);
+	return true;
+}
+
+static bool cook_environment(json::JSON& entry, std::vector<std::vector<char>>& inputs, Executor const& executor, AssetFile& file, std::string& error) {
+	EnvironmentInfo info{};
+	info.format = parse_environment_format(get_string(entry, "format", "rgba16f"));
+	if (info.format == EnvironmentFormat::Unknown) {
+		error = "format must be one of rgba32f, rgba16f, rgb9e5 and r11g11b10f";
+		return false;
+	}
+	bool const sh9 = get_string(entry, "irradiance_storage", "Cubemap") == "SH9";
+	info.irradiance_storage = sh9 ? IrradianceStorage::SH9 : IrradianceStorage::Cubemap;
+	info.hdr_extents[0] = get_uint(entry, "hdr_width", 0);
+	info.hdr_extents[1] = get_uint(entry, "hdr_height", 0);
+	info.irradiance_size = sh9 ? 0 : get_uint(entry, "irradiance_size", 0);
+	info.specular_size = get_uint(entry, "specular_size", 0);
+	info.specular_mip_levels = get_uint(entry, "specular_mip_levels", 1);
+	info.compression = parse_compression_mode(get_string(entry, "compression", "LZ4"));
+	info.compression_level = get_uint(entry, "compression_level", 0);
+	if (info.hdr_extents[0] == 0 || info.hdr_extents[1] == 0 || info.specular_size == 0 || (!sh9 && info.irradiance_size == 0)) {
+		error = "hdr_width, hdr_height, specular_size and irradiance_size are required";
+		return false;
+	}
+	if (info.specular_mip_levels > uint32_t(std::bit_width(info.specular_size))) {
+		error = "more specular mip levels than specular_size allows";
+		return false;
+	}
+
+	uint32_t const texel_size = environment_format_byte_size(info.format);
+	constexpr uint32_t source_texel_size = 4 * sizeof(float);
+	info.hdr_bytes = info.hdr_extents[0] * info.hdr_extents[1] * texel_size;
+	info.irradiance_bytes = 6 * info.irradiance_size * info.irradiance_size * texel_size;
+	info.specular_bytes = environment_specular_byte_size(info, EnvironmentLayout{});
+
+	std::vector<char> const& hdr = inputs[0];
+	std::vector<char> const& specular = inputs.back();
+	if (hdr.size() != uint64_t(info.hdr_bytes) / texel_size * source_texel_size) {
+		return size_error("hdr", hdr.size(), uint64_t(info.hdr_bytes) / texel_size * source_texel_size, error);
+	}
+	if (!sh9 && inputs[1].size() != uint64_t(info.irradiance_bytes) / texel_size * source_texel_size) {
+		return size_error("irradiance", inputs[1].size(), uint64_t(info.irradiance_bytes) / texel_size * source_texel_size, error);
+	}
+	if (specular.size() != uint64_t(info.specular_bytes) / texel_size * source_texel_size) {
+		return size_error("specular", specular.size(), uint64_t(info.specular_bytes) / texel_size * source_texel_size, error);
+	}
+	float const* irradiance = sh9 ? nullptr : reinterpret_cast<float const*>(inputs[1].data());
+	pack_environment(info, reinterpret_cast<float const*>(hdr.data()), irradiance, reinterpret_cast<float const*>(specular.data()), executor, file);
+	return true;
+}
+
+// Writes next to the final path first, so an interrupted cook never leaves a truncated file in the cache.
+// Assets with the same key may be cooked at the same time, each one writes its own temporary file.
+static bool save_cache_file(std::filesystem::path const& path, AssetFile const& file, size_t asset_index) {
+	std::filesystem::path const temporary = path.string() + "." + std::to_string(asset_index) + ".tmp";
+	{
+		plib::binary_output_stream out = plib::binary_output_stream::from_file(temporary.string());
+		if (!save_binary_file(out, file)) return false;
+	}
+	std::error_code ec;
+	uint64_t const expected = asset_file_header_size + file.metadata_json.size() + file.binary_blob.size();
+	if (std::filesystem::file_size(temporary, ec) != expected || ec) return false;
+	std::filesystem::rename(temporary, path, ec);
+	return !ec;
+}
+
+static char const* extension(std::string const& type) {
+	if (type == "texture") return ".itex";
+	if (type == "mesh") return ".mesh";
+	return ".ienv";
+}
+
+struct Cooker {
+	std::filesystem::path base_dir;
+	std::filesystem::path output_dir;
+	std::filesystem::path cache_dir;
+	bool force = false;
+	// Key every output was last cooked from
+	std::unordered_map<std::string, std::string> state;
+	ThreadPool* pool = nullptr;
+
+	void cook(Asset& asset, size_t index) const;
+};
+
+void Cooker::cook(Asset& asset, size_t index) const {
+	std::vector<char const*> const fields = input_fields(asset.type, asset.entry);
+	if (fields.empty()) {
+		asset.error = "unknown type \"" + asset.type + "\"";
+		return;
+	}
+	std::vector<std::vector<char>> inputs(fields.size());
+	for (size_t i = 0; i < fields.size(); ++i) {
+		std::filesystem::path const path = base_dir / get_string(asset.entry, fields[i], "");
+		if (!asset.entry.hasKey(fields[i]) || !read_file(path, inputs[i])) {
+			asset.error = std::string("can't read ") + fields[i] + " " + path.string();
+			return;
+		}
+	}
+
+	asset.key = cache_key(asset.type, settings_string(asset.entry, fields), inputs);
+	std::string const key = key_to_string(asset.key);
+	std::filesystem::path const output = output_dir / asset.output;
+	std::filesystem::path const cached = cache_dir / (key + extension(asset.type));
+	std::error_code ec;
+	if (!force) {
+		auto const previous = state.find(asset.output);
+		if (previous != state.end() && previous->second == key && std::filesystem::exists(output, ec)) {
+			asset.result = CookResult::UpToDate;
+			return;
+		}
+	}
+
+	if (force || !std::filesystem::exists(cached, ec)) {
+		AssetFile file;
+		Executor const executor = pool->executor();
+		bool ok = false;
+		if (asset.type == "texture") ok = cook_texture(asset.entry, inputs, executor, file, asset.error);
+		else if (asset.type == "mesh") ok = cook_mesh(asset.entry, inputs, file, asset.error);
+		else ok = cook_environment(asset.entry, inputs, executor, file, asset.error);
+		if (!ok) return;
+		if (!save_cache_file(cached, file, index)) {
+			asset.error = "can't write " + cached.string();
+			return;
+		}
+		asset.result = CookResult::Cooked;
+	} else {
+		asset.result = CookResult::FromCache;
+	}
+
+	std::filesystem::create_directories(output.parent_path(), ec);
+	if (!std::filesystem::copy_file(cached, output, std::filesystem::copy_options::overwrite_existing, ec)) {
+		asset.error = "can't write " + output.string();
+		asset.result = CookResult::Failed;
+	}
+}
+
+static std::unordered_map<std::string, std::string> load_state(std::filesystem::path const& path) {
+	std::unordered_map<std::string, std::string> state;
+	std::vector<char> data;
+	if (!read_file(path, data)) return state;
+	json::JSON json = json::JSON::Load(std::string(data.begin(), data.end()));
+	if (!json.hasKey("outputs")) return state;
+	for (auto& output : json["outputs"].ObjectRange()) {
+		state[output.first] = output.second.ToString();
+	}
+	return state;
+}
+
+static bool save_state(std::filesystem::path const& path, std::vector<Asset> const& assets) {
+	json::JSON json;
+	json["cook_version"] = cook_version;
+	json["outputs"] = json::Object();
+	for (Asset const& asset : assets) {
+		if (asset.result != CookResult::Failed) json["outputs"][asset.output] = key_to_string(asset.key);
+	}
+	std::ofstream out(path, std::ios::binary);
+	out << json.dump();
+	return static_cast<bool>(out);
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 1;
+	}
+
+	std::vector<char> manifest_data;
+	if (!read_file(options.manifest, manifest_data)) {
+		std::fprintf(stderr, "can't read %s\n", options.manifest.string().c_str());
+		return 1;
+	}
+	json::JSON manifest = json::JSON::Load(std::string(manifest_data.begin(), manifest_data.end()));
+	if (!manifest.hasKey("assets") || manifest["assets"].JSONType() != json::JSON::Class::Array) {
+		std::fprintf(stderr, "%s has no assets array\n", options.manifest.string().c_str());
+		return 1;
+	}
+
+	Cooker cooker;
+	cooker.base_dir = options.manifest.parent_path();
+	cooker.output_dir = cooker.base_dir / get_string(manifest, "output_dir", "");
+	cooker.cache_dir = !options.cache_dir.empty() ? options.cache_dir
+		: manifest.hasKey("cache_dir") ? cooker.base_dir / manifest["cache_dir"].ToString() : cooker.output_dir / ".cook_cache";
+	cooker.force = options.force;
+	std::error_code ec;
+	std::filesystem::create_directories(cooker.cache_dir, ec);
+	if (ec) {
+		std::fprintf(stderr, "can't create %s\n", cooker.cache_dir.string().c_str());
+		return 1;
+	}
+	std::filesystem::path const state_path = cooker.cache_dir / "cook_state.json";
+	cooker.state = load_state(state_path);
+
+	std::vector<Asset> assets;
+	for (json::JSON& entry : manifest["assets"].ArrayRange()) {
+		Asset asset;
+		asset.entry = entry;
+		asset.type = get_string(entry, "type", "");
+		asset.output = get_string(entry, "output", "");
+		assets.push_back(std::move(asset));
+	}
+	std::unordered_map<std::string, size_t> outputs;
+	for (size_t i = 0; i < assets.size(); ++i) {
+		if (assets[i].output.empty() || !outputs.emplace(assets[i].output, i).second) {
+			std::fprintf(stderr, "asset %zu has no output, or the same output as another asset\n", i);
+			return 1;
+		}
+	}
+
+	// Assets are cooked in parallel, and every asset also spreads its own mip generation, block compression and
+	// conversion over the pool
+	ThreadPool pool(options.threads);
+	cooker.pool = &pool;
+	std::mutex print_mutex;
+	auto const start = std::chrono::steady_clock::now();
+	pool.parallel_for(assets.size(), [&](uint32_t i) {
+		Asset& asset = assets[i];
+		auto const asset_start = std::chrono::steady_clock::now();
+		cooker.cook(asset, i);
+		asset.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - asset_start).count();
+
+		char const* const results[] = { "failed", "up to date", "from cache", "cooked" };
+		std::lock_guard lock(print_mutex);
+		std::printf("%-10s %s (%.0f ms)%s%s\n", results[static_cast<int>(asset.result)], asset.output.c_str(), asset.seconds * 1000.0,
+			asset.error.empty() ? "" : ": ", asset.error.c_str());
+	});
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint32_t counts[4]{};
+	for (Asset const& asset : assets) ++counts[static_cast<int>(asset.result)];
+	if (!save_state(state_path, assets)) {
+		std::fprintf(stderr, "can't write %s\n", state_path.string().c_str());
+	}
+	std::printf("%zu assets in %.2f s: %u cooked, %u from cache, %u up to date, %u failed\n", assets.size(), seconds,
+		counts[static_cast<int>(CookResult::Cooked)], counts[static_cast<int>(CookResult::FromCache)],
+		counts[static_cast<int>(CookResult::UpToDate)], counts[static_cast<int>(CookResult::Failed)]);
+	return counts[static_cast<int>(CookResult::Failed)] == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <assetlib/asset_file.hpp>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace assetlib {
+
+// An archive packs many asset files into a single file. It is laid out as follows:
+//	ArchiveHeader
+//	ArchiveEntry[entry_count]: table of contents, sorted in the order assets were added
+//	uint32_t buckets[bucket_count]: open addressing hash table indexed by asset id. Holds entry index + 1, or 0 for empty buckets.
+//	names: all asset names, not null terminated
+//	asset files, each stored exactly like save_binary_file() writes them, starting at a multiple of alignment.
+// Everything needed to locate an asset and build a view of it lives in the table of contents,
+// so looking up an asset never touches the data of other assets.
+
+struct ArchiveHeader {
+	// Always "AARC"
+	char magic[4]{};
+	uint32_t version = 0;
+	uint32_t entry_count = 0;
+	// Always a power of two
+	uint32_t bucket_count = 0;
+	uint32_t alignment = 0;
+	uint32_t names_size = 0;
+	uint64_t names_offset = 0;
+	uint64_t data_offset = 0;
+};
+
+struct ArchiveEntry {
+	// Unique id of the asset, by default the hash of its name (see archive_id()).
+	uint64_t id = 0;
+	// Offset of the asset file from the start of the archive.
+	uint64_t offset = 0;
+	uint32_t name_offset = 0;
+	uint32_t name_length = 0;
+	char type[4]{};
+	uint32_t version = 0;
+	uint32_t metadata_size = 0;
+	uint32_t blob_size = 0;
+};
+
+// Computes the id used to look up an asset by name.
+uint64_t archive_id(std::string_view name);
+
+class ArchiveBuilder {
+public:
+	// Each asset file will start at a multiple of alignment bytes. Must be a power of two.
+	explicit ArchiveBuilder(uint32_t alignment = 4096);
+
+	// Adds a copy of an asset to the archive, identified by archive_id(name).
+	void add(std::string_view name, AssetFileView const& file);
+	// Adds a copy of an asset to the archive with an explicit id, for example a GUID. The name may be empty.
+	void add(uint64_t id, std::string_view name, AssetFileView const& file);
+
+	uint32_t size() const { return static_cast<uint32_t>(entries.size()); }
+
+	bool write(plib::binary_output_stream& out) const;
+
+private:
+	struct PendingEntry {
+		uint64_t id;
+		std::string name;
+		AssetFile file;
+	};
+
+	uint32_t alignment;
+	std::vector<PendingEntry> entries;
+};
+
+class Archive {
+public:
+	// Maps the archive at path. Returns false if it could not be mapped or is not a valid archive.
+	bool open(std::filesystem::path const& path);
+	void close();
+
+	uint32_t size() const { return header.entry_count; }
+
+	// Looks up an asset in O(1). Returns nothing if the archive does not contain it.
+	std::optional<AssetFileView> find(std::string_view name) const;
+	std::optional<AssetFileView> find(uint64_t id) const;
+
+	// Access to the table of contents, for iterating over all assets.
+	ArchiveEntry const& entry(uint32_t index) const;
+	std::string_view name(ArchiveEntry const& entry) const;
+	AssetFileView view(ArchiveEntry const& entry) const;
+
+private:
+	ArchiveEntry const* find_entry(uint64_t id, std::string_view name, bool check_name) const;
+
+	MappedFile mapping;
+	ArchiveHeader header{};
+	ArchiveEntry const* entries = nullptr;
+	uint32_t const* buckets = nullptr;
+	char const* names = nullptr;
+};
+
+// Registers every dictionary ("DICT" asset) in the archive with register_dictionary(), so the other assets in it
+// can be unpacked. Returns the number of dictionaries found.
+uint32_t register_dictionaries(Archive const& archive);
+
+}
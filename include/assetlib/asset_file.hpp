@@ -1,19 +1,32 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <span>
+#include <filesystem>
 #include <cstdint>
+#include <fstream>
+#include <assetlib/scratch_buffer.hpp>
 #include <assetlib/versions.hpp>
 
 #include <plib/stream.hpp>
 
 namespace assetlib {
 
+// Values are stored in asset files, so they may never change.
 enum class CompressionMode {
-	None,
-	LZ4
+	None = 0,
+	LZ4 = 1,
+	// LZ4 high compression. Packs a lot slower than LZ4 with a better ratio, but unpacks just as fast.
+	LZ4HC = 2,
+	// Only valid when packing. Picks the mode and level with the lowest expected load time, see choose_compression().
+	Auto = 3
 };
 
+// Compression modes starting at this value are free for codecs registered with register_codec().
+constexpr uint32_t first_custom_compression_mode = 128;
+
 std::string compression_to_string(CompressionMode compression);
 CompressionMode parse_compression_mode(std::string_view compression);
 
@@ -26,13 +39,146 @@ struct AssetFile {
 	char type[4];
 	// Version of the binary file format.
 	uint32_t version;
-	// json description of the asset
+	// Metadata of the asset. Older revisions of each asset type store a json description here.
+	// Newer revisions start with a binary info block (see BinaryInfoHeader), optionally followed by json.
 	std::string metadata_json;
 	// Binary buffer with all the raw data
 	std::vector<char> binary_blob;
 };
 
+// Start of every binary info block. A binary info block holds everything needed to load an asset in a fixed layout,
+// so it can be read with a single copy instead of parsing json. Revisions only ever append fields to a block,
+// so older blocks can be read by copying the bytes they have and leaving the rest zeroed.
+struct BinaryInfoHeader {
+	// Always "BINF"
+	char magic[4]{};
+	// Size of the whole info block in bytes, including this header.
+	uint32_t size = 0;
+};
+
+// Non-owning view of an asset file. The metadata and the binary blob point into memory owned elsewhere,
+// usually a MappedFile or an AssetFile. A view is only valid for as long as that memory is.
+struct AssetFileView {
+	char type[4]{};
+	uint32_t version = 0;
+	std::string_view metadata_json;
+	std::span<const char> binary_blob;
+};
+
+// Read-only memory mapping of a file on disk. Pages are only read from disk once they are accessed.
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(MappedFile const&) = delete;
+	MappedFile(MappedFile&& rhs) noexcept;
+	MappedFile& operator=(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile&& rhs) noexcept;
+	~MappedFile();
+
+	// Maps the file at path, unmapping any previously mapped file. Returns false if the file could not be mapped.
+	bool open(std::filesystem::path const& path);
+	void close();
+
+	bool is_open() const { return data_ != nullptr; }
+	std::span<const char> data() const { return { data_, size_ }; }
+
+private:
+	char const* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void* file_handle_ = nullptr;
+	void* mapping_handle_ = nullptr;
+#endif
+};
+
+// Size of the fixed header in front of the metadata: type, version, json length and binary length.
+constexpr size_t asset_file_header_size = sizeof(AssetFile::type) + 3 * sizeof(uint32_t);
+
 bool save_binary_file(plib::binary_output_stream& out, AssetFile const& file);
+bool save_binary_file(plib::binary_output_stream& out, AssetFileView const& file);
+// Loading into a file that was used before reuses its memory, but zero-fills it before reading.
 bool load_binary_file(plib::binary_input_stream& in, AssetFile& file);
+// Loads an asset file into storage without initializing it first. view points into storage until it is reused.
+// Returns false if storage could not hold the file.
+bool load_binary_file(plib::binary_input_stream& in, ScratchBuffer& storage, AssetFileView& view);
+
+// Header and metadata of an asset file, without its binary blob. See probe_binary_file().
+struct AssetFileProbe {
+	char type[4]{};
+	uint32_t version = 0;
+	std::string metadata_json;
+	// Size of the binary blob that was not read
+	uint32_t blob_size = 0;
+};
+
+// Metadata larger than this is rejected by probe_binary_file(), so probing something that is not an asset file can't
+// allocate gigabytes for its supposed metadata.
+constexpr uint32_t max_probe_metadata_size = 64 * 1024 * 1024;
+
+// Reads only the fixed header and the metadata of an asset file, for building a registry of assets without keeping
+// their data. The blob is skipped, so the stream is left at the end of the file and assets stored one after the other
+// can be probed in turn. Returns false if the header is not that of an asset file, see max_probe_metadata_size.
+// The stream can't report a short read, so a truncated file is not detected.
+bool probe_binary_file(plib::binary_input_stream& in, AssetFileProbe& probe);
+// Same, but never reads past the metadata of the file at path. Returns false if the file is not an asset file,
+// which is recognized by its size not matching the sizes in its header.
+bool probe_binary_file(std::filesystem::path const& path, AssetFileProbe& probe);
+
+// Creates a view referencing the data owned by file.
+AssetFileView make_view(AssetFile const& file);
+// Creates a view of the metadata of a probed file. It has no binary blob, but read_texture_info() and the other
+// info readers only need the metadata.
+AssetFileView make_view(AssetFileProbe const& probe);
+
+// Parses an asset file stored in memory without copying it. Returns false if memory does not contain a complete asset file.
+bool view_binary_file(std::span<const char> memory, AssetFileView& view);
+
+// Stores a binary info block followed by optional json as the metadata of file.
+// binary_info must start with a BinaryInfoHeader, which is filled in here.
+void write_metadata(AssetFile& file, void* binary_info, uint32_t size, std::string_view json);
+// Same as write_metadata(), but returns the metadata instead of storing it in a file.
+std::string make_metadata(void* binary_info, uint32_t size, std::string_view json);
+
+// Copies the binary info block of file into dst, which is size bytes large and starts with a BinaryInfoHeader.
+// Fields that are missing because the file was written by an older revision are zero-filled.
+// Returns false if the file has no binary info block.
+bool read_binary_info(AssetFileView const& file, void* dst, uint32_t size);
+
+// Returns the json part of the metadata, skipping the binary info block if there is one.
+std::string_view json_metadata(AssetFileView const& file);
+
+// Writes an asset file while its binary blob is still being produced, so the blob never has to be in memory as a whole.
+// When writing to a file, the header and metadata are written as placeholders and patched in finish(). Because of this,
+// the metadata passed to finish() must be exactly as large as the metadata passed to open().
+// When writing to a stream, which can't seek, the blob is kept in memory until finish() writes out the whole file.
+class AssetFileWriter {
+public:
+	// type points to the 4 character asset type
+	bool open(std::filesystem::path const& path, char const* type, uint32_t version, std::string_view metadata);
+	void open(plib::binary_output_stream& out, char const* type, uint32_t version);
+
+	// Size of the blob written so far
+	uint64_t blob_size() const { return blob_size_; }
+	// Appends data to the end of the blob.
+	void append(void const* data, size_t size);
+	// Overwrites data that was already appended, starting at offset in the blob.
+	void patch(uint64_t offset, void const* data, size_t size);
+
+	// Writes the final header and metadata. Returns false if writing to the file failed at any point,
+	// or if the metadata or the blob is larger than the 32 bit sizes in the header can hold.
+	bool finish(std::string_view metadata);
+
+private:
+	char type[4]{};
+	uint32_t version = 0;
+	uint64_t blob_size_ = 0;
+	uint32_t metadata_size = 0;
+	std::ofstream file;
+	plib::binary_output_stream* stream = nullptr;
+	std::vector<char> buffer;
+};
+
+// Maps the file at path and creates a view into the mapping. The view stays valid as long as mapping is open.
+bool map_binary_file(std::filesystem::path const& path, MappedFile& mapping, AssetFileView& view);
 
 }
\ No newline at end of file
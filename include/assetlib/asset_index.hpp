@@ -0,0 +1,92 @@
+#pragma once
+
+#include <assetlib/asset_file.hpp>
+
+#include <string_view>
+
+namespace assetlib {
+
+// A persistent index of every asset file in a directory, so a registry of all assets can be built at startup without
+// opening them. Opening an index maps a single file, finding an asset in it is O(1). It is laid out like an archive
+// holding only the metadata of its assets:
+//	AssetIndexHeader
+//	AssetIndexEntry[entry_count]: one per asset file, sorted by path
+//	uint32_t buckets[bucket_count]: open addressing hash table indexed by id. Holds entry index + 1, or 0 for empty buckets.
+//	paths: path of every asset file relative to the indexed directory, with forward slashes and not null terminated
+//	metadata: the metadata of every asset file, as probe_binary_file() reads it
+// update_asset_index() revalidates an index by the size and modification time of every file, and only probes the files
+// that were added or changed since.
+
+struct AssetIndexHeader {
+	// Always "AIDX"
+	char magic[4]{};
+	uint32_t version = 0;
+	uint32_t entry_count = 0;
+	// Always a power of two
+	uint32_t bucket_count = 0;
+	uint32_t paths_size = 0;
+	uint32_t metadata_size = 0;
+	uint64_t paths_offset = 0;
+	uint64_t metadata_offset = 0;
+};
+
+struct AssetIndexEntry {
+	// archive_id() of the path
+	uint64_t id = 0;
+	// Size of the whole asset file
+	uint64_t file_size = 0;
+	// Last modification time in ticks of std::filesystem::file_time_type. Only ever compared for equality.
+	int64_t modified = 0;
+	uint32_t path_offset = 0;
+	uint32_t path_length = 0;
+	char type[4]{};
+	uint32_t version = 0;
+	// Offset of the metadata from the start of the metadata section
+	uint32_t metadata_offset = 0;
+	uint32_t metadata_size = 0;
+	uint32_t blob_size = 0;
+	uint32_t padding = 0;
+};
+
+struct AssetIndexStats {
+	// Files taken from the previous index without opening them
+	uint32_t unchanged = 0;
+	// Files that were added or changed and had to be probed
+	uint32_t probed = 0;
+	// Entries of the previous index whose file no longer exists or is no longer an asset file
+	uint32_t removed = 0;
+};
+
+// Scans directory and its subdirectories, and writes an index of every asset file in it to index_path.
+// If index_path already holds an index, files with the same size and modification time as recorded in it are not opened.
+// Files that are not asset files are skipped, as is the index itself. Returns false if the index could not be written.
+bool update_asset_index(std::filesystem::path const& directory, std::filesystem::path const& index_path, AssetIndexStats* stats = nullptr);
+
+class AssetIndex {
+public:
+	// Maps the index at path. Returns false if it could not be mapped or is not a valid index.
+	bool open(std::filesystem::path const& path);
+	void close();
+
+	uint32_t size() const { return header.entry_count; }
+
+	// Looks up an asset by its path relative to the indexed directory, with forward slashes.
+	AssetIndexEntry const* find(std::string_view path) const;
+
+	// Access to the entries, for iterating over all assets.
+	AssetIndexEntry const& entry(uint32_t index) const;
+	std::string_view path(AssetIndexEntry const& entry) const;
+	// View of the metadata of an asset. It has no binary blob, but read_texture_info() and the other info readers
+	// only need the metadata.
+	AssetFileView view(AssetIndexEntry const& entry) const;
+
+private:
+	MappedFile mapping;
+	AssetIndexHeader header{};
+	AssetIndexEntry const* entries = nullptr;
+	uint32_t const* buckets = nullptr;
+	char const* paths = nullptr;
+	char const* metadata = nullptr;
+};
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <assetlib/environment.hpp>
+#include <assetlib/mesh.hpp>
+#include <assetlib/texture.hpp>
+#include <assetlib/thread_pool.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace assetlib {
+
+enum class LoadStatus {
+	Completed,
+	// The file could not be read, is not a valid asset or does not match the destination callback in the request.
+	Failed,
+	Cancelled
+};
+
+struct MeshDestination {
+	void* vertices = nullptr;
+	void* indices = nullptr;
+};
+
+struct EnvironmentDestination {
+	void* hdr = nullptr;
+	// May be null for environments without an irradiance map, see IrradianceStorage::SH9
+	void* irradiance = nullptr;
+	void* specular = nullptr;
+	// If set, the maps are unpacked straight into this layout
+	std::optional<EnvironmentLayout> layout;
+};
+
+struct LoadRequest {
+	std::filesystem::path path;
+	// Requests with a higher priority are started first. Requests with equal priority start in submission order.
+	int32_t priority = 0;
+	// The callback matching the type of the asset is called on a worker thread once its info has been read,
+	// and returns the buffers to unpack into. Returning null buffers cancels the request.
+	std::function<void*(TextureInfo const&)> texture_destination;
+	// Optional, called before texture_destination. The texture is then unpacked straight into the returned layout,
+	// which must stay valid until the request has finished.
+	std::function<TextureLayout(TextureInfo const&)> texture_layout;
+	std::function<MeshDestination(MeshInfo const&)> mesh_destination;
+	std::function<EnvironmentDestination(EnvironmentInfo const&)> environment_destination;
+	// Called on a worker thread once the request has finished, whatever the outcome.
+	std::function<void(LoadStatus)> on_complete;
+};
+
+class LoadHandle {
+public:
+	LoadHandle() = default;
+
+	// Cancels the request if it has not started unpacking yet.
+	void cancel();
+	// Blocks until the request has finished.
+	LoadStatus wait() const;
+	bool valid() const { return future.valid(); }
+
+	std::shared_future<LoadStatus> future;
+
+private:
+	friend class AsyncLoader;
+	std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// Loads batches of assets in the background. Dedicated I/O threads map files and fault their pages in,
+// while a worker pool reads asset info and decompresses, so the disk and all cores are kept busy at the same time.
+class AsyncLoader {
+public:
+	// A worker thread count of 0 uses one worker per hardware thread.
+	explicit AsyncLoader(uint32_t io_threads = 1, uint32_t worker_threads = 0);
+	AsyncLoader(AsyncLoader const&) = delete;
+	AsyncLoader& operator=(AsyncLoader const&) = delete;
+	// Cancels all requests that have not started yet and waits for the others to finish.
+	~AsyncLoader();
+
+	LoadHandle submit(LoadRequest request);
+	std::vector<LoadHandle> submit(std::vector<LoadRequest> requests);
+
+	// Blocks until all submitted requests have finished.
+	void wait_idle();
+
+private:
+	struct Job;
+
+	void io_main();
+	void process(std::shared_ptr<Job> job);
+	void finish(Job& job, LoadStatus status);
+
+	ThreadPool workers;
+	std::vector<std::thread> io_threads;
+	// Max-heap on priority, then submission order
+	std::vector<std::shared_ptr<Job>> queue;
+	std::mutex mutex;
+	std::condition_variable queue_changed;
+	std::condition_variable idle;
+	uint64_t next_sequence = 0;
+	// Jobs that were taken off the queue but did not finish yet. Limits how far ahead of decompression the I/O threads run.
+	uint32_t in_flight = 0;
+	uint32_t max_in_flight = 0;
+	uint32_t pending = 0;
+	bool stopping = false;
+};
+
+}
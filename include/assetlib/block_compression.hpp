@@ -0,0 +1,44 @@
+#pragma once
+
+#include <assetlib/texture.hpp>
+
+#include <vector>
+
+namespace assetlib {
+
+// CPU encoder for the block compressed texture formats, so textures can be cooked on any build machine.
+// Blocks are encoded as is from the source texels, so sRGB textures must be uploaded with the sRGB variant of the GPU format.
+// The reference decoder is meant for validation and tools, GPUs decode the blocks themselves.
+//
+// BC1 is opaque, the alpha channel of the source is ignored.
+// BC7 blocks are always encoded in mode 6: a single pair of 7-bit RGBA endpoints with a p-bit each and 4-bit indices.
+
+enum class BlockCompressionQuality {
+	// Endpoints from the bounding box of the block, indices by projection onto the line between them.
+	Fast,
+	// Endpoints along the principal axis of the block, refined once with a least squares fit.
+	Normal,
+	// Like Normal, but every texel searches the nearest palette entry, endpoints are refined more often,
+	// and BC3 alpha, BC4 and BC5 also try the 6 value mode with explicit 0 and 255.
+	High
+};
+
+// Encodes an image of width x height texels in the uncompressed format src_format, rows tightly packed.
+// dst receives ceil(width / 4) * ceil(height / 4) blocks of format, row by row. Blocks past the edge of the image
+// repeat its last row and column. Rows of blocks are encoded in parallel through executor.
+void encode_blocks(TextureFormat format, BlockCompressionQuality quality, TextureFormat src_format, void const* src,
+	uint32_t width, uint32_t height, void* dst, Executor const& executor = {});
+
+// Reference decoder. Writes width x height RGBA8 texels, rows tightly packed.
+// Channels that are not stored decode as 0, or as 255 for alpha. BC7 blocks in any mode other than 6 decode as transparent black.
+void decode_blocks(TextureFormat format, void const* src, uint32_t width, uint32_t height, uint8_t* dst_rgba);
+
+// Encodes every mip level of an uncompressed texture, and updates info to describe the encoded texture.
+std::vector<char> encode_texture(TextureInfo& info, void const* pixel_data, TextureFormat format, BlockCompressionQuality quality,
+	Executor const& executor = {});
+
+// Block compresses an uncompressed texture before packing it, see encode_texture().
+AssetFile pack_texture(TextureInfo const& info, void* pixel_data, TextureFormat format, BlockCompressionQuality quality,
+	Executor const& executor = {});
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <assetlib/asset_file.hpp>
+#include <assetlib/thread_pool.hpp>
+
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace assetlib {
+
+// Interface for the block compressors behind each CompressionMode.
+class Codec {
+public:
+	virtual ~Codec() = default;
+
+	// Largest possible compressed size of size bytes of input.
+	virtual size_t compress_bound(size_t size) const = 0;
+	// Compresses src into dst and returns the compressed size, or 0 if it did not fit in dst_capacity.
+	// A level of 0 selects the codec's default level. If a dictionary is given, the data is compressed
+	// as if it directly followed the dictionary. Codecs that don't support dictionaries return 0 in that case.
+	virtual size_t compress(char const* src, size_t size, char* dst, size_t dst_capacity, int level, std::span<const char> dictionary) const = 0;
+	// Decompresses exactly dst_size bytes, using the same dictionary as when compressing. Returns false if src is corrupted.
+	virtual bool decompress(char const* src, size_t size, char* dst, size_t dst_size, std::span<const char> dictionary) const = 0;
+	// Typical decompression speed in uncompressed bytes per second, used to estimate load times for CompressionMode::Auto.
+	virtual double decode_speed() const = 0;
+	// Compression levels worth trying for CompressionMode::Auto.
+	virtual std::vector<int> levels() const { return { 0 }; }
+};
+
+// Returns the codec for a compression mode, or null if there is none. CompressionMode::None has no codec.
+Codec const* find_codec(CompressionMode mode);
+
+// Registers a codec for a mode of at least first_custom_compression_mode.
+// Not thread safe, codecs should be registered before any packing or unpacking starts.
+void register_codec(CompressionMode mode, std::unique_ptr<Codec> codec);
+
+struct CompressionChoice {
+	CompressionMode mode = CompressionMode::None;
+	int level = 0;
+	// Optional shared dictionary (see dictionary.hpp). Must stay alive while compressing.
+	std::span<const char> dictionary;
+};
+
+struct AutoCompressionSettings {
+	// Expected read bandwidth of the target storage in bytes per second.
+	double disk_bandwidth = 500.0 * 1024 * 1024;
+	// Expected speed of copying uncompressed data in bytes per second.
+	double copy_speed = 8.0 * 1024 * 1024 * 1024;
+	// Modes that will be tried. Every level the codec reports is tried for each of them.
+	std::vector<CompressionMode> candidates = { CompressionMode::None, CompressionMode::LZ4, CompressionMode::LZ4HC };
+	// Number of evenly spread samples that are trial compressed, and the size of each sample.
+	uint32_t sample_count = 8;
+	uint32_t sample_size = 64 * 1024;
+};
+
+// Sets the settings used whenever a packer is given CompressionMode::Auto. Not thread safe.
+void set_auto_compression_settings(AutoCompressionSettings const& settings);
+AutoCompressionSettings const& get_auto_compression_settings();
+
+// Trial compresses samples of data with every candidate and returns the mode and level with the lowest expected load time:
+// compressed size / disk bandwidth + uncompressed size / decode speed.
+// Each span is sampled separately, so payloads of different assets can be considered together.
+// If a dictionary is given, the samples are compressed with it and it is set in the returned choice.
+// The samples are compressed into scratch, the overloads without it use a temporary buffer.
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, AutoCompressionSettings const& settings,
+	std::span<const char> dictionary, ScratchBuffer& scratch);
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, AutoCompressionSettings const& settings,
+	std::span<const char> dictionary = {});
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, std::span<const char> dictionary = {});
+
+// Resolves a requested mode for packing. CompressionMode::Auto is resolved with choose_compression(), any other mode is returned as is.
+// Without any payloads to sample (as in the streaming packers), Auto resolves to LZ4HC at its default level,
+// which unpacks as fast as LZ4 at a better ratio.
+CompressionChoice resolve_compression(CompressionMode mode, int level, std::span<std::span<const char> const> payloads,
+	std::span<const char> dictionary = {});
+CompressionChoice resolve_compression(CompressionMode mode, int level, std::span<std::span<const char> const> payloads,
+	std::span<const char> dictionary, ScratchBuffer& scratch);
+
+// Uncompressed size of a single chunk in a chunked payload.
+constexpr uint32_t default_chunk_size = 256 * 1024;
+
+// A chunked payload splits data into fixed-size chunks that are compressed independently,
+// so they can be decompressed in parallel. It is laid out as follows:
+//	uint32_t chunk_size: uncompressed size of every chunk except the last one
+//	uint32_t chunk_count
+//	uint32_t chunk_end[chunk_count]: end offset of each compressed chunk, relative to the start of the chunk data
+//	chunk data
+// Chunks that do not get smaller when compressed are stored raw. These are recognized by their stored size being
+// equal to their uncompressed size.
+
+// Compresses size bytes from src as a chunked payload and appends it to out.
+// The chunks are compressed into staging first, which needs about as much space as the compressed payload.
+// The overload without staging uses a temporary buffer.
+void compress_chunked(CompressionChoice compression, void const* src, uint64_t size, uint32_t chunk_size, std::vector<char>& out,
+	ScratchBuffer& staging, Executor const& executor = {});
+void compress_chunked(CompressionChoice compression, void const* src, uint64_t size, uint32_t chunk_size, std::vector<char>& out, Executor const& executor = {});
+
+// Writes a chunked payload to an AssetFileWriter while the data comes in, so only one uncompressed chunk is ever held in memory.
+class ChunkedPayloadWriter {
+public:
+	// Starts a chunked payload of size bytes at the current end of the blob, reserving space for its chunk table.
+	void begin(AssetFileWriter& out, CompressionChoice compression, uint64_t size, uint32_t chunk_size = default_chunk_size);
+	// Appends the next bytes of the payload. Every chunk is compressed as soon as it is complete.
+	void write(void const* data, size_t size);
+	// Flushes the last chunk and patches the chunk table.
+	// Returns false if the amount of data written does not match the size given to begin(),
+	// or if the stored chunks don't fit the 32 bit offsets of the chunk table.
+	bool end();
+
+	// Offset of the payload in the blob and its stored size, valid after end().
+	uint64_t offset() const { return table_offset; }
+	uint64_t stored_size() const { return out->blob_size() - table_offset; }
+
+private:
+	void flush_chunk();
+
+	AssetFileWriter* out = nullptr;
+	CompressionChoice compression;
+	uint64_t size = 0;
+	uint64_t written = 0;
+	uint32_t chunk_size = 0;
+	uint64_t table_offset = 0;
+	// Cleared once a chunk end no longer fits in chunk_ends
+	bool fits = true;
+	std::vector<uint32_t> chunk_ends;
+	std::vector<char> chunk;
+	std::vector<char> compressed;
+};
+
+// Decompresses a chunked payload holding size bytes of uncompressed data into dst.
+// The dictionary must be the one the payload was compressed with, if any. Returns false if the payload is malformed.
+bool decompress_chunked(CompressionMode mode, std::span<const char> src, void* dst, uint64_t size, Executor const& executor = {},
+	std::span<const char> dictionary = {});
+
+// Receives size bytes of uncompressed data that start offset bytes into the payload.
+// Called once per chunk, from several threads at once if an executor is given.
+using ChunkSink = std::function<void(uint64_t offset, char const* data, size_t size)>;
+
+// Decompresses a chunked payload chunk by chunk and hands every chunk to sink, for data that does not go to one flat buffer.
+// Only one chunk per thread is ever held in memory.
+bool decompress_chunked(CompressionMode mode, std::span<const char> src, uint64_t size, ChunkSink const& sink, Executor const& executor = {},
+	std::span<const char> dictionary = {});
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <assetlib/asset_file.hpp>
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace assetlib {
+
+// A dictionary is a block of data that typical assets have in common. Compressing with a shared dictionary lets
+// small assets reference data in it, which they could not do on their own since they are too small to contain
+// many repeats. LZ4 only looks at the last 64 KiB of a dictionary.
+// Assets store the id of the dictionary they were compressed with, which has to be registered before unpacking them.
+struct Dictionary {
+	// Hash of the dictionary data, see dictionary_id()
+	uint64_t id = 0;
+	std::vector<char> data;
+};
+
+constexpr uint32_t max_dictionary_size = 64 * 1024;
+
+// Computes the id of a dictionary from its data. 0 is never returned, since it means "no dictionary".
+uint64_t dictionary_id(std::span<const char> data);
+
+// Formats an id as the 16 digit hex string used in the json metadata.
+std::string format_dictionary_id(uint64_t id);
+
+// Builds a dictionary from samples of the kind of assets it will be used for.
+// Segments that occur in most samples are kept, the most common ones last since LZ4 prefers the end of the dictionary.
+Dictionary train_dictionary(std::span<std::span<const char> const> samples, uint32_t max_size = max_dictionary_size);
+
+// Dictionaries are stored as their own asset type ("DICT"), so they can be saved next to the assets or put in an archive.
+AssetFile pack_dictionary(Dictionary const& dictionary);
+Dictionary unpack_dictionary(AssetFile const& file);
+Dictionary unpack_dictionary(AssetFileView const& file);
+
+// Makes a dictionary available to the unpack functions. Registering a dictionary with the same id again is a no-op.
+// Thread safe, dictionaries may be registered while other threads are unpacking.
+void register_dictionary(Dictionary dictionary);
+void unregister_dictionary(uint64_t id);
+// Returns nullptr if no dictionary with this id is registered.
+std::shared_ptr<Dictionary const> find_dictionary(uint64_t id);
+// Looks up the dictionary an asset refers to. Returns nullptr for id 0 and asserts that any other id is registered.
+std::shared_ptr<Dictionary const> require_dictionary(uint64_t id);
+
+// Data of a dictionary to compress with, or an empty span if there is none.
+inline std::span<const char> dictionary_data(Dictionary const* dictionary) {
+	return dictionary ? std::span<const char>(dictionary->data) : std::span<const char>();
+}
+
+}
@@ -1,12 +1,45 @@
 #pragma once
 
 #include <assetlib/asset_file.hpp>
+#include <assetlib/compression.hpp>
+#include <assetlib/thread_pool.hpp>
+
+#include <vector>
 
 namespace assetlib {
 
+// Texel format of the maps of an environment. Enum values are stored in files, so they may never change.
+enum class EnvironmentFormat {
+    // Opaque bytes, as written before formats were stored. The specular map is a single blob without per face addressing.
+    Unknown = 0,
+    RGBA32F = 1,
+    RGBA16F = 2,
+    // 9-bit mantissas with a shared 5-bit exponent, 4 bytes per texel
+    RGB9E5 = 3,
+    // Unsigned 11-bit floats for red and green and a 10-bit float for blue, 4 bytes per texel
+    R11G11B10F = 4
+};
+
+// How the diffuse irradiance of an environment is stored. Enum values are stored in files, so they may never change.
+enum class IrradianceStorage {
+    // A cubemap of irradiance_size texels per face edge
+    Cubemap = 0,
+    // 9 RGB spherical harmonics coefficients in EnvironmentInfo::irradiance_sh, there is no irradiance map
+    SH9 = 1
+};
+
+// Bytes per texel, 0 for EnvironmentFormat::Unknown
+uint32_t environment_format_byte_size(EnvironmentFormat format);
+
+// Converts count RGBA32F texels to format, the formats without alpha drop it. See quantization.hpp for the rounding rules.
+void convert_environment_texels(EnvironmentFormat format, float const* src_rgba, uint64_t count, void* dst);
+// Converts count texels of format back to RGBA32F, alpha is 1 for the formats without it.
+void convert_environment_texels(EnvironmentFormat format, void const* src, uint64_t count, float* dst_rgba);
+
 struct EnvironmentInfo {
-    // ignored by pack_environment(). LZ4 will always be used
-    CompressionMode compression = CompressionMode::None;
+    CompressionMode compression = CompressionMode::LZ4;
+    // Only used when packing. 0 selects the default level of the codec.
+    int compression_level = 0;
     uint32_t hdr_extents[2] { 0, 0 };
     uint32_t hdr_bytes = 0;
     uint32_t irradiance_size = 0;
@@ -17,15 +50,138 @@ struct EnvironmentInfo {
     uint32_t specular_bytes = 0;
     // no need to set this manually before calling pack_environment()
     uint32_t specular_offset = 0;
+    // Format of all three maps. With a known format the byte sizes must match the extents, and every face of every
+    // specular mip level is stored on its own so it can be unpacked by itself.
+    EnvironmentFormat format = EnvironmentFormat::Unknown;
+    // Mip levels of the prefiltered specular cubemap, mip 0 has specular_size texels per face edge. 0 is the same as 1.
+    // Only used with a known format, the specular map is stored mip by mip, with the 6 faces of every mip in order.
+    uint32_t specular_mip_levels = 0;
+    IrradianceStorage irradiance_storage = IrradianceStorage::Cubemap;
+    // Irradiance (not yet divided by pi) in any direction n is sum(irradiance_sh[i] * Y_i(n)) over the real SH basis
+    // of bands 0 to 2, see evaluate_irradiance_sh9(). pack_environment() computes these from the hdr map,
+    // the stream packer stores them as given.
+    float irradiance_sh[9][3]{};
 };
 
+// Projects the hdr map (in info.format) onto spherical harmonics and convolves it with the cosine lobe.
+// The hdr map is equirectangular with +Y up: row y is at the polar angle pi * (y + 0.5) / height from +Y, and column x at
+// the azimuth 2 * pi * (x + 0.5) / width from +X towards +Z.
+void compute_irradiance_sh9(EnvironmentInfo const& info, void const* hdr, float sh[9][3]);
+// Irradiance in a unit direction
+void evaluate_irradiance_sh9(float const sh[9][3], float const direction[3], float irradiance[3]);
+
 // Read environment info from an asset file
 EnvironmentInfo read_environment_info(AssetFile const& file);
+EnvironmentInfo read_environment_info(AssetFileView const& file);
+
+// Unpack environment into destination buffers.
+// If an executor is given, the chunks of all three maps are decompressed in parallel through it.
+// dst_irradiance is not used with IrradianceStorage::SH9.
+void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular, Executor const& executor = {});
+void unpack_environment(EnvironmentInfo const& info, AssetFileView const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular, Executor const& executor = {});
+
+// Size of one face of a specular mip level, environments with a known format only
+uint64_t environment_specular_face_byte_size(EnvironmentInfo const& info, uint32_t mip);
+
+// Unpacks a single face of a specular mip level, tightly packed. Nothing else of the specular map is decompressed.
+void unpack_environment_specular(EnvironmentInfo const& info, AssetFile const& file, uint32_t mip, uint32_t face, void* dst, Executor const& executor = {});
+void unpack_environment_specular(EnvironmentInfo const& info, AssetFileView const& file, uint32_t mip, uint32_t face, void* dst, Executor const& executor = {});
+
+// Entry of the specular table at the start of the specular map, one per face of every mip level, mip by mip
+struct SpecularTableEntry {
+    // Offset of the chunked payload holding this face in the binary blob
+    uint32_t offset = 0;
+    uint32_t stored_size = 0;
+    // Size of the face after decompression
+    uint32_t byte_size = 0;
+};
 
-// Unpack environment into destination buffers
-void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular);
+// Layout of the maps of an environment in staging memory, so they can be unpacked straight into upload buffers.
+// The hdr map is laid out as hdr_extents[1] rows and the irradiance map as 6 cube faces of irradiance_size rows each.
+// With a known format the specular map is laid out mip by mip, each mip holding its 6 faces in order, otherwise it
+// is unpacked as stored.
+struct EnvironmentLayout {
+    // Every row of the hdr map and of the cube faces starts at a multiple of this many bytes.
+    uint32_t row_alignment = 1;
+    // Every cube face starts at a multiple of this many bytes.
+    uint32_t face_alignment = 1;
+};
+
+uint64_t environment_hdr_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout);
+uint64_t environment_irradiance_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout);
+uint64_t environment_irradiance_face_offset(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t face);
+uint64_t environment_specular_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t mip);
+uint64_t environment_specular_face_offset(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t mip, uint32_t face);
+// Size of the buffers of the maps in a layout. The irradiance buffer is empty with IrradianceStorage::SH9,
+// and without a known format the specular buffer holds info.specular_bytes.
+uint64_t environment_hdr_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout);
+uint64_t environment_irradiance_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout);
+uint64_t environment_specular_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout);
 
-// Packs raw pixel data into a binary asset file ready to save to disk
+// Unpacks the maps of an environment straight into a layout. Every chunk is placed as soon as it is decompressed,
+// so there are no tightly packed copies of the maps in between.
+void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, EnvironmentLayout const& layout, void* dst_hdr, void* dst_irradiance,
+    void* dst_specular, Executor const& executor = {});
+void unpack_environment(EnvironmentInfo const& info, AssetFileView const& file, EnvironmentLayout const& layout, void* dst_hdr, void* dst_irradiance,
+    void* dst_specular, Executor const& executor = {});
+
+// Packs raw pixel data into a binary asset file ready to save to disk.
+// With IrradianceStorage::SH9 the coefficients are computed from the hdr map and irradiance is ignored.
 AssetFile pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular);
+// Same as above, but packs into file and reuses the storage it already holds, see pack_texture().
+void pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular, AssetFile& file);
+// Same as above, but stages through scratch, see pack_texture().
+void pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular, AssetFile& file, PackScratch& scratch);
+
+// Converts RGBA32F maps to info.format before packing them, see convert_environment_texels().
+// The byte sizes in info describe the maps after conversion.
+// The converted maps are staged in scratch, so packing environments one after the other with the same scratch reuses them.
+AssetFile pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor);
+void pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor, AssetFile& file);
+void pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor, AssetFile& file, PackScratch& scratch);
+
+// Packs an environment while its maps come in, compressing them chunk by chunk as soon as data arrives.
+// When packing to a stream, the compressed environment is held in memory until finish().
+class EnvironmentStreamPacker {
+public:
+    bool open(std::filesystem::path const& path, EnvironmentInfo const& info);
+    void open(plib::binary_output_stream& out, EnvironmentInfo const& info);
+
+    // Data may be split at any byte, but the maps must be written in order: hdr, irradiance, specular.
+    // There is no irradiance map to write with IrradianceStorage::SH9.
+    void write_hdr(void const* data, size_t size);
+    void write_irradiance(void const* data, size_t size);
+    void write_specular(void const* data, size_t size);
+
+    // Writes the header. Returns false if writing failed or if the amount of data written does not match the environment info.
+    bool finish();
+
+private:
+    enum class Map {
+        Hdr,
+        Irradiance,
+        Specular
+    };
+
+    void begin();
+    void advance_to(Map map);
+    void begin_specular_face();
+
+    EnvironmentInfo info;
+    CompressionChoice compression;
+    AssetFileWriter writer;
+    ChunkedPayloadWriter payload;
+    Map current = Map::Hdr;
+    uint32_t irradiance_offset = 0;
+    uint32_t specular_offset = 0;
+    // Only used with a known format
+    std::vector<SpecularTableEntry> specular_table;
+    uint32_t current_face = 0;
+    uint64_t remaining_in_face = 0;
+    bool ok = true;
+};
 
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace assetlib {
+
+// Timings and byte counts of the load path, reported to callbacks installed by the application.
+// The library only reports them when built with ASSETLIB_INSTRUMENTATION defined (the CMake option of the same name).
+// Otherwise every measuring point compiles to nothing and installed callbacks are never called.
+// When compiled in but no callbacks are installed, each measuring point costs a single flag check.
+
+enum class LoadStage {
+	// Loading a file from a stream, or mapping and faulting it in by AsyncLoader. bytes_in is the size of the file.
+	FileRead = 0,
+	// read_texture_info(), read_mesh_info() and read_environment_info(). bytes_in is the size of the metadata.
+	InfoParse = 1,
+	// Decompressing one chunked payload. bytes_in is the stored size, bytes_out the decompressed size.
+	// These run inside Unpack stages, possibly on worker threads, and don't know the asset type.
+	Decompress = 2,
+	// A whole unpack_texture(), unpack_mesh() or unpack_environment() call, including the Decompress stages in it.
+	// bytes_in is the size of the binary blob, bytes_out the size of the unpacked data.
+	Unpack = 3
+};
+constexpr uint32_t load_stage_count = 4;
+
+char const* load_stage_name(LoadStage stage);
+
+struct StageEvent {
+	LoadStage stage = LoadStage::FileRead;
+	// ITEX, MESH or IENV. All zero if the stage doesn't know the asset type.
+	char type[4]{};
+	// Steady clock time in nanoseconds
+	uint64_t begin_ns = 0;
+	uint64_t end_ns = 0;
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+	// Path of the asset if known, such as for every stage of an AsyncLoader request. Only valid during the callback.
+	std::string_view label;
+};
+
+struct Instrumentation {
+	// Called on the thread that ran the stage, possibly from several threads at once
+	std::function<void(StageEvent const& event)> on_stage;
+};
+
+// Installs callbacks for all later loads, or removes them if instrumentation is empty.
+// Not synchronized with loads in flight, install them before loading starts.
+void set_instrumentation(Instrumentation instrumentation);
+// Returns true if the library was built with ASSETLIB_INSTRUMENTATION.
+bool instrumentation_available();
+
+// Steady clock time in nanoseconds, the clock of StageEvent
+uint64_t instrumentation_now_ns();
+
+struct StageTotals {
+	uint64_t count = 0;
+	uint64_t total_ns = 0;
+	uint64_t max_ns = 0;
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+};
+
+// Sums up events per asset type and stage. Events without a known type are summed under an all zero type.
+class InstrumentationStats {
+public:
+	void record(StageEvent const& event);
+	// type points to the 4 character asset type, or nullptr for events without one
+	StageTotals totals(char const* type, LoadStage stage) const;
+	void reset();
+
+	// Callbacks recording into this object, which must outlive them
+	Instrumentation callbacks();
+
+private:
+	// ITEX, MESH, IENV and everything else
+	static constexpr uint32_t type_count = 4;
+	static uint32_t type_index(char const* type);
+
+	mutable std::mutex mutex;
+	StageTotals stats[type_count][load_stage_count]{};
+};
+
+// Keeps every event and writes them in the Chrome trace event format, which chrome://tracing and Perfetto can open.
+// Each stage becomes a complete event on the track of the thread it ran on.
+class ChromeTraceWriter {
+public:
+	ChromeTraceWriter();
+
+	void record(StageEvent const& event);
+	void clear();
+
+	std::string json() const;
+	bool write(std::filesystem::path const& path) const;
+
+	// Callbacks recording into this object, which must outlive them
+	Instrumentation callbacks();
+
+private:
+	struct Event {
+		StageEvent event;
+		std::string label;
+		uint32_t thread = 0;
+	};
+
+	uint64_t start_ns = 0;
+	mutable std::mutex mutex;
+	std::vector<Event> events;
+	std::vector<std::thread::id> threads;
+};
+
+}
@@ -1,13 +1,22 @@
 #pragma once
 
 #include <assetlib/asset_file.hpp>
+#include <assetlib/compression.hpp>
+#include <assetlib/dictionary.hpp>
+#include <assetlib/thread_pool.hpp>
 
 namespace assetlib {
 
+// Stored by value, new formats must be added at the end.
 enum class VertexFormat {
 	// Position (3) - Normal (3) - Tangent (3) - UV (2), all 32-bit float
-	PNTV32,
-	Unknown
+	PNTV32 = 0,
+	Unknown = 1,
+	// Position (3 + 1 padding) as 16-bit snorm, Normal and Tangent octahedral encoded as 2 16-bit snorm each, UV (2) as half float.
+	// Positions are dequantized with MeshInfo::position_scale and position_offset.
+	PNTV16N = 2,
+	// Like PNTV16N, but positions are stored as half floats.
+	PNTV16H = 3
 };
 
 struct PNTV32Vertex {
@@ -17,22 +26,158 @@ struct PNTV32Vertex {
 	float uv[2]{};
 };
 
+struct PNTV16NVertex {
+	int16_t position[4]{};
+	int16_t normal[2]{};
+	int16_t tangent[2]{};
+	uint16_t uv[2]{};
+};
+
+struct PNTV16HVertex {
+	uint16_t position[4]{};
+	int16_t normal[2]{};
+	int16_t tangent[2]{};
+	uint16_t uv[2]{};
+};
+
 struct MeshInfo {
 	VertexFormat format = VertexFormat::PNTV32;
 	CompressionMode compression = CompressionMode::LZ4;
+	// Only used when packing. 0 selects the default level of the codec.
+	int compression_level = 0;
 	uint32_t vertex_count = 0;
 	uint32_t index_count = 0;
 	uint8_t index_bits = 32;
 	// This does not need to be set when packing a mesh
 	uint32_t index_binary_offset = 0;
+	// Id of a registered dictionary to compress with, or 0 for none (see dictionary.hpp).
+	// Small meshes compress a lot better with a dictionary trained on similar meshes.
+	uint64_t dictionary_id = 0;
+	// Dequantization transform of the compact vertex formats: position = stored position * scale + offset.
+	// Filled in by quantize_vertices(), unused for PNTV32.
+	float position_scale[3]{ 1.0f, 1.0f, 1.0f };
+	float position_offset[3]{ 0.0f, 0.0f, 0.0f };
+	// pack_mesh() builds meshlets with at most this many vertices and triangles if max_meshlet_vertices is not 0,
+	// see meshlet.hpp. A max_meshlet_triangles of 0 selects the default.
+	uint32_t max_meshlet_vertices = 0;
+	uint32_t max_meshlet_triangles = 0;
+	// These do not need to be set when packing a mesh. meshlet_count is 0 if the mesh has no meshlets.
+	uint32_t meshlet_count = 0;
+	uint32_t meshlet_vertex_count = 0;
+	uint32_t meshlet_triangle_count = 0;
+	uint32_t meshlet_binary_offset = 0;
+	uint32_t meshlet_vertices_binary_offset = 0;
+	uint32_t meshlet_triangles_binary_offset = 0;
+	// Bounds of LOD 0, computed by pack_mesh(). The stream packer stores them as given.
+	float aabb_min[3]{};
+	float aabb_max[3]{};
+	float sphere_center[3]{};
+	float sphere_radius = 0.0f;
+	// Number of levels of detail. LOD 0 is the mesh described by this info, see read_mesh_lod() for the others.
+	// This does not need to be set when packing a mesh.
+	uint32_t lod_count = 1;
+	// These do not need to be set when packing a mesh
+	uint32_t vertex_binary_offset = 0;
+	uint32_t lod_table_offset = 0;
+};
+
+// A level of detail of a mesh. All levels share the vertex format, index size and bounds of LOD 0.
+// Also the layout of an entry in the LOD table.
+struct MeshLod {
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	// Geometric error compared to LOD 0, in mesh units
+	float error = 0.0f;
+	// Largest projected size of the bounding sphere, as a fraction of the screen height, this LOD is meant for.
+	// Decreases with every level. LOD 0 is used for any size.
+	float screen_size = 0.0f;
+	uint32_t vertex_binary_offset = 0;
+	uint32_t index_binary_offset = 0;
+	uint32_t index_binary_end = 0;
+	uint32_t padding = 0;
+};
+
+// Source data of an additional level of detail, in the vertex format and index size of LOD 0.
+struct MeshLodData {
+	void const* vertices = nullptr;
+	void const* indices = nullptr;
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	float error = 0.0f;
+	float screen_size = 0.0f;
 };
 
+// Size of a single vertex in bytes, or 0 for VertexFormat::Unknown.
+uint32_t vertex_byte_size(VertexFormat format);
+
+// Converts info.vertex_count PNTV32 vertices to the compact format info.format when cooking a mesh, and stores the
+// dequantization transform in info. The result is then packed with pack_mesh().
+// Positions are centered on their bounds, so PNTV16H keeps its precision for meshes far from the origin.
+void quantize_vertices(MeshInfo& info, PNTV32Vertex const* src, void* dst);
+// Converts vertices in any format back to PNTV32, for tools and CPU side processing.
+void dequantize_vertices(MeshInfo const& info, void const* src, PNTV32Vertex* dst);
+
 MeshInfo read_mesh_info(AssetFile const& file);
+MeshInfo read_mesh_info(AssetFileView const& file);
 
-// Unpacks raw mesh data into destination buffers
-void unpack_mesh(MeshInfo const& info, AssetFile const& file, void* dst_vertices, void* dst_indices);
+// Unpacks raw mesh data into destination buffers. Vertices are kept in the stored format, so compact formats
+// can be uploaded as is and dequantized in the vertex shader.
+// If an executor is given, the chunks of the mesh are decompressed in parallel through it.
+void unpack_mesh(MeshInfo const& info, AssetFile const& file, void* dst_vertices, void* dst_indices, Executor const& executor = {});
+void unpack_mesh(MeshInfo const& info, AssetFileView const& file, void* dst_vertices, void* dst_indices, Executor const& executor = {});
 
-// Packs raw mesh data into a binary asset file ready to save to disk
+// Packs raw mesh data into a binary asset file ready to save to disk.
+// Meshlets are built from the vertex and index data if info.max_meshlet_vertices is set.
 AssetFile pack_mesh(MeshInfo const& info, void* vertices, void* indices);
+// Same as above, but pack into file and reuse the storage it already holds, see pack_texture().
+void pack_mesh(MeshInfo const& info, void* vertices, void* indices, AssetFile& file);
+// Same as above, but stages through scratch, see pack_texture().
+void pack_mesh(MeshInfo const& info, void* vertices, void* indices, AssetFile& file, PackScratch& scratch);
+
+// Packs a mesh with additional levels of detail, ordered from fine to coarse. Every level is compressed separately
+// and the coarsest level is stored first, so distant objects can be streamed in from a small prefix of the file.
+// Meshlets are only built for LOD 0. Without any lods this is the same as pack_mesh().
+AssetFile pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods);
+void pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods, AssetFile& file);
+void pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods, AssetFile& file, PackScratch& scratch);
+
+// Reads the LOD table entry of a level of detail. This only touches the small uncompressed table.
+MeshLod read_mesh_lod(MeshInfo const& info, AssetFileView const& file, uint32_t lod);
+// Selects the coarsest level of detail meant for a mesh whose bounding sphere projects to screen_size of the screen height.
+uint32_t select_mesh_lod(MeshInfo const& info, AssetFileView const& file, float screen_size);
+
+// Unpacks a single level of detail, with the vertex and index counts given by read_mesh_lod().
+void unpack_mesh_lod(MeshInfo const& info, AssetFile const& file, uint32_t lod, void* dst_vertices, void* dst_indices, Executor const& executor = {});
+void unpack_mesh_lod(MeshInfo const& info, AssetFileView const& file, uint32_t lod, void* dst_vertices, void* dst_indices, Executor const& executor = {});
+
+// Packs a mesh while the vertex and index data comes in, compressing it chunk by chunk as soon as it arrives.
+// When packing to a stream, the compressed mesh is held in memory until finish().
+// Meshlets and bounds need the whole mesh, so they are not computed by the stream packer. Bounds are stored as given in
+// the info, and the mesh has a single level of detail.
+class MeshStreamPacker {
+public:
+	bool open(std::filesystem::path const& path, MeshInfo const& info);
+	void open(plib::binary_output_stream& out, MeshInfo const& info);
+
+	// Data may be split at any byte, but all vertices must be written before the first index.
+	void write_vertices(void const* data, size_t size);
+	void write_indices(void const* data, size_t size);
+
+	// Writes the header. Returns false if writing failed or if the amount of data written does not match the mesh info.
+	bool finish();
+
+private:
+	void begin_vertices();
+
+	MeshInfo info;
+	// Keeps the dictionary alive while compression refers to it
+	std::shared_ptr<Dictionary const> dictionary;
+	CompressionChoice compression;
+	AssetFileWriter writer;
+	ChunkedPayloadWriter payload;
+	uint32_t index_binary_offset = 0;
+	bool writing_indices = false;
+	bool ok = true;
+};
 
 }
\ No newline at end of file
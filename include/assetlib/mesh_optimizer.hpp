@@ -0,0 +1,66 @@
+#pragma once
+
+#include <assetlib/mesh.hpp>
+
+#include <vector>
+
+namespace assetlib {
+
+// Optional pack time optimization of meshes. Reordering triangles and vertices does not change what is rendered,
+// but makes better use of the post-transform vertex cache and of memory when fetching vertices.
+// As a side effect the index stream becomes a lot more coherent, so it also compresses better.
+
+struct MeshOptimizeSettings {
+	// Size of the simulated FIFO post-transform cache, in vertices.
+	uint32_t cache_size = 16;
+	// Reorders triangles for vertex cache locality using Tipsify.
+	bool optimize_vertex_cache = true;
+	// Sorts the clusters of triangles found while optimizing for the vertex cache so that triangles facing outwards
+	// are drawn first, which reduces overdraw independent of the view direction. Requires optimize_vertex_cache.
+	bool optimize_overdraw = false;
+	// The overdraw order is only kept if the ACMR does not get worse than this factor.
+	float overdraw_threshold = 1.05f;
+	// Reorders vertices in the order they are first used and drops unused vertices.
+	bool optimize_vertex_fetch = true;
+};
+
+struct VertexCacheStatistics {
+	// Vertices transformed, counting every cache miss.
+	uint32_t vertices_transformed = 0;
+	// Average cache miss ratio: vertices transformed per triangle. 0.5 is the best possible, 3 the worst.
+	float acmr = 0.0f;
+	// Average transform to vertex ratio: vertices transformed per referenced vertex. 1 is the best possible.
+	float atvr = 0.0f;
+};
+
+struct MeshOptimizeReport {
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+	// Number of vertices that were not referenced by any triangle, and were removed.
+	uint32_t removed_vertices = 0;
+};
+
+// Simulates a FIFO cache of cache_size vertices.
+VertexCacheStatistics analyze_vertex_cache(std::span<const uint32_t> indices, uint32_t vertex_count, uint32_t cache_size = 16);
+
+// Reorders triangles for vertex cache locality. If clusters is given, it receives the index of the first triangle of each
+// cluster: runs of triangles that were emitted without a break in locality.
+void optimize_vertex_cache(std::span<uint32_t> indices, uint32_t vertex_count, uint32_t cache_size = 16, std::vector<uint32_t>* clusters = nullptr);
+
+// Reorders the clusters returned by optimize_vertex_cache() to reduce overdraw. positions points to the first position,
+// with stride bytes between consecutive vertices.
+void optimize_overdraw(std::span<uint32_t> indices, std::span<const uint32_t> clusters, float const* positions, uint32_t stride,
+	uint32_t vertex_count, uint32_t cache_size = 16, float threshold = 1.05f);
+
+// Reorders vertices in the order they are first used and rewrites indices to match. Unused vertices are removed.
+// vertices holds vertex_count vertices of vertex_size bytes each. Returns the new vertex count.
+uint32_t optimize_vertex_fetch(std::span<uint32_t> indices, void* vertices, uint32_t vertex_count, uint32_t vertex_size);
+
+// Runs all enabled optimizations on mesh data in place. Vertices may be in any vertex format and indices use info.index_bits.
+// info.vertex_count is updated if unused vertices were removed.
+MeshOptimizeReport optimize_mesh(MeshInfo& info, void* vertices, void* indices, MeshOptimizeSettings const& settings = {});
+
+// Optimizes the mesh data in place before packing it, see optimize_mesh().
+AssetFile pack_mesh(MeshInfo const& info, void* vertices, void* indices, MeshOptimizeSettings const& settings, MeshOptimizeReport* report = nullptr);
+
+}
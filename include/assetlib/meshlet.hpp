@@ -0,0 +1,58 @@
+#pragma once
+
+#include <assetlib/mesh.hpp>
+
+#include <vector>
+
+namespace assetlib {
+
+// Meshlets split a mesh into small clusters of triangles that can be culled on their own and are ready for mesh shaders.
+// Each meshlet references a range of meshlet_vertices, which index into the vertex buffer, and a range of
+// meshlet_triangles, which hold 3 local indices into that vertex range per triangle.
+
+// Layout is the same in memory and on disk, and matches std430 so it can be uploaded as is.
+struct Meshlet {
+	// Offset of the first vertex in meshlet_vertices
+	uint32_t vertex_offset = 0;
+	// Offset of the first triangle in meshlet_triangles, in triangles (so the first local index is at 3 * triangle_offset)
+	uint32_t triangle_offset = 0;
+	uint32_t vertex_count = 0;
+	uint32_t triangle_count = 0;
+	// Bounding sphere
+	float center[3]{};
+	float radius = 0.0f;
+	// Normal cone. The meshlet is backfacing and can be culled if
+	// dot(normalize(cone_apex - camera_position), cone_axis) >= cone_cutoff.
+	// A cone_cutoff of 1 means the triangles face too many directions for cone culling.
+	float cone_axis[3]{};
+	float cone_cutoff = 1.0f;
+	float cone_apex[3]{};
+	uint32_t padding = 0;
+};
+
+// Default limits, a good fit for most mesh shader implementations.
+constexpr uint32_t default_meshlet_vertices = 64;
+constexpr uint32_t default_meshlet_triangles = 124;
+// Local indices are 8 bits
+constexpr uint32_t max_meshlet_vertices = 255;
+
+struct MeshletData {
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> vertices;
+	std::vector<uint8_t> triangles;
+};
+
+// Splits the triangles of a mesh into meshlets of at most max_vertices vertices and max_triangles triangles,
+// in the order of the index buffer. Vertices may be in any vertex format and indices use info.index_bits.
+// Run optimize_mesh() first to get fuller meshlets.
+MeshletData build_meshlets(MeshInfo const& info, void const* vertices, void const* indices,
+	uint32_t max_vertices = default_meshlet_vertices, uint32_t max_triangles = default_meshlet_triangles);
+
+// Unpacks the meshlet section of a mesh on its own. dst_meshlets, dst_vertices and dst_triangles must hold
+// info.meshlet_count meshlets, info.meshlet_vertex_count vertex indices and 3 * info.meshlet_triangle_count local indices.
+void unpack_meshlets(MeshInfo const& info, AssetFile const& file, Meshlet* dst_meshlets, uint32_t* dst_vertices, uint8_t* dst_triangles,
+	Executor const& executor = {});
+void unpack_meshlets(MeshInfo const& info, AssetFileView const& file, Meshlet* dst_meshlets, uint32_t* dst_vertices, uint8_t* dst_triangles,
+	Executor const& executor = {});
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <assetlib/texture.hpp>
+
+#include <vector>
+
+namespace assetlib {
+
+// Pack time generation of mip chains. Every level is filtered from the one above it, with the color channels of
+// ColorSpace::sRGB textures converted to linear first. Alpha is always filtered as is.
+// Extents that are not a power of two are handled by weighting source texels by how much of them each destination
+// texel covers, so odd rows and columns are not dropped.
+//
+// Mips can only be generated for the uncompressed formats. Generate them before block compressing a texture,
+// see encode_texture() in block_compression.hpp.
+
+enum class MipFilter {
+	// Average of the covered texels. Fast, but a little blurry.
+	Box,
+	// Kaiser windowed sinc. Keeps more detail in the smaller mips, at the cost of a wider footprint.
+	Kaiser
+};
+
+struct MipSettings {
+	MipFilter filter = MipFilter::Box;
+	// Number of mip levels to generate, including mip 0. 0 generates the full chain down to 1x1.
+	uint32_t mip_levels = 0;
+	// Radius of the Kaiser window, in destination texels.
+	float kaiser_width = 3.0f;
+	// Shape of the Kaiser window, larger values fall off faster.
+	float kaiser_alpha = 4.0f;
+};
+
+// Downsamples a single image of src_width x src_height texels into dst_width x dst_height texels.
+// Rows of the destination are filtered in parallel through executor.
+void downsample_image(TextureFormat format, ColorSpace colorspace, void const* src, uint32_t src_width, uint32_t src_height,
+	void* dst, uint32_t dst_width, uint32_t dst_height, MipSettings const& settings = {}, Executor const& executor = {});
+
+// Generates the mip chain of a texture from mip 0 in pixel_data. info.mip_levels is ignored and updated together with
+// info.byte_size to describe the result, which holds every mip level starting with a copy of mip 0.
+std::vector<char> generate_mips(TextureInfo& info, void const* pixel_data, MipSettings const& settings = {}, Executor const& executor = {});
+
+// Generates the mip chain of a texture before packing it, see generate_mips(). pixel_data only holds mip 0.
+AssetFile pack_texture(TextureInfo const& info, void* pixel_data, MipSettings const& settings, Executor const& executor = {});
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+namespace assetlib {
+
+// Scalar conversions used by the compact asset formats. Bulk conversions use SIMD versions of these
+// that produce bit identical results.
+
+// IEEE 754 half precision, rounded to nearest even. Values too large for a half become infinity.
+uint16_t float_to_half(float value);
+float half_to_float(uint16_t value);
+
+// Shared exponent RGB with 9-bit mantissas and a 5-bit exponent, as in GL_EXT_texture_shared_exponent.
+// Negative values and NaN become 0, values too large are clamped to the largest representable value.
+uint32_t float3_to_rgb9e5(float const rgb[3]);
+void rgb9e5_to_float3(uint32_t value, float rgb[3]);
+
+// Unsigned 11-bit floats for red and green and a 10-bit float for blue, rounded to nearest even.
+// Negative values and NaN become 0, values too large (and infinity) are clamped to the largest finite value.
+uint32_t float3_to_r11g11b10f(float const rgb[3]);
+void r11g11b10f_to_float3(uint32_t value, float rgb[3]);
+
+// Signed normalized 16-bit integer, value is clamped to [-1, 1] and rounded to nearest.
+int16_t float_to_snorm16(float value);
+float snorm16_to_float(int16_t value);
+
+// sRGB transfer function, for values in [0, 1].
+float srgb_to_linear(float value);
+float linear_to_srgb(float value);
+
+// Octahedral encoding of a direction as two snorm16 values. The direction does not need to be normalized,
+// decoding always returns a unit vector. A zero vector decodes as +Z.
+void encode_octahedral(float const direction[3], int16_t encoded[2]);
+void decode_octahedral(int16_t const encoded[2], float direction[3]);
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace assetlib {
+
+// Memory supplied by the caller, such as an arena or a pool of staging memory.
+// An empty Allocator uses the global heap.
+struct Allocator {
+	// Returns size bytes aligned to at least alignment, or nullptr if there is no memory left.
+	std::function<void*(size_t size, size_t alignment)> allocate;
+	// Gives back memory returned by allocate. May be empty for arenas that are reset as a whole.
+	std::function<void(void* memory, size_t size)> deallocate;
+};
+
+// Uninitialized memory that is reused from one asset to the next. It only ever grows, so loading or unpacking
+// a stream of assets through the same buffer stops allocating once it has held the largest of them.
+class ScratchBuffer {
+public:
+	// Every ScratchBuffer starts out aligned to this many bytes
+	static constexpr size_t alignment = 64;
+
+	ScratchBuffer() = default;
+	explicit ScratchBuffer(Allocator allocator);
+	ScratchBuffer(ScratchBuffer const&) = delete;
+	ScratchBuffer(ScratchBuffer&& rhs) noexcept;
+	ScratchBuffer& operator=(ScratchBuffer const&) = delete;
+	ScratchBuffer& operator=(ScratchBuffer&& rhs) noexcept;
+	~ScratchBuffer();
+
+	// Returns at least size bytes. Their contents are undefined, nothing is kept from earlier uses.
+	// Returns nullptr if the allocator ran out of memory.
+	char* reserve(size_t size);
+	// Gives the memory back to the allocator.
+	void release();
+
+	char* data() const { return data_; }
+	size_t capacity() const { return capacity_; }
+
+private:
+	Allocator allocator;
+	char* data_ = nullptr;
+	size_t capacity_ = 0;
+};
+
+// Staging memory for packing, owned by the caller. Packing asset after asset through the same PackScratch stops
+// allocating staging once it has held the largest of them. The pack functions that don't take one stage in temporary
+// buffers that are freed before they return.
+struct PackScratch {
+	PackScratch() = default;
+	// All buffers allocate from allocator
+	explicit PackScratch(Allocator const& allocator);
+
+	// Gives all memory back, e.g. after packing an unusually large asset.
+	void release();
+
+	// Compressed chunks of a payload before they are appended to the blob, and the trial compression of CompressionMode::Auto
+	ScratchBuffer chunks;
+	// Data rearranged or converted before it is compressed, such as a texture tile or the converted maps of an environment
+	ScratchBuffer staging[3];
+};
+
+// Parallel unpack jobs keep a chunk or tile sized buffer per thread. Once it has grown beyond this many bytes it is
+// released after use, so a single huge asset doesn't stay resident on every worker thread.
+constexpr size_t thread_scratch_limit = 4 * 1024 * 1024;
+
+}
@@ -1,16 +1,32 @@
 #pragma once
 
 #include <assetlib/asset_file.hpp>
+#include <assetlib/compression.hpp>
+#include <assetlib/dictionary.hpp>
+#include <assetlib/thread_pool.hpp>
 #include <cstddef>
 
 namespace assetlib {
 
+// Stored by value, new formats must be added at the end.
 enum class TextureFormat {
 	Unknown = 0,
     R8,
     RG8,
     RGB8,
-	RGBA8
+	RGBA8,
+	// Block compressed formats, see block_compression.hpp. These store blocks of 4x4 texels,
+	// mip levels that are not a multiple of 4 texels are padded to whole blocks.
+	// RGB, 8 bytes per block
+	BC1,
+	// RGBA, 16 bytes per block
+	BC3,
+	// R, 8 bytes per block
+	BC4,
+	// RG, 16 bytes per block
+	BC5,
+	// RGBA, 16 bytes per block
+	BC7
 };
 
 enum class ColorSpace {
@@ -24,17 +40,154 @@ struct TextureInfo {
 	TextureFormat format = TextureFormat::Unknown;
     ColorSpace colorspace = ColorSpace::Unknown;
 	CompressionMode compression;
+	// Only used when packing. 0 selects the default level of the codec.
+	int compression_level = 0;
 	uint32_t extents[3]{ 0, 0, 0 };
 	uint32_t mip_levels = 0;
+	// Id of a registered dictionary to compress with, or 0 for none (see dictionary.hpp).
+	// Only worth it for small textures such as icons and decals, larger ones have enough repeats of their own.
+	uint64_t dictionary_id = 0;
+	// Width and height of the tiles every mip level is split into, in texels. 0 stores every mip level as a whole.
+	// Tiles are compressed on their own, so a few pages of a large texture can be decoded without the rest of it,
+	// see unpack_texture_tiles(). Must be a multiple of 4 for block compressed formats.
+	uint32_t tile_size = 0;
+};
+
+// A tile of a mip level, x and y count tiles. Tiles at the right and bottom edge of a mip level may be smaller than
+// tile_size. Untiled textures have a single tile per mip level.
+struct TextureTile {
+	uint32_t mip = 0;
+	uint32_t x = 0;
+	uint32_t y = 0;
 };
 
 // Read texture metadata from binary file
 TextureInfo read_texture_info(AssetFile const& file);
+TextureInfo read_texture_info(AssetFileView const& file);
+
+// Unpacks raw pixel data into destination buffer.
+// If an executor is given, the chunks of the texture are decompressed in parallel through it.
+void unpack_texture(TextureInfo const& info, AssetFile const& file, void* dst, Executor const& executor = {});
+void unpack_texture(TextureInfo const& info, AssetFileView const& file, void* dst, Executor const& executor = {});
+
+bool is_block_compressed(TextureFormat format);
+// Size in bytes of a texel, or of a 4x4 block for block compressed formats.
+uint32_t texture_format_byte_size(TextureFormat format);
+
+// Size in bytes of a single mip level after decompression
+uint64_t texture_mip_byte_size(TextureInfo const& info, uint32_t mip);
+// Number of mip levels in a full chain down to 1x1
+uint32_t texture_max_mip_levels(TextureInfo const& info);
+// Offset of a mip level in the fully unpacked texture. Mip levels are stored largest first.
+uint64_t texture_mip_byte_offset(TextureInfo const& info, uint32_t mip);
+
+// Unpacks only mip levels [first_mip, last_mip] into dst, tightly packed starting with first_mip.
+// Only the compressed data of these mip levels is touched, so with a mapped file the other mips are never read from disk.
+void unpack_texture_mips(TextureInfo const& info, AssetFile const& file, uint32_t first_mip, uint32_t last_mip, void* dst, Executor const& executor = {});
+void unpack_texture_mips(TextureInfo const& info, AssetFileView const& file, uint32_t first_mip, uint32_t last_mip, void* dst, Executor const& executor = {});
+
+// Layout of a texture in staging memory, so it can be unpacked straight into an upload buffer.
+struct TextureLayout {
+	// Every row starts at a multiple of this many bytes. Rows are rows of blocks for block compressed formats.
+	uint32_t row_alignment = 1;
+	// Every mip level starts at a multiple of this many bytes.
+	uint32_t mip_alignment = 1;
+	// If not empty, the offset of every mip level in the destination, for example as computed by the graphics API.
+	// Replaces the offsets from mip_alignment.
+	std::span<uint64_t const> mip_offsets;
+	// Expands R8, RG8 and RGB8 texels to RGBA8 while unpacking. Missing color channels are 0 and alpha is 255.
+	bool expand_to_rgba = false;
+};
+
+// Bytes between the rows of a mip level in a layout
+uint64_t texture_layout_row_pitch(TextureInfo const& info, TextureLayout const& layout, uint32_t mip);
+// Offset of a mip level in a layout
+uint64_t texture_layout_mip_offset(TextureInfo const& info, TextureLayout const& layout, uint32_t mip);
+// Size of a buffer holding every mip level in a layout
+uint64_t texture_layout_byte_size(TextureInfo const& info, TextureLayout const& layout);
+
+// Unpacks every mip level straight into a layout. Every chunk is placed as soon as it is decompressed,
+// so there is no tightly packed copy of the texture in between.
+void unpack_texture(TextureInfo const& info, AssetFile const& file, TextureLayout const& layout, void* dst, Executor const& executor = {});
+void unpack_texture(TextureInfo const& info, AssetFileView const& file, TextureLayout const& layout, void* dst, Executor const& executor = {});
+
+// Number of tiles of a mip level along x and y
+void texture_tile_count(TextureInfo const& info, uint32_t mip, uint32_t& tiles_x, uint32_t& tiles_y);
+// Size in bytes of a tile after decompression. Its rows are tightly packed, rows of blocks for block compressed formats.
+uint64_t texture_tile_byte_size(TextureInfo const& info, TextureTile const& tile);
 
-// Unpacks raw pixel data into destination buffer
-void unpack_texture(TextureInfo const& info, AssetFile const& file, void* dst);
+// Unpacks tiles into dst one after the other, in the order given. Only the compressed data of these tiles is touched.
+// If an executor is given, the tiles are decompressed in parallel through it.
+void unpack_texture_tiles(TextureInfo const& info, AssetFile const& file, std::span<TextureTile const> tiles, void* dst, Executor const& executor = {});
+void unpack_texture_tiles(TextureInfo const& info, AssetFileView const& file, std::span<TextureTile const> tiles, void* dst, Executor const& executor = {});
 
-// Packs raw pixel data into a binary asset file ready to save to disk
+// Unpacks the rectangle of width x height texels at x, y of a mip level into dst, with dst_row_pitch bytes between rows
+// (0 for tightly packed rows). Only the tiles overlapping the rectangle are decompressed, untiled textures decompress the whole mip.
+// For block compressed formats x and y must be multiples of 4 and the rows of dst are rows of blocks.
+void unpack_texture_region(TextureInfo const& info, AssetFile const& file, uint32_t mip, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+	void* dst, uint64_t dst_row_pitch = 0, Executor const& executor = {});
+void unpack_texture_region(TextureInfo const& info, AssetFileView const& file, uint32_t mip, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+	void* dst, uint64_t dst_row_pitch = 0, Executor const& executor = {});
+
+// Packs raw pixel data into a binary asset file ready to save to disk. pixel_data holds every mip level,
+// see mipmap.hpp to generate them.
 AssetFile pack_texture(TextureInfo const& info, void* pixel_data);
+// Same as above, but packs into file and reuses the storage it already holds. Packing asset after asset into the same
+// AssetFile stops allocating for the blob once it has grown to the largest one.
+void pack_texture(TextureInfo const& info, void* pixel_data, AssetFile& file);
+// Same as above, but stages through scratch, so packing asset after asset with the same scratch stops allocating for staging too.
+void pack_texture(TextureInfo const& info, void* pixel_data, AssetFile& file, PackScratch& scratch);
+
+// Entry of the mip table at the start of the binary blob of a texture
+struct MipTableEntry {
+	// Offset of the chunked payload holding this mip in the binary blob
+	uint32_t offset = 0;
+	uint32_t stored_size = 0;
+	// Size of the mip after decompression
+	uint32_t byte_size = 0;
+};
+
+// Entry of the tile table of tiled textures, which follows the mip table
+struct TileTableEntry {
+	// Offset of the chunked payload holding this tile in the binary blob
+	uint32_t offset = 0;
+	uint32_t stored_size = 0;
+};
+
+// Packs a texture while the pixel data comes in, for example row by row or mip by mip from an importer.
+// Data is compressed chunk by chunk as soon as it arrives, so the uncompressed texture is never held in memory.
+// When packing to a stream, the compressed texture is held in memory until finish().
+// Unlike pack_texture(), incompressible textures are not converted to CompressionMode::None as a whole,
+// but every chunk that does not compress is still stored raw. CompressionMode::Auto can't sample the data up front,
+// see resolve_compression(). Tiled textures can't be stream packed, since tiles need rows that have not come in yet.
+class TextureStreamPacker {
+public:
+	bool open(std::filesystem::path const& path, TextureInfo const& info);
+	void open(plib::binary_output_stream& out, TextureInfo const& info);
+
+	// Appends pixel data in the same order pack_texture() expects it: mip 0 first, each mip row by row.
+	// Data may be split at any byte.
+	void write(void const* data, size_t size);
+
+	// Writes the mip table and the header. Returns false if writing failed or if the amount of data written
+	// does not match the texture info.
+	bool finish();
+
+private:
+	void begin(TextureInfo const& info);
+	void begin_blob();
+	void begin_mip();
+
+	TextureInfo info;
+	// Keeps the dictionary alive while compression refers to it
+	std::shared_ptr<Dictionary const> dictionary;
+	CompressionChoice compression;
+	AssetFileWriter writer;
+	ChunkedPayloadWriter payload;
+	std::vector<MipTableEntry> mip_table;
+	uint32_t current_mip = 0;
+	uint64_t remaining_in_mip = 0;
+	bool ok = true;
+};
 
 }
\ No newline at end of file
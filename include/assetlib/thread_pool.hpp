@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace assetlib {
+
+// Runs job(i) for every i in [0, count) and only returns once all of them have finished.
+// Jobs may run in any order and on any thread. An empty Executor runs all jobs serially on the calling thread.
+using Executor = std::function<void(uint32_t count, std::function<void(uint32_t)> const& job)>;
+
+// Runs all jobs through executor, or serially if no executor was given.
+void run_jobs(Executor const& executor, uint32_t count, std::function<void(uint32_t)> const& job);
+
+// Simple fixed-size worker pool.
+class ThreadPool {
+public:
+	// A thread count of 0 uses one thread per hardware thread.
+	explicit ThreadPool(uint32_t threads = 0);
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+	~ThreadPool();
+
+	// Queues a task to be run on one of the worker threads.
+	void submit(std::function<void()> task);
+
+	// Runs job for every index in [0, count). The calling thread takes part in the work,
+	// so this may safely be called from inside a task running on this pool.
+	void parallel_for(uint32_t count, std::function<void(uint32_t)> const& job);
+
+	// Returns an executor that schedules jobs on this pool. The pool must outlive the executor.
+	Executor executor();
+
+	uint32_t thread_count() const { return static_cast<uint32_t>(workers.size()); }
+
+private:
+	void worker_main();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable task_available;
+	bool stopping = false;
+};
+
+}
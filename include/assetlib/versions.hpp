@@ -30,8 +30,11 @@ inline constexpr uint8_t patch_version(uint32_t version) {
 	return version & 0xFF;
 }
 
-constexpr uint32_t itex_version = pack_version(1, 0, 1);
-constexpr uint32_t mesh_version = pack_version(1, 0, 0);
-constexpr uint32_t ienv_version = pack_version(1, 0, 0);
+constexpr uint32_t itex_version = pack_version(2, 4, 0);
+constexpr uint32_t mesh_version = pack_version(2, 5, 0);
+constexpr uint32_t ienv_version = pack_version(2, 2, 0);
+constexpr uint32_t archive_version = pack_version(1, 0, 0);
+constexpr uint32_t dict_version = pack_version(1, 0, 0);
+constexpr uint32_t asset_index_version = pack_version(1, 0, 0);
 
 }
\ No newline at end of file
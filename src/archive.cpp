@@ -0,0 +1,214 @@
+#include <assetlib/archive.hpp>
+#include <assetlib/dictionary.hpp>
+
+#include <plib/stream.hpp>
+#include <xxhash.h>
+
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+namespace assetlib {
+
+static_assert(sizeof(ArchiveHeader) == 40, "ArchiveHeader must not contain padding");
+static_assert(sizeof(ArchiveEntry) == 40, "ArchiveEntry must not contain padding");
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void write_padding(plib::binary_output_stream& out, uint64_t count) {
+	static constexpr char zeroes[256]{};
+	while (count > 0) {
+		uint64_t const size = std::min<uint64_t>(count, sizeof(zeroes));
+		out.write(zeroes, size);
+		count -= size;
+	}
+}
+
+uint64_t archive_id(std::string_view name) {
+	return XXH64(name.data(), name.size(), 0);
+}
+
+ArchiveBuilder::ArchiveBuilder(uint32_t alignment) : alignment(alignment) {
+	assert(std::has_single_bit(alignment) && "Archive alignment must be a power of two");
+}
+
+void ArchiveBuilder::add(std::string_view name, AssetFileView const& file) {
+	add(archive_id(name), name, file);
+}
+
+void ArchiveBuilder::add(uint64_t id, std::string_view name, AssetFileView const& file) {
+	PendingEntry entry;
+	entry.id = id;
+	entry.name = name;
+	std::memcpy(entry.file.type, file.type, sizeof(file.type));
+	entry.file.version = file.version;
+	entry.file.metadata_json = file.metadata_json;
+	entry.file.binary_blob.assign(file.binary_blob.begin(), file.binary_blob.end());
+	entries.push_back(std::move(entry));
+}
+
+bool ArchiveBuilder::write(plib::binary_output_stream& out) const {
+	ArchiveHeader header;
+	std::memcpy(header.magic, "AARC", 4);
+	header.version = archive_version;
+	header.entry_count = entries.size();
+	// Keep the load factor at or below 50% so probe sequences stay short
+	header.bucket_count = std::bit_ceil(std::max<uint32_t>(2 * header.entry_count, 1));
+	header.alignment = alignment;
+
+	std::vector<ArchiveEntry> toc(entries.size());
+	std::vector<uint32_t> buckets(header.bucket_count, 0);
+	uint32_t const mask = header.bucket_count - 1;
+	for (uint32_t i = 0; i < entries.size(); ++i) {
+		PendingEntry const& pending = entries[i];
+		ArchiveEntry& entry = toc[i];
+		entry.id = pending.id;
+		entry.name_offset = header.names_size;
+		entry.name_length = pending.name.size();
+		header.names_size += entry.name_length;
+		std::memcpy(entry.type, pending.file.type, sizeof(entry.type));
+		entry.version = pending.file.version;
+		entry.metadata_size = pending.file.metadata_json.size();
+		entry.blob_size = pending.file.binary_blob.size();
+
+		uint32_t bucket = entry.id & mask;
+		while (buckets[bucket] != 0) {
+			if (toc[buckets[bucket] - 1].id == entry.id) {
+				assert(false && "Duplicate asset id in archive");
+				return false;
+			}
+			bucket = (bucket + 1) & mask;
+		}
+		buckets[bucket] = i + 1;
+	}
+
+	header.names_offset = sizeof(ArchiveHeader) + toc.size() * sizeof(ArchiveEntry) + buckets.size() * sizeof(uint32_t);
+	header.data_offset = align_up(header.names_offset + header.names_size, alignment);
+	uint64_t offset = header.data_offset;
+	for (ArchiveEntry& entry : toc) {
+		entry.offset = offset;
+		offset = align_up(offset + asset_file_header_size + entry.metadata_size + entry.blob_size, alignment);
+	}
+
+	out.write(&header, 1);
+	out.write(toc.data(), toc.size());
+	out.write(buckets.data(), buckets.size());
+	for (PendingEntry const& pending : entries) {
+		out.write(pending.name.data(), pending.name.size());
+	}
+	write_padding(out, header.data_offset - (header.names_offset + header.names_size));
+
+	uint64_t position = header.data_offset;
+	for (uint32_t i = 0; i < entries.size(); ++i) {
+		write_padding(out, toc[i].offset - position);
+		save_binary_file(out, entries[i].file);
+		position = toc[i].offset + asset_file_header_size + toc[i].metadata_size + toc[i].blob_size;
+	}
+	return true;
+}
+
+bool Archive::open(std::filesystem::path const& path) {
+	close();
+	if (!mapping.open(path)) return false;
+
+	std::span<const char> const data = mapping.data();
+	if (data.size() < sizeof(ArchiveHeader)) {
+		close();
+		return false;
+	}
+	std::memcpy(&header, data.data(), sizeof(ArchiveHeader));
+	bool valid = std::memcmp(header.magic, "AARC", 4) == 0
+		&& major_version(header.version) == major_version(archive_version)
+		&& std::has_single_bit(header.bucket_count)
+		&& header.bucket_count >= header.entry_count;
+	uint64_t const toc_end = sizeof(ArchiveHeader) + uint64_t(header.entry_count) * sizeof(ArchiveEntry);
+	uint64_t const buckets_end = toc_end + uint64_t(header.bucket_count) * sizeof(uint32_t);
+	valid = valid && header.names_offset == buckets_end && header.names_offset + header.names_size <= data.size();
+	if (!valid) {
+		close();
+		return false;
+	}
+
+	// The mapping is page aligned and both the header and the entries are multiples of 8 bytes large,
+	// so the table of contents and the buckets can be used in place.
+	entries = reinterpret_cast<ArchiveEntry const*>(data.data() + sizeof(ArchiveHeader));
+	buckets = reinterpret_cast<uint32_t const*>(data.data() + toc_end);
+	names = data.data() + header.names_offset;
+	return true;
+}
+
+void Archive::close() {
+	mapping.close();
+	header = {};
+	entries = nullptr;
+	buckets = nullptr;
+	names = nullptr;
+}
+
+ArchiveEntry const* Archive::find_entry(uint64_t id, std::string_view name, bool check_name) const {
+	if (header.entry_count == 0) return nullptr;
+	uint32_t const mask = header.bucket_count - 1;
+	uint32_t bucket = id & mask;
+	// The table is at most half full, so this always hits an empty bucket eventually.
+	for (uint32_t probes = 0; probes < header.bucket_count; ++probes) {
+		uint32_t const index = buckets[bucket];
+		if (index == 0 || index > header.entry_count) return nullptr;
+		ArchiveEntry const& entry = entries[index - 1];
+		if (entry.id == id && (!check_name || this->name(entry) == name)) return &entry;
+		bucket = (bucket + 1) & mask;
+	}
+	return nullptr;
+}
+
+std::optional<AssetFileView> Archive::find(std::string_view name) const {
+	ArchiveEntry const* entry = find_entry(archive_id(name), name, true);
+	if (!entry) return std::nullopt;
+	return view(*entry);
+}
+
+std::optional<AssetFileView> Archive::find(uint64_t id) const {
+	ArchiveEntry const* entry = find_entry(id, {}, false);
+	if (!entry) return std::nullopt;
+	return view(*entry);
+}
+
+ArchiveEntry const& Archive::entry(uint32_t index) const {
+	assert(index < header.entry_count && "Archive entry index out of range");
+	return entries[index];
+}
+
+std::string_view Archive::name(ArchiveEntry const& entry) const {
+	if (uint64_t(entry.name_offset) + entry.name_length > header.names_size) return {};
+	return std::string_view(names + entry.name_offset, entry.name_length);
+}
+
+AssetFileView Archive::view(ArchiveEntry const& entry) const {
+	// Build the view from the table of contents alone, so the asset's pages are not touched until it's unpacked.
+	AssetFileView view;
+	std::span<const char> const data = mapping.data();
+	uint64_t const metadata_offset = entry.offset + asset_file_header_size;
+	if (metadata_offset + entry.metadata_size + entry.blob_size > data.size()) {
+		assert(false && "Corrupted archive entry");
+		return view;
+	}
+	std::memcpy(view.type, entry.type, sizeof(view.type));
+	view.version = entry.version;
+	view.metadata_json = std::string_view(data.data() + metadata_offset, entry.metadata_size);
+	view.binary_blob = data.subspan(metadata_offset + entry.metadata_size, entry.blob_size);
+	return view;
+}
+
+uint32_t register_dictionaries(Archive const& archive) {
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < archive.size(); ++i) {
+		ArchiveEntry const& entry = archive.entry(i);
+		if (std::memcmp(entry.type, "DICT", 4) != 0) continue;
+		register_dictionary(unpack_dictionary(archive.view(entry)));
+		count += 1;
+	}
+	return count;
+}
+
+}
@@ -1,7 +1,26 @@
 #include <assetlib/asset_file.hpp>
 
+#include "instrumentation_scope.hpp"
+
 #include <plib/stream.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace assetlib {
 
 std::string compression_to_string(CompressionMode compression) {
@@ -10,15 +29,34 @@ std::string compression_to_string(CompressionMode compression) {
 		return "None";
 	case CompressionMode::LZ4:
 		return "LZ4";
+	case CompressionMode::LZ4HC:
+		return "LZ4HC";
+	case CompressionMode::Auto:
+		return "Auto";
+	default:
+		return "Custom" + std::to_string(static_cast<uint32_t>(compression));
 	}
 }
 
 CompressionMode parse_compression_mode(std::string_view compression) {
 	if (compression == "LZ4") { return CompressionMode::LZ4; }
+	if (compression == "LZ4HC") { return CompressionMode::LZ4HC; }
+	if (compression == "Auto") { return CompressionMode::Auto; }
+	if (compression.starts_with("Custom")) {
+		return static_cast<CompressionMode>(std::strtoul(std::string(compression.substr(6)).c_str(), nullptr, 10));
+	}
 	return CompressionMode::None;
 }
 
 bool save_binary_file(plib::binary_output_stream& out, AssetFile const& file) {
+	return save_binary_file(out, make_view(file));
+}
+
+bool save_binary_file(plib::binary_output_stream& out, AssetFileView const& file) {
+	// The header stores both sizes in 32 bits
+	if (file.metadata_json.size() > std::numeric_limits<uint32_t>::max() || file.binary_blob.size() > std::numeric_limits<uint32_t>::max()) {
+		return false;
+	}
 	// Write metadata
 	out.write(file.type, sizeof(file.type));
 	uint32_t version = file.version;
@@ -39,11 +77,14 @@ bool save_binary_file(plib::binary_output_stream& out, AssetFile const& file) {
 }
 
 bool load_binary_file(plib::binary_input_stream& in, AssetFile& file) {
+	StageScope stage(LoadStage::FileRead);
 	in.read(file.type, sizeof(file.type));
 	in.read(&file.version, 1);
 	uint32_t json_length, binary_length;
 	in.read(&json_length, 1);
 	in.read(&binary_length, 1);
+	stage.set_type(file.type);
+	stage.set_bytes(asset_file_header_size + uint64_t(json_length) + binary_length, 0);
 
 	file.metadata_json.resize(json_length);
 	file.binary_blob.resize(binary_length);
@@ -53,4 +94,321 @@ bool load_binary_file(plib::binary_input_stream& in, AssetFile& file) {
 	return true;
 }
 
+bool load_binary_file(plib::binary_input_stream& in, ScratchBuffer& storage, AssetFileView& view) {
+	StageScope stage(LoadStage::FileRead);
+	in.read(view.type, sizeof(view.type));
+	in.read(&view.version, 1);
+	uint32_t json_length, binary_length;
+	in.read(&json_length, 1);
+	in.read(&binary_length, 1);
+	stage.set_type(view.type);
+	stage.set_bytes(asset_file_header_size + uint64_t(json_length) + binary_length, 0);
+
+	char* data = storage.reserve(uint64_t(json_length) + binary_length);
+	if (!data) return false;
+	in.read(data, uint64_t(json_length) + binary_length);
+	view.metadata_json = std::string_view(data, json_length);
+	view.binary_blob = std::span<const char>(data + json_length, binary_length);
+	return true;
+}
+
+// Type codes are four printable characters, anything else is not an asset file
+static bool valid_probe_header(char const* type, uint32_t json_length) {
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (type[i] < ' ' || type[i] > '~') return false;
+	}
+	return json_length <= max_probe_metadata_size;
+}
+
+bool probe_binary_file(plib::binary_input_stream& in, AssetFileProbe& probe) {
+	StageScope stage(LoadStage::FileRead);
+	in.read(probe.type, sizeof(probe.type));
+	in.read(&probe.version, 1);
+	uint32_t json_length;
+	in.read(&json_length, 1);
+	in.read(&probe.blob_size, 1);
+	if (!valid_probe_header(probe.type, json_length)) return false;
+	stage.set_type(probe.type);
+	stage.set_bytes(asset_file_header_size + json_length, 0);
+
+	probe.metadata_json.resize(json_length);
+	in.read(probe.metadata_json.data(), json_length);
+
+	// The stream can't seek, so the blob is read in small pieces and dropped
+	char discard[4096];
+	for (uint32_t remaining = probe.blob_size; remaining > 0;) {
+		uint32_t const size = std::min<uint32_t>(remaining, sizeof(discard));
+		in.read(discard, size);
+		remaining -= size;
+	}
+	return true;
+}
+
+bool probe_binary_file(std::filesystem::path const& path, AssetFileProbe& probe) {
+	StageScope stage(LoadStage::FileRead);
+	std::ifstream file(path, std::ios::binary);
+	char header[asset_file_header_size];
+	if (!file || !file.read(header, sizeof(header))) return false;
+
+	uint32_t json_length, binary_length;
+	std::memcpy(probe.type, header, sizeof(probe.type));
+	std::memcpy(&probe.version, header + 4, sizeof(uint32_t));
+	std::memcpy(&json_length, header + 8, sizeof(uint32_t));
+	std::memcpy(&binary_length, header + 12, sizeof(uint32_t));
+	if (!valid_probe_header(probe.type, json_length)) return false;
+	// Any other file would have to match its first 16 bytes by chance
+	std::error_code ec;
+	if (std::filesystem::file_size(path, ec) != asset_file_header_size + uint64_t(json_length) + binary_length || ec) return false;
+	stage.set_type(probe.type);
+	stage.set_bytes(asset_file_header_size + json_length, 0);
+
+	probe.metadata_json.resize(json_length);
+	if (!file.read(probe.metadata_json.data(), json_length)) return false;
+	probe.blob_size = binary_length;
+	return true;
+}
+
+AssetFileView make_view(AssetFile const& file) {
+	AssetFileView view;
+	std::memcpy(view.type, file.type, sizeof(view.type));
+	view.version = file.version;
+	view.metadata_json = file.metadata_json;
+	view.binary_blob = file.binary_blob;
+	return view;
+}
+
+AssetFileView make_view(AssetFileProbe const& probe) {
+	AssetFileView view;
+	std::memcpy(view.type, probe.type, sizeof(view.type));
+	view.version = probe.version;
+	view.metadata_json = probe.metadata_json;
+	return view;
+}
+
+void write_metadata(AssetFile& file, void* binary_info, uint32_t size, std::string_view json) {
+	file.metadata_json = make_metadata(binary_info, size, json);
+}
+
+std::string make_metadata(void* binary_info, uint32_t size, std::string_view json) {
+	BinaryInfoHeader header;
+	std::memcpy(header.magic, "BINF", 4);
+	header.size = size;
+	std::memcpy(binary_info, &header, sizeof(header));
+
+	std::string metadata;
+	metadata.reserve(size + json.size());
+	metadata.append(reinterpret_cast<char const*>(binary_info), size);
+	metadata.append(json);
+	return metadata;
+}
+
+static bool read_binary_info_header(std::string_view metadata, BinaryInfoHeader& header) {
+	if (metadata.size() < sizeof(BinaryInfoHeader)) return false;
+	std::memcpy(&header, metadata.data(), sizeof(BinaryInfoHeader));
+	return std::memcmp(header.magic, "BINF", 4) == 0 && header.size >= sizeof(BinaryInfoHeader) && header.size <= metadata.size();
+}
+
+bool read_binary_info(AssetFileView const& file, void* dst, uint32_t size) {
+	BinaryInfoHeader header;
+	if (!read_binary_info_header(file.metadata_json, header)) return false;
+
+	uint32_t const copy_size = std::min(header.size, size);
+	std::memcpy(dst, file.metadata_json.data(), copy_size);
+	std::memset(reinterpret_cast<char*>(dst) + copy_size, 0, size - copy_size);
+	return true;
+}
+
+std::string_view json_metadata(AssetFileView const& file) {
+	BinaryInfoHeader header;
+	if (!read_binary_info_header(file.metadata_json, header)) return file.metadata_json;
+	return file.metadata_json.substr(header.size);
+}
+
+bool view_binary_file(std::span<const char> memory, AssetFileView& view) {
+	if (memory.size() < asset_file_header_size) return false;
+
+	char const* header = memory.data();
+	uint32_t json_length, binary_length;
+	std::memcpy(view.type, header, sizeof(view.type));
+	std::memcpy(&view.version, header + 4, sizeof(uint32_t));
+	std::memcpy(&json_length, header + 8, sizeof(uint32_t));
+	std::memcpy(&binary_length, header + 12, sizeof(uint32_t));
+
+	// Check in 64 bits so a corrupted header cannot overflow the addition
+	if (asset_file_header_size + uint64_t(json_length) + uint64_t(binary_length) > memory.size()) return false;
+
+	view.metadata_json = std::string_view(header + asset_file_header_size, json_length);
+	view.binary_blob = memory.subspan(asset_file_header_size + json_length, binary_length);
+	return true;
+}
+
+bool AssetFileWriter::open(std::filesystem::path const& path, char const* type, uint32_t version, std::string_view metadata) {
+	std::memcpy(this->type, type, 4);
+	this->version = version;
+	blob_size_ = 0;
+	metadata_size = metadata.size();
+	stream = nullptr;
+	if (metadata.size() > std::numeric_limits<uint32_t>::max()) return false;
+	file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!file) return false;
+
+	// Placeholder header, the blob size is only known in finish()
+	char header[asset_file_header_size]{};
+	file.write(header, sizeof(header));
+	file.write(metadata.data(), metadata.size());
+	return file.good();
+}
+
+void AssetFileWriter::open(plib::binary_output_stream& out, char const* type, uint32_t version) {
+	std::memcpy(this->type, type, 4);
+	this->version = version;
+	blob_size_ = 0;
+	metadata_size = 0;
+	stream = &out;
+	buffer.clear();
+}
+
+void AssetFileWriter::append(void const* data, size_t size) {
+	if (stream) {
+		char const* bytes = reinterpret_cast<char const*>(data);
+		buffer.insert(buffer.end(), bytes, bytes + size);
+	} else {
+		file.write(reinterpret_cast<char const*>(data), size);
+	}
+	blob_size_ += size;
+}
+
+void AssetFileWriter::patch(uint64_t offset, void const* data, size_t size) {
+	assert(offset + size <= blob_size_ && "Patching data that was not written yet");
+	if (stream) {
+		std::memcpy(buffer.data() + offset, data, size);
+	} else {
+		file.seekp(asset_file_header_size + metadata_size + offset);
+		file.write(reinterpret_cast<char const*>(data), size);
+		file.seekp(0, std::ios::end);
+	}
+}
+
+bool AssetFileWriter::finish(std::string_view metadata) {
+	// The header stores both sizes in 32 bits, a larger file would be written with wrapped sizes
+	bool const fits = metadata.size() <= std::numeric_limits<uint32_t>::max() && blob_size_ <= std::numeric_limits<uint32_t>::max();
+	if (stream) {
+		AssetFileView view;
+		std::memcpy(view.type, type, sizeof(type));
+		view.version = version;
+		view.metadata_json = metadata;
+		view.binary_blob = buffer;
+		bool const ok = fits && save_binary_file(*stream, view);
+		buffer = {};
+		stream = nullptr;
+		return ok;
+	}
+
+	assert(metadata.size() == metadata_size && "Metadata size changed while writing");
+	uint32_t const json_length = metadata.size();
+	uint32_t const binary_length = blob_size_;
+	file.seekp(0);
+	file.write(type, sizeof(type));
+	file.write(reinterpret_cast<char const*>(&version), sizeof(version));
+	file.write(reinterpret_cast<char const*>(&json_length), sizeof(json_length));
+	file.write(reinterpret_cast<char const*>(&binary_length), sizeof(binary_length));
+	file.write(metadata.data(), metadata.size());
+	bool const ok = fits && file.good();
+	file.close();
+	return ok;
+}
+
+bool map_binary_file(std::filesystem::path const& path, MappedFile& mapping, AssetFileView& view) {
+	if (!mapping.open(path)) return false;
+	return view_binary_file(mapping.data(), view);
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept {
+	*this = std::move(rhs);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept {
+	if (this != &rhs) {
+		close();
+		std::swap(data_, rhs.data_);
+		std::swap(size_, rhs.size_);
+#ifdef _WIN32
+		std::swap(file_handle_, rhs.file_handle_);
+		std::swap(mapping_handle_, rhs.mapping_handle_);
+#endif
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(std::filesystem::path const& path) {
+	close();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle_ = file;
+	mapping_handle_ = mapping;
+	data_ = static_cast<char const*>(data);
+	size_ = size.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping_handle_) CloseHandle(mapping_handle_);
+	if (file_handle_) CloseHandle(file_handle_);
+	data_ = nullptr;
+	size_ = 0;
+	file_handle_ = nullptr;
+	mapping_handle_ = nullptr;
+}
+
+#else
+
+bool MappedFile::open(std::filesystem::path const& path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	if (data == MAP_FAILED) return false;
+	data_ = static_cast<char const*>(data);
+	size_ = st.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) munmap(const_cast<char*>(data_), size_);
+	data_ = nullptr;
+	size_ = 0;
+}
+
+#endif
+
 }
\ No newline at end of file
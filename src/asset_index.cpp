@@ -0,0 +1,217 @@
+#include <assetlib/asset_index.hpp>
+#include <assetlib/archive.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace assetlib {
+
+static_assert(sizeof(AssetIndexHeader) == 40, "AssetIndexHeader must not contain padding");
+static_assert(sizeof(AssetIndexEntry) == 56, "AssetIndexEntry must not contain padding");
+
+namespace {
+
+struct PendingEntry {
+	AssetIndexEntry entry;
+	std::string path;
+	std::string metadata;
+};
+
+}
+
+static bool write_index(std::filesystem::path const& path, std::vector<PendingEntry>& pending) {
+	AssetIndexHeader header;
+	std::memcpy(header.magic, "AIDX", 4);
+	header.version = asset_index_version;
+	header.entry_count = pending.size();
+	// Keep the load factor at or below 50% so probe sequences stay short
+	header.bucket_count = std::bit_ceil(std::max<uint32_t>(2 * header.entry_count, 1));
+
+	std::vector<AssetIndexEntry> entries(pending.size());
+	std::vector<uint32_t> buckets(header.bucket_count, 0);
+	uint32_t const mask = header.bucket_count - 1;
+	uint64_t paths_size = 0;
+	uint64_t metadata_size = 0;
+	for (uint32_t i = 0; i < pending.size(); ++i) {
+		AssetIndexEntry& entry = entries[i];
+		entry = pending[i].entry;
+		entry.id = archive_id(pending[i].path);
+		entry.path_offset = paths_size;
+		entry.path_length = pending[i].path.size();
+		entry.metadata_offset = metadata_size;
+		entry.metadata_size = pending[i].metadata.size();
+		paths_size += entry.path_length;
+		metadata_size += entry.metadata_size;
+
+		uint32_t bucket = entry.id & mask;
+		while (buckets[bucket] != 0) {
+			bucket = (bucket + 1) & mask;
+		}
+		buckets[bucket] = i + 1;
+	}
+	if (paths_size > std::numeric_limits<uint32_t>::max() || metadata_size > std::numeric_limits<uint32_t>::max()) {
+		assert(false && "Asset index too large");
+		return false;
+	}
+	header.paths_size = paths_size;
+	header.metadata_size = metadata_size;
+	header.paths_offset = sizeof(AssetIndexHeader) + entries.size() * sizeof(AssetIndexEntry) + buckets.size() * sizeof(uint32_t);
+	header.metadata_offset = header.paths_offset + header.paths_size;
+
+	std::ofstream file(path, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!file) return false;
+	file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+	file.write(reinterpret_cast<char const*>(entries.data()), entries.size() * sizeof(AssetIndexEntry));
+	file.write(reinterpret_cast<char const*>(buckets.data()), buckets.size() * sizeof(uint32_t));
+	for (PendingEntry const& entry : pending) {
+		file.write(entry.path.data(), entry.path.size());
+	}
+	for (PendingEntry const& entry : pending) {
+		file.write(entry.metadata.data(), entry.metadata.size());
+	}
+	return file.good();
+}
+
+bool update_asset_index(std::filesystem::path const& directory, std::filesystem::path const& index_path, AssetIndexStats* stats) {
+	AssetIndexStats counts;
+	AssetIndex previous;
+	previous.open(index_path);
+	std::vector<bool> seen(previous.size(), false);
+
+	std::error_code ec;
+	std::string const index_name = std::filesystem::relative(index_path, directory, ec).generic_string();
+	std::string const temporary_name = index_name + ".tmp";
+
+	std::vector<PendingEntry> pending;
+	AssetFileProbe probe;
+	for (std::filesystem::recursive_directory_iterator it(directory, std::filesystem::directory_options::skip_permission_denied, ec), end;
+		!ec && it != end; it.increment(ec)) {
+		std::filesystem::directory_entry const& file = *it;
+		if (!file.is_regular_file(ec)) continue;
+		std::string path = std::filesystem::relative(file.path(), directory, ec).generic_string();
+		if (ec || path == index_name || path == temporary_name) continue;
+
+		PendingEntry result;
+		result.entry.file_size = file.file_size(ec);
+		result.entry.modified = file.last_write_time(ec).time_since_epoch().count();
+		if (ec) continue;
+		AssetIndexEntry const* known = previous.find(path);
+		if (known && known->file_size == result.entry.file_size && known->modified == result.entry.modified) {
+			seen[known - &previous.entry(0)] = true;
+			AssetFileView const view = previous.view(*known);
+			std::memcpy(result.entry.type, known->type, sizeof(result.entry.type));
+			result.entry.version = known->version;
+			result.entry.blob_size = known->blob_size;
+			result.metadata = view.metadata_json;
+			counts.unchanged += 1;
+		} else {
+			// A file that changed into something else than an asset file is counted as removed below
+			if (!probe_binary_file(file.path(), probe)) continue;
+			if (known) seen[known - &previous.entry(0)] = true;
+			std::memcpy(result.entry.type, probe.type, sizeof(result.entry.type));
+			result.entry.version = probe.version;
+			result.entry.blob_size = probe.blob_size;
+			result.metadata = std::move(probe.metadata_json);
+			counts.probed += 1;
+		}
+		result.path = std::move(path);
+		pending.push_back(std::move(result));
+	}
+	if (ec) return false;
+	counts.removed = std::count(seen.begin(), seen.end(), false);
+	// The old index may not be mapped while it's replaced
+	previous.close();
+
+	std::sort(pending.begin(), pending.end(), [](PendingEntry const& lhs, PendingEntry const& rhs) { return lhs.path < rhs.path; });
+	// Written next to the index first, so readers never see a partially written index
+	std::filesystem::path const temporary = index_path.string() + ".tmp";
+	if (!write_index(temporary, pending)) return false;
+	std::filesystem::rename(temporary, index_path, ec);
+	if (ec) return false;
+	if (stats) *stats = counts;
+	return true;
+}
+
+bool AssetIndex::open(std::filesystem::path const& path) {
+	close();
+	if (!mapping.open(path)) return false;
+
+	std::span<const char> const data = mapping.data();
+	if (data.size() < sizeof(AssetIndexHeader)) {
+		close();
+		return false;
+	}
+	std::memcpy(&header, data.data(), sizeof(AssetIndexHeader));
+	bool valid = std::memcmp(header.magic, "AIDX", 4) == 0
+		&& major_version(header.version) == major_version(asset_index_version)
+		&& std::has_single_bit(header.bucket_count)
+		&& header.bucket_count >= header.entry_count;
+	uint64_t const entries_end = sizeof(AssetIndexHeader) + uint64_t(header.entry_count) * sizeof(AssetIndexEntry);
+	uint64_t const buckets_end = entries_end + uint64_t(header.bucket_count) * sizeof(uint32_t);
+	valid = valid && header.paths_offset == buckets_end && header.metadata_offset == header.paths_offset + header.paths_size
+		&& header.metadata_offset + header.metadata_size <= data.size();
+	if (!valid) {
+		close();
+		return false;
+	}
+
+	// The mapping is page aligned and both the header and the entries are multiples of 8 bytes large,
+	// so the entries and the buckets can be used in place.
+	entries = reinterpret_cast<AssetIndexEntry const*>(data.data() + sizeof(AssetIndexHeader));
+	buckets = reinterpret_cast<uint32_t const*>(data.data() + entries_end);
+	paths = data.data() + header.paths_offset;
+	metadata = data.data() + header.metadata_offset;
+	return true;
+}
+
+void AssetIndex::close() {
+	mapping.close();
+	header = {};
+	entries = nullptr;
+	buckets = nullptr;
+	paths = nullptr;
+	metadata = nullptr;
+}
+
+AssetIndexEntry const* AssetIndex::find(std::string_view path) const {
+	if (header.entry_count == 0) return nullptr;
+	uint64_t const id = archive_id(path);
+	uint32_t const mask = header.bucket_count - 1;
+	uint32_t bucket = id & mask;
+	// The table is at most half full, so this always hits an empty bucket eventually.
+	for (uint32_t probes = 0; probes < header.bucket_count; ++probes) {
+		uint32_t const index = buckets[bucket];
+		if (index == 0 || index > header.entry_count) return nullptr;
+		AssetIndexEntry const& entry = entries[index - 1];
+		if (entry.id == id && this->path(entry) == path) return &entry;
+		bucket = (bucket + 1) & mask;
+	}
+	return nullptr;
+}
+
+AssetIndexEntry const& AssetIndex::entry(uint32_t index) const {
+	assert(index < header.entry_count && "Asset index entry out of range");
+	return entries[index];
+}
+
+std::string_view AssetIndex::path(AssetIndexEntry const& entry) const {
+	if (uint64_t(entry.path_offset) + entry.path_length > header.paths_size) return {};
+	return std::string_view(paths + entry.path_offset, entry.path_length);
+}
+
+AssetFileView AssetIndex::view(AssetIndexEntry const& entry) const {
+	AssetFileView view;
+	if (uint64_t(entry.metadata_offset) + entry.metadata_size > header.metadata_size) {
+		assert(false && "Corrupted asset index entry");
+		return view;
+	}
+	std::memcpy(view.type, entry.type, sizeof(view.type));
+	view.version = entry.version;
+	view.metadata_json = std::string_view(metadata + entry.metadata_offset, entry.metadata_size);
+	return view;
+}
+
+}
@@ -0,0 +1,212 @@
+#include <assetlib/async_loader.hpp>
+
+#include "instrumentation_scope.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace assetlib {
+
+struct AsyncLoader::Job {
+	LoadRequest request;
+	uint64_t sequence = 0;
+	std::promise<LoadStatus> promise;
+	std::shared_ptr<std::atomic<bool>> cancelled;
+	MappedFile mapping;
+	AssetFileView view;
+	// Set once an I/O thread took the job off the queue
+	bool in_flight = false;
+
+	// Heap comparator. std::push_heap builds a max-heap, so the job that should run first must compare greatest.
+	static bool order(std::shared_ptr<Job> const& lhs, std::shared_ptr<Job> const& rhs) {
+		if (lhs->request.priority != rhs->request.priority) return lhs->request.priority < rhs->request.priority;
+		return lhs->sequence > rhs->sequence;
+	}
+};
+
+// Reads one byte of every page so the page faults happen on the I/O thread instead of during decompression.
+static void fault_in(std::span<const char> data) {
+	constexpr size_t page_size = 4096;
+	char volatile sink = 0;
+	for (size_t offset = 0; offset < data.size(); offset += page_size) {
+		sink = data[offset];
+	}
+	(void)sink;
+}
+
+static bool type_is(AssetFileView const& file, char const* type) {
+	return std::memcmp(file.type, type, 4) == 0;
+}
+
+void LoadHandle::cancel() {
+	if (cancelled) *cancelled = true;
+}
+
+LoadStatus LoadHandle::wait() const {
+	return future.get();
+}
+
+AsyncLoader::AsyncLoader(uint32_t io_thread_count, uint32_t worker_threads) : workers(worker_threads) {
+	// Keep enough files ready that workers never wait on I/O, without mapping the whole batch up front.
+	max_in_flight = 2 * workers.thread_count();
+	io_thread_count = std::max(io_thread_count, 1u);
+	for (uint32_t i = 0; i < io_thread_count; ++i) {
+		io_threads.emplace_back([this] { io_main(); });
+	}
+}
+
+AsyncLoader::~AsyncLoader() {
+	std::vector<std::shared_ptr<Job>> dropped;
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+		dropped = std::move(queue);
+		queue.clear();
+	}
+	queue_changed.notify_all();
+	for (std::shared_ptr<Job> const& job : dropped) {
+		finish(*job, LoadStatus::Cancelled);
+	}
+	for (std::thread& thread : io_threads) {
+		thread.join();
+	}
+	wait_idle();
+}
+
+LoadHandle AsyncLoader::submit(LoadRequest request) {
+	std::vector<LoadRequest> batch;
+	batch.push_back(std::move(request));
+	return submit(std::move(batch)).front();
+}
+
+std::vector<LoadHandle> AsyncLoader::submit(std::vector<LoadRequest> requests) {
+	std::vector<LoadHandle> handles;
+	handles.reserve(requests.size());
+	{
+		std::lock_guard lock(mutex);
+		for (LoadRequest& request : requests) {
+			auto job = std::make_shared<Job>();
+			job->request = std::move(request);
+			job->sequence = next_sequence++;
+			job->cancelled = std::make_shared<std::atomic<bool>>(false);
+
+			LoadHandle handle;
+			handle.future = job->promise.get_future().share();
+			handle.cancelled = job->cancelled;
+			handles.push_back(std::move(handle));
+
+			queue.push_back(std::move(job));
+			std::push_heap(queue.begin(), queue.end(), Job::order);
+			++pending;
+		}
+	}
+	queue_changed.notify_all();
+	return handles;
+}
+
+void AsyncLoader::wait_idle() {
+	std::unique_lock lock(mutex);
+	idle.wait(lock, [this] { return pending == 0; });
+}
+
+void AsyncLoader::io_main() {
+	while (true) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock lock(mutex);
+			queue_changed.wait(lock, [this] { return stopping || (!queue.empty() && in_flight < max_in_flight); });
+			if (stopping) return;
+			std::pop_heap(queue.begin(), queue.end(), Job::order);
+			job = std::move(queue.back());
+			queue.pop_back();
+			job->in_flight = true;
+			++in_flight;
+		}
+
+		if (*job->cancelled) {
+			finish(*job, LoadStatus::Cancelled);
+			continue;
+		}
+		{
+			StageLabelScope label(job->request.path);
+			StageScope stage(LoadStage::FileRead);
+			if (!map_binary_file(job->request.path, job->mapping, job->view)) {
+				finish(*job, LoadStatus::Failed);
+				continue;
+			}
+			// Mapping is lazy, the file is only read while faulting it in
+			fault_in(job->mapping.data());
+			stage.set_type(job->view.type);
+			stage.set_bytes(job->mapping.data().size(), 0);
+		}
+		workers.submit([this, job] { process(job); });
+	}
+}
+
+void AsyncLoader::process(std::shared_ptr<Job> job) {
+	AssetFileView const& file = job->view;
+	LoadRequest const& request = job->request;
+	if (*job->cancelled) {
+		finish(*job, LoadStatus::Cancelled);
+		return;
+	}
+
+	StageLabelScope label(request.path);
+	Executor const executor = workers.executor();
+	if (type_is(file, "ITEX") && request.texture_destination && file.version <= itex_version) {
+		TextureInfo const info = read_texture_info(file);
+		std::optional<TextureLayout> layout;
+		if (request.texture_layout) layout = request.texture_layout(info);
+		void* dst = request.texture_destination(info);
+		if (!dst || *job->cancelled) {
+			finish(*job, LoadStatus::Cancelled);
+			return;
+		}
+		if (layout) {
+			unpack_texture(info, file, *layout, dst, executor);
+		} else {
+			unpack_texture(info, file, dst, executor);
+		}
+	} else if (type_is(file, "MESH") && request.mesh_destination && file.version <= mesh_version) {
+		MeshInfo const info = read_mesh_info(file);
+		MeshDestination const dst = request.mesh_destination(info);
+		if (!dst.vertices || !dst.indices || *job->cancelled) {
+			finish(*job, LoadStatus::Cancelled);
+			return;
+		}
+		unpack_mesh(info, file, dst.vertices, dst.indices, executor);
+	} else if (type_is(file, "IENV") && request.environment_destination && file.version <= ienv_version) {
+		EnvironmentInfo const info = read_environment_info(file);
+		EnvironmentDestination const dst = request.environment_destination(info);
+		if (!dst.hdr || (!dst.irradiance && info.irradiance_bytes != 0) || !dst.specular || *job->cancelled) {
+			finish(*job, LoadStatus::Cancelled);
+			return;
+		}
+		if (dst.layout) {
+			unpack_environment(info, file, *dst.layout, dst.hdr, dst.irradiance, dst.specular, executor);
+		} else {
+			unpack_environment(info, file, dst.hdr, dst.irradiance, dst.specular, executor);
+		}
+	} else {
+		finish(*job, LoadStatus::Failed);
+		return;
+	}
+	finish(*job, LoadStatus::Completed);
+}
+
+void AsyncLoader::finish(Job& job, LoadStatus status) {
+	job.mapping.close();
+	if (job.request.on_complete) job.request.on_complete(status);
+	job.promise.set_value(status);
+
+	bool now_idle;
+	{
+		std::lock_guard lock(mutex);
+		if (job.in_flight) --in_flight;
+		now_idle = --pending == 0;
+	}
+	queue_changed.notify_all();
+	if (now_idle) idle.notify_all();
+}
+
+}
@@ -0,0 +1,747 @@
+#include <assetlib/block_compression.hpp>
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace assetlib {
+
+// Block layouts follow the D3D11 functional specification.
+// BC1:	u16 color0, u16 color1 (RGB565), 2-bit index per texel. color0 > color1 selects the 4 color mode,
+//		otherwise the 3rd color is the average and the 4th transparent black. The encoder only writes the 4 color mode.
+// BC3:	a BC4 block for alpha followed by a BC1 block for color, which always uses the 4 color mode.
+// BC4:	u8 red0, u8 red1, 3-bit index per texel. red0 > red1 interpolates 8 values,
+//		otherwise 6 values followed by 0 and 255.
+// BC5:	two BC4 blocks, red then green.
+// BC7:	see encode_bc7_block().
+// Indices are stored with texel 0 in the lowest bits, texels in row major order.
+
+// Texels of a block in [0, 255], one array per channel so the SIMD kernels can work on 4 texels at once.
+struct BlockTexels {
+	alignas(16) float channels[4][16];
+};
+
+struct BlockEndpoints {
+	float e0[4]{};
+	float e1[4]{};
+};
+
+// BC7 mode 6 interpolation weights, in 64ths
+constexpr uint32_t bc7_weights[16]{ 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static void load_block(TextureFormat src_format, uint8_t const* src, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y,
+	BlockTexels& block) {
+	uint32_t const texel_size = texture_format_byte_size(src_format);
+	for (uint32_t i = 0; i < 16; ++i) {
+		uint32_t const x = std::min(block_x * 4 + i % 4, width - 1);
+		uint32_t const y = std::min(block_y * 4 + i / 4, height - 1);
+		uint8_t const* texel = src + (uint64_t(y) * width + x) * texel_size;
+		for (uint32_t c = 0; c < 4; ++c) {
+			block.channels[c][i] = c < texel_size ? float(texel[c]) : (c == 3 ? 255.0f : 0.0f);
+		}
+	}
+}
+
+// Finds the nearest palette entry of every texel over the first channel_count channels. Returns the total squared error.
+// The scalar path gives the same result as the SIMD path.
+static float nearest_indices(BlockTexels const& block, uint32_t channel_count, float const (*palette)[4], uint32_t palette_size, uint8_t* indices) {
+	float total = 0.0f;
+#ifdef ASSETLIB_SSE2
+	for (uint32_t group = 0; group < 16; group += 4) {
+		__m128 best_error = _mm_set1_ps(std::numeric_limits<float>::max());
+		__m128i best_index = _mm_setzero_si128();
+		for (uint32_t p = 0; p < palette_size; ++p) {
+			__m128 error = _mm_setzero_ps();
+			for (uint32_t c = 0; c < channel_count; ++c) {
+				__m128 const d = _mm_sub_ps(_mm_load_ps(&block.channels[c][group]), _mm_set1_ps(palette[p][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(d, d));
+			}
+			__m128i const better = _mm_castps_si128(_mm_cmplt_ps(error, best_error));
+			best_error = _mm_min_ps(error, best_error);
+			best_index = _mm_or_si128(_mm_andnot_si128(better, best_index), _mm_and_si128(better, _mm_set1_epi32(int32_t(p))));
+		}
+		alignas(16) float errors[4];
+		alignas(16) int32_t best[4];
+		_mm_store_ps(errors, best_error);
+		_mm_store_si128(reinterpret_cast<__m128i*>(best), best_index);
+		for (uint32_t i = 0; i < 4; ++i) {
+			indices[group + i] = static_cast<uint8_t>(best[i]);
+			total += errors[i];
+		}
+	}
+#else
+	for (uint32_t i = 0; i < 16; ++i) {
+		float best_error = std::numeric_limits<float>::max();
+		uint32_t best = 0;
+		for (uint32_t p = 0; p < palette_size; ++p) {
+			float error = 0.0f;
+			for (uint32_t c = 0; c < channel_count; ++c) {
+				float const d = block.channels[c][i] - palette[p][c];
+				error += d * d;
+			}
+			if (error < best_error) {
+				best_error = error;
+				best = p;
+			}
+		}
+		indices[i] = static_cast<uint8_t>(best);
+		total += best_error;
+	}
+#endif
+	return total;
+}
+
+// Projects every texel onto the line from e0 to e1, and rounds to the nearest of steps + 1 evenly spaced points on it.
+// steps_out receives 0 for e0 up to steps for e1. The scalar path gives the same result as the SIMD path.
+static void project_indices(BlockTexels const& block, uint32_t channel_count, BlockEndpoints const& endpoints, uint32_t steps, uint8_t* steps_out) {
+	float axis[4]{};
+	float length_squared = 0.0f;
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		axis[c] = endpoints.e1[c] - endpoints.e0[c];
+		length_squared += axis[c] * axis[c];
+	}
+	if (length_squared == 0.0f) {
+		std::memset(steps_out, 0, 16);
+		return;
+	}
+	float const scale = float(steps) / length_squared;
+	for (uint32_t c = 0; c < channel_count; ++c) axis[c] *= scale;
+
+#ifdef ASSETLIB_SSE2
+	for (uint32_t group = 0; group < 16; group += 4) {
+		__m128 t = _mm_setzero_ps();
+		for (uint32_t c = 0; c < channel_count; ++c) {
+			__m128 const d = _mm_sub_ps(_mm_load_ps(&block.channels[c][group]), _mm_set1_ps(endpoints.e0[c]));
+			t = _mm_add_ps(t, _mm_mul_ps(d, _mm_set1_ps(axis[c])));
+		}
+		t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(float(steps)));
+		alignas(16) int32_t rounded[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(rounded), _mm_cvtps_epi32(t));
+		for (uint32_t i = 0; i < 4; ++i) steps_out[group + i] = static_cast<uint8_t>(rounded[i]);
+	}
+#else
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t = 0.0f;
+		for (uint32_t c = 0; c < channel_count; ++c) {
+			t += (block.channels[c][i] - endpoints.e0[c]) * axis[c];
+		}
+		t = std::min(std::max(t, 0.0f), float(steps));
+		steps_out[i] = static_cast<uint8_t>(std::lrint(t));
+	}
+#endif
+}
+
+static float palette_error(BlockTexels const& block, uint32_t channel_count, float const (*palette)[4], uint8_t const* indices) {
+	float total = 0.0f;
+	for (uint32_t i = 0; i < 16; ++i) {
+		for (uint32_t c = 0; c < channel_count; ++c) {
+			float const d = block.channels[c][i] - palette[indices[i]][c];
+			total += d * d;
+		}
+	}
+	return total;
+}
+
+// Corners of the bounding box, inset a little since the extremes rarely need to be hit exactly.
+// The diagonal follows the sign of the covariance with the channel of the largest range.
+static BlockEndpoints bounding_box_endpoints(BlockTexels const& block, uint32_t channel_count) {
+	BlockEndpoints result;
+	float mean[4]{};
+	float range[4]{};
+	uint32_t widest = 0;
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		float const* values = block.channels[c];
+		float const min = *std::min_element(values, values + 16);
+		float const max = *std::max_element(values, values + 16);
+		float const inset = (max - min) / 16.0f;
+		result.e0[c] = min + inset;
+		result.e1[c] = max - inset;
+		for (uint32_t i = 0; i < 16; ++i) mean[c] += values[i];
+		mean[c] /= 16.0f;
+		range[c] = max - min;
+		if (range[c] > range[widest]) widest = c;
+	}
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		float covariance = 0.0f;
+		for (uint32_t i = 0; i < 16; ++i) {
+			covariance += (block.channels[c][i] - mean[c]) * (block.channels[widest][i] - mean[widest]);
+		}
+		if (covariance < 0.0f) std::swap(result.e0[c], result.e1[c]);
+	}
+	return result;
+}
+
+// Extent of the texels along the principal axis of their covariance, found by power iteration.
+static BlockEndpoints principal_endpoints(BlockTexels const& block, uint32_t channel_count) {
+	float mean[4]{};
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		for (uint32_t i = 0; i < 16; ++i) mean[c] += block.channels[c][i];
+		mean[c] /= 16.0f;
+	}
+	float covariance[4][4]{};
+	for (uint32_t i = 0; i < 16; ++i) {
+		for (uint32_t a = 0; a < channel_count; ++a) {
+			for (uint32_t b = 0; b < channel_count; ++b) {
+				covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+			}
+		}
+	}
+
+	BlockEndpoints result;
+	std::copy_n(mean, 4, result.e0);
+	std::copy_n(mean, 4, result.e1);
+	uint32_t widest = 0;
+	for (uint32_t c = 1; c < channel_count; ++c) {
+		if (covariance[c][c] > covariance[widest][widest]) widest = c;
+	}
+	if (covariance[widest][widest] == 0.0f) return result;
+
+	float axis[4]{};
+	axis[widest] = 1.0f;
+	for (int iteration = 0; iteration < 8; ++iteration) {
+		float next[4]{};
+		float largest = 0.0f;
+		for (uint32_t a = 0; a < channel_count; ++a) {
+			for (uint32_t b = 0; b < channel_count; ++b) next[a] += covariance[a][b] * axis[b];
+			largest = std::max(largest, std::abs(next[a]));
+		}
+		if (largest == 0.0f) break;
+		for (uint32_t c = 0; c < channel_count; ++c) axis[c] = next[c] / largest;
+	}
+	float length = 0.0f;
+	for (uint32_t c = 0; c < channel_count; ++c) length += axis[c] * axis[c];
+	length = std::sqrt(length);
+	for (uint32_t c = 0; c < channel_count; ++c) axis[c] /= length;
+
+	float min_t = 0.0f;
+	float max_t = 0.0f;
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t = 0.0f;
+		for (uint32_t c = 0; c < channel_count; ++c) t += (block.channels[c][i] - mean[c]) * axis[c];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		result.e0[c] = std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+		result.e1[c] = std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+	}
+	return result;
+}
+
+// Least squares fit of the endpoints, given how much of e1 goes into the palette entry of every texel.
+// Returns false if the weights don't determine both endpoints.
+static bool refine_endpoints(BlockTexels const& block, uint32_t channel_count, float const* weights, BlockEndpoints& endpoints) {
+	float aa = 0.0f;
+	float ab = 0.0f;
+	float bb = 0.0f;
+	float ax[4]{};
+	float bx[4]{};
+	for (uint32_t i = 0; i < 16; ++i) {
+		float const a = 1.0f - weights[i];
+		float const b = weights[i];
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (uint32_t c = 0; c < channel_count; ++c) {
+			ax[c] += a * block.channels[c][i];
+			bx[c] += b * block.channels[c][i];
+		}
+	}
+	float const determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f) return false;
+	for (uint32_t c = 0; c < channel_count; ++c) {
+		endpoints.e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+		endpoints.e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+static uint32_t refinement_passes(BlockCompressionQuality quality) {
+	switch (quality) {
+	case BlockCompressionQuality::Fast:
+		return 0;
+	case BlockCompressionQuality::Normal:
+		return 1;
+	default:
+		return 3;
+	}
+}
+
+static BlockEndpoints initial_endpoints(BlockTexels const& block, uint32_t channel_count, BlockCompressionQuality quality) {
+	if (quality == BlockCompressionQuality::Fast) return bounding_box_endpoints(block, channel_count);
+	return principal_endpoints(block, channel_count);
+}
+
+static void write_u16(uint8_t* out, uint32_t value) {
+	out[0] = static_cast<uint8_t>(value);
+	out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static uint32_t read_u16(uint8_t const* in) {
+	return uint32_t(in[0]) | (uint32_t(in[1]) << 8);
+}
+
+static uint16_t to_565(float const* color) {
+	uint32_t const r = static_cast<uint32_t>(std::lrint(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f));
+	uint32_t const g = static_cast<uint32_t>(std::lrint(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f));
+	uint32_t const b = static_cast<uint32_t>(std::lrint(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f));
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void bc1_palette(uint32_t c0, uint32_t c1, bool four_color_only, uint8_t (*palette)[4]) {
+	for (uint32_t e = 0; e < 2; ++e) {
+		uint32_t const color = e == 0 ? c0 : c1;
+		uint32_t const r = (color >> 11) & 31;
+		uint32_t const g = (color >> 5) & 63;
+		uint32_t const b = color & 31;
+		palette[e][0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+		palette[e][1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+		palette[e][2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+		palette[e][3] = 255;
+	}
+	for (uint32_t c = 0; c < 3; ++c) {
+		if (c0 > c1 || four_color_only) {
+			palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+		} else {
+			palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	palette[2][3] = 255;
+	palette[3][3] = c0 > c1 || four_color_only ? 255 : 0;
+}
+
+static void encode_bc1_block(BlockTexels const& block, BlockCompressionQuality quality, uint8_t* out) {
+	// Projection step to index, and index to weight of color1
+	constexpr uint8_t step_index[4]{ 0, 2, 3, 1 };
+	constexpr float index_weight[4]{ 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	BlockEndpoints endpoints = initial_endpoints(block, 3, quality);
+	uint32_t const passes = refinement_passes(quality);
+	uint32_t best_c0 = 0;
+	uint32_t best_c1 = 0;
+	uint8_t best_indices[16]{};
+	float best_error = std::numeric_limits<float>::max();
+	for (uint32_t pass = 0;; ++pass) {
+		uint32_t c0 = to_565(endpoints.e0);
+		uint32_t c1 = to_565(endpoints.e1);
+		uint8_t palette8[4][4];
+		float palette[4][4];
+		uint8_t indices[16];
+		// Equal colors can only be stored in the 3 color mode, where index 0 is still color0
+		uint32_t const palette_size = c0 == c1 ? 1 : 4;
+		if (c0 < c1) {
+			std::swap(c0, c1);
+			std::swap(endpoints.e0, endpoints.e1);
+		}
+		bc1_palette(c0, c1, true, palette8);
+		for (uint32_t p = 0; p < 4; ++p) {
+			for (uint32_t c = 0; c < 4; ++c) palette[p][c] = palette8[p][c];
+		}
+
+		float error = 0.0f;
+		if (quality == BlockCompressionQuality::High || palette_size == 1) {
+			error = nearest_indices(block, 3, palette, palette_size, indices);
+		} else {
+			BlockEndpoints line;
+			std::copy_n(palette[0], 4, line.e0);
+			std::copy_n(palette[1], 4, line.e1);
+			project_indices(block, 3, line, 3, indices);
+			for (uint8_t& index : indices) index = step_index[index];
+			error = palette_error(block, 3, palette, indices);
+		}
+		if (error < best_error) {
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			std::copy_n(indices, 16, best_indices);
+		}
+
+		if (pass == passes || error == 0.0f || palette_size == 1) break;
+		float weights[16];
+		for (uint32_t i = 0; i < 16; ++i) weights[i] = index_weight[indices[i]];
+		if (!refine_endpoints(block, 3, weights, endpoints)) break;
+	}
+
+	write_u16(out, best_c0);
+	write_u16(out + 2, best_c1);
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < 16; ++i) bits |= uint32_t(best_indices[i]) << (2 * i);
+	for (uint32_t b = 0; b < 4; ++b) out[4 + b] = static_cast<uint8_t>(bits >> (8 * b));
+}
+
+static void bc4_palette(uint32_t r0, uint32_t r1, uint8_t* palette) {
+	palette[0] = static_cast<uint8_t>(r0);
+	palette[1] = static_cast<uint8_t>(r1);
+	if (r0 > r1) {
+		for (uint32_t i = 2; i < 8; ++i) palette[i] = static_cast<uint8_t>(((8 - i) * r0 + (i - 1) * r1) / 7);
+	} else {
+		for (uint32_t i = 2; i < 6; ++i) palette[i] = static_cast<uint8_t>(((6 - i) * r0 + (i - 1) * r1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// Indices of a single channel block for the given endpoints. Returns the total squared error.
+static float bc4_indices(BlockTexels const& block, uint32_t r0, uint32_t r1, bool nearest, uint8_t* indices) {
+	uint8_t palette8[8];
+	float palette[8][4]{};
+	bc4_palette(r0, r1, palette8);
+	for (uint32_t p = 0; p < 8; ++p) palette[p][0] = palette8[p];
+	if (nearest || r0 <= r1) return nearest_indices(block, 1, palette, 8, indices);
+
+	BlockEndpoints line;
+	line.e0[0] = float(r0);
+	line.e1[0] = float(r1);
+	project_indices(block, 1, line, 7, indices);
+	for (uint32_t i = 0; i < 16; ++i) {
+		indices[i] = indices[i] == 0 ? 0 : (indices[i] == 7 ? 1 : indices[i] + 1);
+	}
+	return palette_error(block, 1, palette, indices);
+}
+
+static void encode_bc4_block(BlockTexels const& texels, uint32_t channel, BlockCompressionQuality quality, uint8_t* out) {
+	BlockTexels block;
+	std::copy_n(texels.channels[channel], 16, block.channels[0]);
+	float const* values = block.channels[0];
+	uint32_t const min = static_cast<uint32_t>(*std::min_element(values, values + 16));
+	uint32_t const max = static_cast<uint32_t>(*std::max_element(values, values + 16));
+	bool const nearest = quality == BlockCompressionQuality::High;
+
+	uint32_t best_r0 = max;
+	uint32_t best_r1 = min;
+	uint8_t best_indices[16]{};
+	float best_error = 0.0f;
+	if (min != max) {
+		best_error = bc4_indices(block, best_r0, best_r1, nearest, best_indices);
+
+		// Refine the 8 value mode, index to weight of red1
+		constexpr float index_weight[8]{ 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+		uint8_t indices[16];
+		std::copy_n(best_indices, 16, indices);
+		uint32_t const passes = refinement_passes(quality);
+		for (uint32_t pass = 0; pass < passes && best_error > 0.0f; ++pass) {
+			float weights[16];
+			for (uint32_t i = 0; i < 16; ++i) weights[i] = index_weight[indices[i]];
+			BlockEndpoints endpoints;
+			if (!refine_endpoints(block, 1, weights, endpoints)) break;
+			uint32_t r0 = static_cast<uint32_t>(std::lrint(endpoints.e0[0]));
+			uint32_t r1 = static_cast<uint32_t>(std::lrint(endpoints.e1[0]));
+			if (r0 == r1) break;
+			if (r0 < r1) std::swap(r0, r1);
+			float const error = bc4_indices(block, r0, r1, nearest, indices);
+			if (error >= best_error) break;
+			best_error = error;
+			best_r0 = r0;
+			best_r1 = r1;
+			std::copy_n(indices, 16, best_indices);
+		}
+
+		if (nearest) {
+			// The 6 value mode has exact 0 and 255, so the endpoints only need to cover the other values
+			uint32_t inner_min = 255;
+			uint32_t inner_max = 0;
+			for (uint32_t i = 0; i < 16; ++i) {
+				uint32_t const value = static_cast<uint32_t>(values[i]);
+				if (value == 0 || value == 255) continue;
+				inner_min = std::min(inner_min, value);
+				inner_max = std::max(inner_max, value);
+			}
+			if (inner_min > inner_max) inner_min = inner_max = 0;
+			float const error = bc4_indices(block, inner_min, inner_max, true, indices);
+			if (error < best_error) {
+				best_r0 = inner_min;
+				best_r1 = inner_max;
+				std::copy_n(indices, 16, best_indices);
+			}
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(best_r0);
+	out[1] = static_cast<uint8_t>(best_r1);
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < 16; ++i) bits |= uint64_t(best_indices[i]) << (3 * i);
+	for (uint32_t b = 0; b < 6; ++b) out[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+}
+
+// 128 bits, written and read starting at the lowest bit of byte 0.
+struct BlockBits {
+	uint64_t words[2]{};
+	uint32_t position = 0;
+
+	void write(uint32_t value, uint32_t count) {
+		for (uint32_t i = 0; i < count; ++i, ++position) {
+			words[position / 64] |= uint64_t((value >> i) & 1) << (position % 64);
+		}
+	}
+
+	uint32_t read(uint32_t count) {
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < count; ++i, ++position) {
+			value |= uint32_t((words[position / 64] >> (position % 64)) & 1) << i;
+		}
+		return value;
+	}
+
+	void store(uint8_t* out) const {
+		for (uint32_t b = 0; b < 16; ++b) out[b] = static_cast<uint8_t>(words[b / 8] >> (8 * (b % 8)));
+	}
+
+	void load(uint8_t const* in) {
+		for (uint32_t b = 0; b < 16; ++b) words[b / 8] |= uint64_t(in[b]) << (8 * (b % 8));
+	}
+};
+
+// Quantizes an endpoint to 7 bits per channel and a p-bit, which is the lowest bit of all four 8-bit channels.
+static uint32_t quantize_bc7_endpoint(float const* color, uint8_t* quantized) {
+	float best_error = std::numeric_limits<float>::max();
+	uint32_t best_p = 0;
+	for (uint32_t p = 0; p < 2; ++p) {
+		uint8_t candidate[4];
+		float error = 0.0f;
+		for (uint32_t c = 0; c < 4; ++c) {
+			long const q = std::clamp(std::lrint((color[c] - float(p)) / 2.0f), 0l, 127l);
+			candidate[c] = static_cast<uint8_t>(q);
+			float const d = float(q * 2 + p) - color[c];
+			error += d * d;
+		}
+		if (error < best_error) {
+			best_error = error;
+			best_p = p;
+			std::copy_n(candidate, 4, quantized);
+		}
+	}
+	return best_p;
+}
+
+static uint32_t bc7_interpolate(uint32_t e0, uint32_t e1, uint32_t weight) {
+	return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+// Mode 6: 7 bits mode (0b1000000), 7 bits per endpoint channel in the order R0 R1 G0 G1 B0 B1 A0 A1, the p-bits of both
+// endpoints, then a 4-bit index per texel. The highest bit of the index of texel 0 is left out and must be 0.
+static void encode_bc7_block(BlockTexels const& block, BlockCompressionQuality quality, uint8_t* out) {
+	BlockEndpoints endpoints = initial_endpoints(block, 4, quality);
+	uint32_t const passes = refinement_passes(quality);
+	uint8_t best_q[2][4]{};
+	uint32_t best_p[2]{};
+	uint8_t best_indices[16]{};
+	float best_error = std::numeric_limits<float>::max();
+	for (uint32_t pass = 0;; ++pass) {
+		uint8_t q[2][4];
+		uint32_t const p[2]{ quantize_bc7_endpoint(endpoints.e0, q[0]), quantize_bc7_endpoint(endpoints.e1, q[1]) };
+		BlockEndpoints line;
+		for (uint32_t c = 0; c < 4; ++c) {
+			line.e0[c] = float(q[0][c] * 2 + p[0]);
+			line.e1[c] = float(q[1][c] * 2 + p[1]);
+		}
+		float palette[16][4];
+		for (uint32_t i = 0; i < 16; ++i) {
+			for (uint32_t c = 0; c < 4; ++c) {
+				palette[i][c] = float(bc7_interpolate(uint32_t(line.e0[c]), uint32_t(line.e1[c]), bc7_weights[i]));
+			}
+		}
+
+		uint8_t indices[16];
+		float error = 0.0f;
+		if (quality == BlockCompressionQuality::High) {
+			error = nearest_indices(block, 4, palette, 16, indices);
+		} else {
+			// The weights are close enough to evenly spaced that the step is the index
+			project_indices(block, 4, line, 15, indices);
+			error = palette_error(block, 4, palette, indices);
+		}
+		if (error < best_error) {
+			best_error = error;
+			std::copy_n(&q[0][0], 8, &best_q[0][0]);
+			best_p[0] = p[0];
+			best_p[1] = p[1];
+			std::copy_n(indices, 16, best_indices);
+		}
+
+		if (pass == passes || error == 0.0f) break;
+		float weights[16];
+		for (uint32_t i = 0; i < 16; ++i) weights[i] = float(bc7_weights[indices[i]]) / 64.0f;
+		if (!refine_endpoints(block, 4, weights, endpoints)) break;
+	}
+
+	// The weights are symmetric, so swapping the endpoints and inverting the indices decodes the same
+	if (best_indices[0] >= 8) {
+		std::swap(best_q[0], best_q[1]);
+		std::swap(best_p[0], best_p[1]);
+		for (uint8_t& index : best_indices) index = static_cast<uint8_t>(15 - index);
+	}
+
+	BlockBits bits;
+	bits.write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; ++c) {
+		bits.write(best_q[0][c], 7);
+		bits.write(best_q[1][c], 7);
+	}
+	bits.write(best_p[0], 1);
+	bits.write(best_p[1], 1);
+	for (uint32_t i = 0; i < 16; ++i) bits.write(best_indices[i], i == 0 ? 3 : 4);
+	bits.store(out);
+}
+
+static void encode_block(TextureFormat format, BlockCompressionQuality quality, BlockTexels const& block, uint8_t* out) {
+	switch (format) {
+	case TextureFormat::BC1:
+		encode_bc1_block(block, quality, out);
+		break;
+	case TextureFormat::BC3:
+		encode_bc4_block(block, 3, quality, out);
+		encode_bc1_block(block, quality, out + 8);
+		break;
+	case TextureFormat::BC4:
+		encode_bc4_block(block, 0, quality, out);
+		break;
+	case TextureFormat::BC5:
+		encode_bc4_block(block, 0, quality, out);
+		encode_bc4_block(block, 1, quality, out + 8);
+		break;
+	case TextureFormat::BC7:
+		encode_bc7_block(block, quality, out);
+		break;
+	default:
+		assert(false && "Not a block compressed format");
+	}
+}
+
+void encode_blocks(TextureFormat format, BlockCompressionQuality quality, TextureFormat src_format, void const* src,
+	uint32_t width, uint32_t height, void* dst, Executor const& executor) {
+	assert(is_block_compressed(format) && "Not a block compressed format");
+	assert(!is_block_compressed(src_format) && texture_format_byte_size(src_format) != 0 && "Source must be uncompressed");
+
+	uint32_t const blocks_x = (width + 3) / 4;
+	uint32_t const blocks_y = (height + 3) / 4;
+	uint32_t const block_size = texture_format_byte_size(format);
+	uint8_t const* src_bytes = reinterpret_cast<uint8_t const*>(src);
+	uint8_t* dst_bytes = reinterpret_cast<uint8_t*>(dst);
+	run_jobs(executor, blocks_y, [&](uint32_t block_y) {
+		BlockTexels block;
+		uint8_t* row = dst_bytes + uint64_t(block_y) * blocks_x * block_size;
+		for (uint32_t block_x = 0; block_x < blocks_x; ++block_x) {
+			load_block(src_format, src_bytes, width, height, block_x, block_y, block);
+			encode_block(format, quality, block, row + uint64_t(block_x) * block_size);
+		}
+	});
+}
+
+static void decode_bc1_block(uint8_t const* in, bool four_color_only, uint8_t (*texels)[4]) {
+	uint8_t palette[4][4];
+	bc1_palette(read_u16(in), read_u16(in + 2), four_color_only, palette);
+	uint32_t const bits = read_u16(in + 4) | (read_u16(in + 6) << 16);
+	for (uint32_t i = 0; i < 16; ++i) {
+		std::copy_n(palette[(bits >> (2 * i)) & 3], 4, texels[i]);
+	}
+}
+
+static void decode_bc4_block(uint8_t const* in, uint8_t (*texels)[4], uint32_t channel) {
+	uint8_t palette[8];
+	bc4_palette(in[0], in[1], palette);
+	uint64_t bits = 0;
+	for (uint32_t b = 0; b < 6; ++b) bits |= uint64_t(in[2 + b]) << (8 * b);
+	for (uint32_t i = 0; i < 16; ++i) {
+		texels[i][channel] = palette[(bits >> (3 * i)) & 7];
+	}
+}
+
+static void decode_bc7_block(uint8_t const* in, uint8_t (*texels)[4]) {
+	BlockBits bits;
+	bits.load(in);
+	if (bits.read(7) != 1 << 6) {
+		std::memset(texels, 0, 16 * 4);
+		return;
+	}
+	uint32_t endpoints[2][4];
+	for (uint32_t c = 0; c < 4; ++c) {
+		endpoints[0][c] = bits.read(7) << 1;
+		endpoints[1][c] = bits.read(7) << 1;
+	}
+	uint32_t const p0 = bits.read(1);
+	uint32_t const p1 = bits.read(1);
+	for (uint32_t c = 0; c < 4; ++c) {
+		endpoints[0][c] |= p0;
+		endpoints[1][c] |= p1;
+	}
+	for (uint32_t i = 0; i < 16; ++i) {
+		uint32_t const index = bits.read(i == 0 ? 3 : 4);
+		for (uint32_t c = 0; c < 4; ++c) {
+			texels[i][c] = static_cast<uint8_t>(bc7_interpolate(endpoints[0][c], endpoints[1][c], bc7_weights[index]));
+		}
+	}
+}
+
+void decode_blocks(TextureFormat format, void const* src, uint32_t width, uint32_t height, uint8_t* dst_rgba) {
+	assert(is_block_compressed(format) && "Not a block compressed format");
+
+	uint32_t const blocks_x = (width + 3) / 4;
+	uint32_t const blocks_y = (height + 3) / 4;
+	uint32_t const block_size = texture_format_byte_size(format);
+	uint8_t const* block = reinterpret_cast<uint8_t const*>(src);
+	for (uint32_t block_y = 0; block_y < blocks_y; ++block_y) {
+		for (uint32_t block_x = 0; block_x < blocks_x; ++block_x, block += block_size) {
+			uint8_t texels[16][4]{};
+			for (uint32_t i = 0; i < 16; ++i) texels[i][3] = 255;
+			switch (format) {
+			case TextureFormat::BC1:
+				decode_bc1_block(block, false, texels);
+				break;
+			case TextureFormat::BC3:
+				decode_bc1_block(block + 8, true, texels);
+				decode_bc4_block(block, texels, 3);
+				break;
+			case TextureFormat::BC4:
+				decode_bc4_block(block, texels, 0);
+				break;
+			case TextureFormat::BC5:
+				decode_bc4_block(block, texels, 0);
+				decode_bc4_block(block + 8, texels, 1);
+				break;
+			default:
+				decode_bc7_block(block, texels);
+				break;
+			}
+
+			for (uint32_t i = 0; i < 16; ++i) {
+				uint32_t const x = block_x * 4 + i % 4;
+				uint32_t const y = block_y * 4 + i / 4;
+				if (x >= width || y >= height) continue;
+				std::copy_n(texels[i], 4, dst_rgba + (uint64_t(y) * width + x) * 4);
+			}
+		}
+	}
+}
+
+std::vector<char> encode_texture(TextureInfo& info, void const* pixel_data, TextureFormat format, BlockCompressionQuality quality,
+	Executor const& executor) {
+	TextureInfo encoded = info;
+	encoded.format = format;
+	uint32_t const mips = std::max(info.mip_levels, 1u);
+	encoded.byte_size = texture_mip_byte_offset(encoded, mips);
+
+	std::vector<char> result(encoded.byte_size);
+	char const* src = reinterpret_cast<char const*>(pixel_data);
+	for (uint32_t mip = 0; mip < mips; ++mip) {
+		uint32_t const width = std::max(info.extents[0] >> mip, 1u);
+		uint32_t const height = std::max(info.extents[1] >> mip, 1u);
+		encode_blocks(format, quality, info.format, src + texture_mip_byte_offset(info, mip), width, height,
+			result.data() + texture_mip_byte_offset(encoded, mip), executor);
+	}
+	info = encoded;
+	return result;
+}
+
+AssetFile pack_texture(TextureInfo const& info, void* pixel_data, TextureFormat format, BlockCompressionQuality quality, Executor const& executor) {
+	TextureInfo encoded = info;
+	std::vector<char> blocks = encode_texture(encoded, pixel_data, format, quality, executor);
+	return pack_texture(encoded, blocks.data());
+}
+
+}
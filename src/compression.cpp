@@ -0,0 +1,384 @@
+#include <assetlib/compression.hpp>
+#include <assetlib/scratch_buffer.hpp>
+
+#include "instrumentation_scope.hpp"
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace assetlib {
+
+namespace {
+
+class LZ4Codec : public Codec {
+public:
+	size_t compress_bound(size_t size) const override {
+		return LZ4_compressBound(size);
+	}
+
+	size_t compress(char const* src, size_t size, char* dst, size_t dst_capacity, int, std::span<const char> dictionary) const override {
+		if (dictionary.empty()) {
+			return std::max(LZ4_compress_default(src, dst, size, dst_capacity), 0);
+		}
+		LZ4_stream_t stream;
+		LZ4_initStream(&stream, sizeof(stream));
+		LZ4_loadDict(&stream, dictionary.data(), dictionary.size());
+		return std::max(LZ4_compress_fast_continue(&stream, src, dst, size, dst_capacity, 1), 0);
+	}
+
+	bool decompress(char const* src, size_t size, char* dst, size_t dst_size, std::span<const char> dictionary) const override {
+		int const result = dictionary.empty()
+			? LZ4_decompress_safe(src, dst, size, dst_size)
+			: LZ4_decompress_safe_usingDict(src, dst, size, dst_size, dictionary.data(), dictionary.size());
+		return result == static_cast<int>(dst_size);
+	}
+
+	double decode_speed() const override {
+		return 4.0 * 1024 * 1024 * 1024;
+	}
+};
+
+// Produces regular LZ4 blocks, so it shares the decompressor with LZ4Codec.
+class LZ4HCCodec : public LZ4Codec {
+public:
+	size_t compress(char const* src, size_t size, char* dst, size_t dst_capacity, int level, std::span<const char> dictionary) const override {
+		if (level == 0) level = LZ4HC_CLEVEL_DEFAULT;
+		if (dictionary.empty()) {
+			return std::max(LZ4_compress_HC(src, dst, size, dst_capacity, level), 0);
+		}
+		// The HC state is too large for the stack
+		LZ4_streamHC_t* stream = LZ4_createStreamHC();
+		LZ4_resetStreamHC_fast(stream, level);
+		LZ4_loadDictHC(stream, dictionary.data(), dictionary.size());
+		int const result = LZ4_compress_HC_continue(stream, src, dst, size, dst_capacity);
+		LZ4_freeStreamHC(stream);
+		return std::max(result, 0);
+	}
+
+	std::vector<int> levels() const override {
+		return { LZ4HC_CLEVEL_MIN, LZ4HC_CLEVEL_DEFAULT, LZ4HC_CLEVEL_OPT_MIN, LZ4HC_CLEVEL_MAX };
+	}
+};
+
+}
+
+static std::array<std::unique_ptr<Codec>, 256>& codec_registry() {
+	static std::array<std::unique_ptr<Codec>, 256> codecs = [] {
+		std::array<std::unique_ptr<Codec>, 256> result;
+		result[static_cast<uint32_t>(CompressionMode::LZ4)] = std::make_unique<LZ4Codec>();
+		result[static_cast<uint32_t>(CompressionMode::LZ4HC)] = std::make_unique<LZ4HCCodec>();
+		return result;
+	}();
+	return codecs;
+}
+
+Codec const* find_codec(CompressionMode mode) {
+	uint32_t const index = static_cast<uint32_t>(mode);
+	if (index >= codec_registry().size()) return nullptr;
+	return codec_registry()[index].get();
+}
+
+void register_codec(CompressionMode mode, std::unique_ptr<Codec> codec) {
+	uint32_t const index = static_cast<uint32_t>(mode);
+	assert(index >= first_custom_compression_mode && index < codec_registry().size() && "Invalid custom compression mode");
+	codec_registry()[index] = std::move(codec);
+}
+
+static AutoCompressionSettings& auto_settings() {
+	static AutoCompressionSettings settings;
+	return settings;
+}
+
+void set_auto_compression_settings(AutoCompressionSettings const& settings) {
+	auto_settings() = settings;
+}
+
+AutoCompressionSettings const& get_auto_compression_settings() {
+	return auto_settings();
+}
+
+// Space compress_chunk() needs to compress size bytes
+static size_t compress_chunk_bound(CompressionChoice compression, size_t size) {
+	Codec const* codec = find_codec(compression.mode);
+	return codec ? codec->compress_bound(size) : 0;
+}
+
+// Compresses a single chunk into dst, which holds compress_chunk_bound() bytes.
+// Returns the data to store, which is src itself if compressing did not help.
+static std::span<const char> compress_chunk(CompressionChoice compression, char const* src, size_t size, char* dst) {
+	if (Codec const* codec = find_codec(compression.mode)) {
+		size_t const compressed_size = codec->compress(src, size, dst, codec->compress_bound(size), compression.level, compression.dictionary);
+		if (compressed_size > 0 && compressed_size < size) {
+			return { dst, compressed_size };
+		}
+	}
+	return { src, size };
+}
+
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, std::span<const char> dictionary) {
+	return choose_compression(payloads, get_auto_compression_settings(), dictionary);
+}
+
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, AutoCompressionSettings const& settings,
+	std::span<const char> dictionary) {
+	ScratchBuffer scratch;
+	return choose_compression(payloads, settings, dictionary, scratch);
+}
+
+CompressionChoice choose_compression(std::span<std::span<const char> const> payloads, AutoCompressionSettings const& settings,
+	std::span<const char> dictionary, ScratchBuffer& scratch) {
+	// The samples only depend on the payloads, so every candidate is measured on the same data
+	auto for_each_sample = [&](auto const& function) {
+		for (std::span<const char> payload : payloads) {
+			uint64_t const sample_count = std::min<uint64_t>(settings.sample_count, (payload.size() + settings.sample_size - 1) / settings.sample_size);
+			for (uint64_t i = 0; i < sample_count; ++i) {
+				// Spread samples evenly, the last one ends at the end of the payload
+				uint64_t const size = std::min<uint64_t>(settings.sample_size, payload.size());
+				uint64_t const offset = sample_count > 1 ? (payload.size() - size) * i / (sample_count - 1) : 0;
+				function(payload.subspan(offset, size));
+			}
+		}
+	};
+
+	CompressionChoice best{ CompressionMode::None, 0, dictionary };
+	double best_time = std::numeric_limits<double>::max();
+	for (CompressionMode mode : settings.candidates) {
+		Codec const* codec = find_codec(mode);
+		std::vector<int> const levels = codec ? codec->levels() : std::vector<int>{ 0 };
+		for (int level : levels) {
+			CompressionChoice const candidate{ mode, level, dictionary };
+			double time = 0.0;
+			for_each_sample([&](std::span<const char> sample) {
+				char* const dst = scratch.reserve(compress_chunk_bound(candidate, sample.size()));
+				std::span<const char> const stored = compress_chunk(candidate, sample.data(), sample.size(), dst);
+				bool const raw = stored.data() == sample.data();
+				time += stored.size() / settings.disk_bandwidth + sample.size() / (raw ? settings.copy_speed : codec->decode_speed());
+			});
+			if (time < best_time) {
+				best_time = time;
+				best = candidate;
+			}
+		}
+	}
+	return best;
+}
+
+CompressionChoice resolve_compression(CompressionMode mode, int level, std::span<std::span<const char> const> payloads,
+	std::span<const char> dictionary) {
+	ScratchBuffer scratch;
+	return resolve_compression(mode, level, payloads, dictionary, scratch);
+}
+
+CompressionChoice resolve_compression(CompressionMode mode, int level, std::span<std::span<const char> const> payloads,
+	std::span<const char> dictionary, ScratchBuffer& scratch) {
+	if (mode != CompressionMode::Auto) return { mode, level, dictionary };
+	if (payloads.empty()) return { CompressionMode::LZ4HC, 0, dictionary };
+	return choose_compression(payloads, get_auto_compression_settings(), dictionary, scratch);
+}
+
+static uint32_t chunk_count_for(uint64_t size, uint32_t chunk_size) {
+	return static_cast<uint32_t>((size + chunk_size - 1) / chunk_size);
+}
+
+static uint32_t read_u32(char const* src) {
+	uint32_t value;
+	std::memcpy(&value, src, sizeof(value));
+	return value;
+}
+
+void compress_chunked(CompressionChoice compression, void const* src, uint64_t size, uint32_t chunk_size, std::vector<char>& out, Executor const& executor) {
+	ScratchBuffer staging;
+	compress_chunked(compression, src, size, chunk_size, out, staging, executor);
+}
+
+void compress_chunked(CompressionChoice compression, void const* src, uint64_t size, uint32_t chunk_size, std::vector<char>& out,
+	ScratchBuffer& staging, Executor const& executor) {
+	uint32_t const chunk_count = chunk_count_for(size, chunk_size);
+	char const* src_bytes = reinterpret_cast<char const*>(src);
+
+	// Compress every chunk into its own slot of staging first, since we don't know their final offsets yet.
+	// Staging starts with the stored size of every chunk, followed by the slots.
+	size_t const slot_size = compress_chunk_bound(compression, chunk_size);
+	size_t const sizes_size = size_t(chunk_count) * sizeof(uint32_t);
+	char* const memory = staging.reserve(sizes_size + size_t(chunk_count) * slot_size);
+	assert((memory || chunk_count == 0) && "Out of memory for compression staging");
+	uint32_t* const stored_sizes = reinterpret_cast<uint32_t*>(memory);
+	char* const slots = memory + sizes_size;
+	run_jobs(executor, chunk_count, [&](uint32_t i) {
+		uint64_t const offset = uint64_t(i) * chunk_size;
+		size_t const raw_size = std::min<uint64_t>(chunk_size, size - offset);
+		stored_sizes[i] = compress_chunk(compression, src_bytes + offset, raw_size, slots + size_t(i) * slot_size).size();
+	});
+
+	size_t const table_offset = out.size();
+	out.resize(table_offset + (2 + chunk_count) * sizeof(uint32_t));
+	char* table = out.data() + table_offset;
+	std::memcpy(table, &chunk_size, sizeof(uint32_t));
+	std::memcpy(table + sizeof(uint32_t), &chunk_count, sizeof(uint32_t));
+	uint32_t end = 0;
+	for (uint32_t i = 0; i < chunk_count; ++i) {
+		end += stored_sizes[i];
+		std::memcpy(table + (2 + i) * sizeof(uint32_t), &end, sizeof(uint32_t));
+	}
+
+	out.reserve(out.size() + end);
+	for (uint32_t i = 0; i < chunk_count; ++i) {
+		uint64_t const offset = uint64_t(i) * chunk_size;
+		size_t const raw_size = std::min<uint64_t>(chunk_size, size - offset);
+		// Chunks that didn't get smaller were not copied to their slot, see compress_chunk()
+		char const* chunk = stored_sizes[i] == raw_size ? src_bytes + offset : slots + size_t(i) * slot_size;
+		out.insert(out.end(), chunk, chunk + stored_sizes[i]);
+	}
+}
+
+void ChunkedPayloadWriter::begin(AssetFileWriter& out, CompressionChoice compression, uint64_t size, uint32_t chunk_size) {
+	this->out = &out;
+	this->compression = compression;
+	this->size = size;
+	this->chunk_size = chunk_size;
+	written = 0;
+	table_offset = out.blob_size();
+	fits = true;
+	chunk_ends.clear();
+	chunk.clear();
+	chunk.reserve(chunk_size);
+
+	uint32_t const chunk_count = chunk_count_for(size, chunk_size);
+	std::vector<char> table((2 + chunk_count) * sizeof(uint32_t));
+	out.append(table.data(), table.size());
+}
+
+void ChunkedPayloadWriter::write(void const* data, size_t size) {
+	char const* bytes = reinterpret_cast<char const*>(data);
+	written += size;
+	while (size > 0) {
+		size_t const count = std::min<size_t>(size, chunk_size - chunk.size());
+		chunk.insert(chunk.end(), bytes, bytes + count);
+		bytes += count;
+		size -= count;
+		if (chunk.size() == chunk_size) flush_chunk();
+	}
+}
+
+void ChunkedPayloadWriter::flush_chunk() {
+	if (chunk.empty()) return;
+	// Sized for a whole chunk once, later chunks reuse it
+	compressed.resize(std::max(compressed.size(), compress_chunk_bound(compression, chunk.size())));
+	std::span<const char> const stored = compress_chunk(compression, chunk.data(), chunk.size(), compressed.data());
+	out->append(stored.data(), stored.size());
+	uint64_t const chunk_end = (chunk_ends.empty() ? 0 : uint64_t(chunk_ends.back())) + stored.size();
+	fits = fits && chunk_end <= std::numeric_limits<uint32_t>::max();
+	chunk_ends.push_back(static_cast<uint32_t>(chunk_end));
+	chunk.clear();
+}
+
+bool ChunkedPayloadWriter::end() {
+	flush_chunk();
+	uint32_t const chunk_count = chunk_ends.size();
+	if (written != size || chunk_count != chunk_count_for(size, chunk_size) || !fits) return false;
+
+	uint32_t const header[2] = { chunk_size, chunk_count };
+	out->patch(table_offset, header, sizeof(header));
+	if (chunk_count != 0) {
+		out->patch(table_offset + sizeof(header), chunk_ends.data(), chunk_count * sizeof(uint32_t));
+	}
+	return true;
+}
+
+namespace {
+
+struct ChunkTable {
+	uint32_t chunk_size = 0;
+	uint32_t chunk_count = 0;
+	char const* ends = nullptr;
+	std::span<const char> data;
+
+	uint32_t begin(uint32_t i) const { return i == 0 ? 0 : read_u32(ends + (i - 1) * sizeof(uint32_t)); }
+	uint32_t end(uint32_t i) const { return read_u32(ends + i * sizeof(uint32_t)); }
+};
+
+}
+
+// Validates the whole table up front so the jobs only need to report decompression failures.
+static bool read_chunk_table(std::span<const char> src, uint64_t size, ChunkTable& table) {
+	if (src.size() < 2 * sizeof(uint32_t)) return false;
+	table.chunk_size = read_u32(src.data());
+	table.chunk_count = read_u32(src.data() + sizeof(uint32_t));
+	if (table.chunk_size == 0 || table.chunk_count != chunk_count_for(size, table.chunk_size)) return false;
+
+	size_t const table_size = (2 + uint64_t(table.chunk_count)) * sizeof(uint32_t);
+	if (src.size() < table_size) return false;
+	table.ends = src.data() + 2 * sizeof(uint32_t);
+	table.data = src.subspan(table_size);
+
+	uint32_t previous_end = 0;
+	for (uint32_t i = 0; i < table.chunk_count; ++i) {
+		uint32_t const end = table.end(i);
+		if (end < previous_end || end > table.data.size()) return false;
+		previous_end = end;
+	}
+	return true;
+}
+
+bool decompress_chunked(CompressionMode mode, std::span<const char> src, void* dst, uint64_t size, Executor const& executor,
+	std::span<const char> dictionary) {
+	StageScope stage(LoadStage::Decompress, nullptr, src.size(), size);
+	ChunkTable table;
+	if (!read_chunk_table(src, size, table)) return false;
+
+	Codec const* codec = find_codec(mode);
+	char* dst_bytes = reinterpret_cast<char*>(dst);
+	std::atomic<bool> ok = true;
+	run_jobs(executor, table.chunk_count, [&](uint32_t i) {
+		uint32_t const begin = table.begin(i);
+		uint32_t const end = table.end(i);
+		uint64_t const offset = uint64_t(i) * table.chunk_size;
+		size_t const raw_size = std::min<uint64_t>(table.chunk_size, size - offset);
+		size_t const stored_size = end - begin;
+		if (stored_size == raw_size) {
+			std::memcpy(dst_bytes + offset, table.data.data() + begin, raw_size);
+		} else if (!codec || !codec->decompress(table.data.data() + begin, stored_size, dst_bytes + offset, raw_size, dictionary)) {
+			ok = false;
+		}
+	});
+	return ok;
+}
+
+bool decompress_chunked(CompressionMode mode, std::span<const char> src, uint64_t size, ChunkSink const& sink, Executor const& executor,
+	std::span<const char> dictionary) {
+	StageScope stage(LoadStage::Decompress, nullptr, src.size(), size);
+	ChunkTable table;
+	if (!read_chunk_table(src, size, table)) return false;
+
+	Codec const* codec = find_codec(mode);
+	std::atomic<bool> ok = true;
+	run_jobs(executor, table.chunk_count, [&](uint32_t i) {
+		// One chunk sized buffer per thread, so the data stays in cache until the sink has placed it
+		thread_local ScratchBuffer chunk;
+		uint32_t const begin = table.begin(i);
+		uint32_t const end = table.end(i);
+		uint64_t const offset = uint64_t(i) * table.chunk_size;
+		size_t const raw_size = std::min<uint64_t>(table.chunk_size, size - offset);
+		size_t const stored_size = end - begin;
+		if (stored_size == raw_size) {
+			sink(offset, table.data.data() + begin, raw_size);
+			return;
+		}
+		char* const buffer = chunk.reserve(raw_size);
+		if (!buffer || !codec || !codec->decompress(table.data.data() + begin, stored_size, buffer, raw_size, dictionary)) {
+			ok = false;
+		} else {
+			sink(offset, buffer, raw_size);
+		}
+		if (chunk.capacity() > thread_scratch_limit) chunk.release();
+	});
+	return ok;
+}
+
+}
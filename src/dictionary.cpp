@@ -0,0 +1,166 @@
+#include <assetlib/dictionary.hpp>
+
+#include <json.hpp>
+#include <xxhash.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace assetlib {
+
+//	Dictionary files store the id in a DictionaryBinaryInfo block at the start of the metadata,
+//	followed by a json description holding the id as a hex string and the size, only kept for tools and debugging.
+//	The binary blob holds the dictionary data, uncompressed.
+
+struct DictionaryBinaryInfo {
+	BinaryInfoHeader header;
+	uint64_t id = 0;
+	uint32_t size = 0;
+	uint32_t padding = 0;
+};
+
+// Samples are cut into segments of this size, which are then ranked by the number of samples they occur in.
+constexpr uint32_t dictionary_segment_size = 32;
+
+uint64_t dictionary_id(std::span<const char> data) {
+	uint64_t const id = XXH64(data.data(), data.size(), 0);
+	return id != 0 ? id : 1;
+}
+
+std::string format_dictionary_id(uint64_t id) {
+	char result[17];
+	std::snprintf(result, sizeof(result), "%016llx", static_cast<unsigned long long>(id));
+	return result;
+}
+
+Dictionary train_dictionary(std::span<std::span<const char> const> samples, uint32_t max_size) {
+	assert(max_size <= max_dictionary_size && "LZ4 can not use dictionaries larger than 64 KiB");
+
+	struct Segment {
+		char const* data = nullptr;
+		// Number of distinct samples this segment occurs in
+		uint32_t count = 0;
+		uint32_t last_sample = 0;
+		// Order of first occurrence, to keep training deterministic
+		uint32_t first_seen = 0;
+	};
+	std::unordered_map<uint64_t, Segment> segments;
+	uint32_t const step = dictionary_segment_size / 2;
+	for (uint32_t i = 0; i < samples.size(); ++i) {
+		std::span<const char> const sample = samples[i];
+		for (size_t offset = 0; offset + dictionary_segment_size <= sample.size(); offset += step) {
+			char const* data = sample.data() + offset;
+			Segment& segment = segments[XXH64(data, dictionary_segment_size, 0)];
+			if (segment.count == 0) {
+				segment.data = data;
+				segment.first_seen = segments.size();
+			} else if (segment.last_sample == i) {
+				continue;
+			}
+			segment.count += 1;
+			segment.last_sample = i;
+		}
+	}
+
+	// Segments only found in a single sample don't help other assets, unless there is nothing else to learn from.
+	uint32_t const min_count = samples.size() > 1 ? 2 : 1;
+	std::vector<Segment> ranked;
+	for (auto const& [hash, segment] : segments) {
+		if (segment.count >= min_count) ranked.push_back(segment);
+	}
+	std::sort(ranked.begin(), ranked.end(), [](Segment const& lhs, Segment const& rhs) {
+		if (lhs.count != rhs.count) return lhs.count > rhs.count;
+		return lhs.first_seen < rhs.first_seen;
+	});
+	ranked.resize(std::min<size_t>(ranked.size(), max_size / dictionary_segment_size));
+
+	// Most common segments go last, since matches close to the data are the last to fall out of the window
+	Dictionary dictionary;
+	dictionary.data.reserve(ranked.size() * dictionary_segment_size);
+	for (auto it = ranked.rbegin(); it != ranked.rend(); ++it) {
+		dictionary.data.insert(dictionary.data.end(), it->data, it->data + dictionary_segment_size);
+	}
+	dictionary.id = dictionary_id(dictionary.data);
+	return dictionary;
+}
+
+AssetFile pack_dictionary(Dictionary const& dictionary) {
+	assert(dictionary.data.size() <= max_dictionary_size && "LZ4 can not use dictionaries larger than 64 KiB");
+
+	AssetFile file;
+	file.type[0] = 'D'; file.type[1] = 'I'; file.type[2] = 'C'; file.type[3] = 'T';
+	file.version = dict_version;
+
+	json::JSON json;
+	json["id"] = format_dictionary_id(dictionary.id);
+	json["size"] = dictionary.data.size();
+
+	DictionaryBinaryInfo binary;
+	binary.id = dictionary.id;
+	binary.size = dictionary.data.size();
+	file.metadata_json = make_metadata(&binary, sizeof(binary), json.dump(0, ""));
+	file.binary_blob = dictionary.data;
+	return file;
+}
+
+Dictionary unpack_dictionary(AssetFile const& file) {
+	return unpack_dictionary(make_view(file));
+}
+
+Dictionary unpack_dictionary(AssetFileView const& file) {
+	assert(file.type[0] == 'D' && file.type[1] == 'I' && file.type[2] == 'C' && file.type[3] == 'T' && file.version <= dict_version && "Type/version mismatch");
+
+	DictionaryBinaryInfo binary;
+	bool const ok = read_binary_info(file, &binary, sizeof(binary));
+	assert(ok && binary.size <= file.binary_blob.size() && "Corrupted dictionary");
+
+	Dictionary dictionary;
+	dictionary.id = binary.id;
+	dictionary.data.assign(file.binary_blob.begin(), file.binary_blob.begin() + binary.size);
+	return dictionary;
+}
+
+struct DictionaryRegistry {
+	std::shared_mutex mutex;
+	std::unordered_map<uint64_t, std::shared_ptr<Dictionary const>> dictionaries;
+};
+
+static DictionaryRegistry& dictionary_registry() {
+	static DictionaryRegistry registry;
+	return registry;
+}
+
+void register_dictionary(Dictionary dictionary) {
+	assert(dictionary.id != 0 && "Dictionary has no id");
+	DictionaryRegistry& registry = dictionary_registry();
+	std::unique_lock lock(registry.mutex);
+	auto& entry = registry.dictionaries[dictionary.id];
+	if (!entry) entry = std::make_shared<Dictionary const>(std::move(dictionary));
+}
+
+void unregister_dictionary(uint64_t id) {
+	DictionaryRegistry& registry = dictionary_registry();
+	std::unique_lock lock(registry.mutex);
+	registry.dictionaries.erase(id);
+}
+
+std::shared_ptr<Dictionary const> find_dictionary(uint64_t id) {
+	DictionaryRegistry& registry = dictionary_registry();
+	std::shared_lock lock(registry.mutex);
+	auto it = registry.dictionaries.find(id);
+	return it != registry.dictionaries.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<Dictionary const> require_dictionary(uint64_t id) {
+	if (id == 0) return nullptr;
+	std::shared_ptr<Dictionary const> dictionary = find_dictionary(id);
+	assert(dictionary && "Asset was packed with a dictionary that is not registered");
+	return dictionary;
+}
+
+}
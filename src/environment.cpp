@@ -1,17 +1,351 @@
 #include <assetlib/environment.hpp>
+#include <assetlib/compression.hpp>
+#include <assetlib/quantization.hpp>
+
+#include "instrumentation_scope.hpp"
+#include "simd.hpp"
 
 #include <json.hpp>
 #include <lz4.h>
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numbers>
 
 namespace assetlib {
 
+// Since version 1.1.0 the hdr, irradiance and specular maps are each stored as a chunked payload (see compression.hpp).
+// Version 1.0.0 stored each of them as a single LZ4 block.
+constexpr uint32_t ienv_chunked_version = pack_version(1, 1, 0);
+// Since version 2.0.0 the metadata starts with an EnvironmentBinaryInfo block, which is all the parser reads.
+// The json description that follows it is only kept for tools and debugging, and no longer holds the blob offsets.
+// Version 2.1.0 started honoring EnvironmentInfo::compression when packing, before that LZ4 was always used.
+constexpr uint32_t ienv_binary_info_version = pack_version(2, 0, 0);
+// Since version 2.2.0 the binary info also holds the texel format, the specular mip levels and the irradiance storage
+// with its SH coefficients. With a known format the specular map starts with a table of SpecularTableEntry (u32 count,
+// then the entries, mip by mip) followed by every face of every mip level as its own chunked payload.
+constexpr uint32_t ienv_format_version = pack_version(2, 2, 0);
+
+// Enums are stored by value, so their values may never change.
+struct EnvironmentBinaryInfo {
+    BinaryInfoHeader header;
+    uint32_t compression = 0;
+    uint32_t hdr_extents[2]{};
+    uint32_t hdr_bytes = 0;
+    uint32_t irradiance_size = 0;
+    uint32_t irradiance_bytes = 0;
+    uint32_t irradiance_offset = 0;
+    uint32_t specular_size = 0;
+    uint32_t specular_bytes = 0;
+    uint32_t specular_offset = 0;
+    uint32_t format = 0;
+    uint32_t specular_mip_levels = 0;
+    uint32_t irradiance_storage = 0;
+    float irradiance_sh[9][3]{};
+};
+
+constexpr uint32_t cube_faces = 6;
+// Texels converted per job when packing RGBA32F maps
+constexpr uint64_t texels_per_job = 16384;
+
+uint32_t environment_format_byte_size(EnvironmentFormat format) {
+    switch (format) {
+    case EnvironmentFormat::RGBA32F:
+        return 16;
+    case EnvironmentFormat::RGBA16F:
+        return 8;
+    case EnvironmentFormat::RGB9E5:
+    case EnvironmentFormat::R11G11B10F:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static char const* format_to_string(EnvironmentFormat format) {
+    switch (format) {
+    case EnvironmentFormat::RGBA32F:
+        return "rgba32f";
+    case EnvironmentFormat::RGBA16F:
+        return "rgba16f";
+    case EnvironmentFormat::RGB9E5:
+        return "rgb9e5";
+    case EnvironmentFormat::R11G11B10F:
+        return "r11g11b10f";
+    default:
+        return "unknown";
+    }
+}
+
+#ifdef ASSETLIB_SSE2
+static __m128i select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// SIMD version of float3_to_rgb9e5() for 4 texels, one channel per register
+static __m128i rgb9e5_x4(__m128 r, __m128 g, __m128 b) {
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const max_value = _mm_set1_ps(65408.0f);
+    // max returns its second operand for NaN
+    r = _mm_min_ps(_mm_max_ps(r, zero), max_value);
+    g = _mm_min_ps(_mm_max_ps(g, zero), max_value);
+    b = _mm_min_ps(_mm_max_ps(b, zero), max_value);
+    __m128 const max_channel = _mm_max_ps(_mm_max_ps(r, g), b);
+    __m128i const exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(max_channel), 23), _mm_set1_epi32(127));
+    __m128i const tiny = _mm_castps_si128(_mm_cmplt_ps(max_channel, _mm_set1_ps(0x1p-16f)));
+    __m128i shared = _mm_add_epi32(select(tiny, _mm_set1_epi32(-16), exponent), _mm_set1_epi32(16));
+    __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 24), shared), 23));
+    __m128 const half = _mm_set1_ps(0.5f);
+    __m128i const overflow = _mm_cmpeq_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(max_channel, scale), half)), _mm_set1_epi32(512));
+    shared = _mm_sub_epi32(shared, overflow);
+    scale = _mm_castsi128_ps(select(overflow, _mm_castps_si128(_mm_mul_ps(scale, half)), _mm_castps_si128(scale)));
+    __m128i result = _mm_slli_epi32(shared, 27);
+    result = _mm_or_si128(result, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half)));
+    result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half)), 9));
+    return _mm_or_si128(result, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half)), 18));
+}
+
+// SIMD version of the unsigned small floats of float3_to_r11g11b10f()
+template <int mantissa_bits>
+static __m128i small_float_x4(__m128 value) {
+    constexpr int shift = 23 - mantissa_bits;
+    __m128i const positive = _mm_castps_si128(_mm_cmpgt_ps(value, _mm_setzero_ps()));
+    __m128i const bits = _mm_castps_si128(value);
+    __m128i const is_subnormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(0x38800000));
+    __m128 const magic = _mm_castsi128_ps(_mm_set1_epi32((136 - mantissa_bits) << 23));
+    __m128i const subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(value, magic)), _mm_castps_si128(magic));
+    __m128i const odd = _mm_and_si128(_mm_srli_epi32(bits, shift), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(_mm_add_epi32(bits, _mm_set1_epi32((1 << (shift - 1)) - 1 - (112 << 23))), odd);
+    normal = _mm_srli_epi32(normal, shift);
+    __m128i const max_finite = _mm_set1_epi32((31 << mantissa_bits) - 1);
+    normal = select(_mm_cmpgt_epi32(normal, max_finite), max_finite, normal);
+    return _mm_and_si128(positive, select(is_subnormal, subnormal, normal));
+}
+
+static __m128i r11g11b10f_x4(__m128 r, __m128 g, __m128 b) {
+    __m128i const packed = _mm_or_si128(small_float_x4<6>(r), _mm_slli_epi32(small_float_x4<6>(g), 11));
+    return _mm_or_si128(packed, _mm_slli_epi32(small_float_x4<5>(b), 22));
+}
+#endif
+
+void convert_environment_texels(EnvironmentFormat format, float const* src_rgba, uint64_t count, void* dst) {
+    char* dst_bytes = reinterpret_cast<char*>(dst);
+    switch (format) {
+    case EnvironmentFormat::RGBA32F:
+        std::memcpy(dst, src_rgba, count * 4 * sizeof(float));
+        return;
+    case EnvironmentFormat::RGBA16F:
+        for (uint64_t i = 0; i < count; ++i) {
+#if ASSETLIB_F16C
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_bytes + i * 8), _mm_cvtps_ph(_mm_loadu_ps(src_rgba + i * 4), _MM_FROUND_TO_NEAREST_INT));
+#else
+            uint16_t const texel[4] = { float_to_half(src_rgba[i * 4]), float_to_half(src_rgba[i * 4 + 1]),
+                float_to_half(src_rgba[i * 4 + 2]), float_to_half(src_rgba[i * 4 + 3]) };
+            std::memcpy(dst_bytes + i * 8, texel, sizeof(texel));
+#endif
+        }
+        return;
+    case EnvironmentFormat::RGB9E5:
+    case EnvironmentFormat::R11G11B10F: {
+        uint64_t i = 0;
+#ifdef ASSETLIB_SSE2
+        for (; i + 4 <= count; i += 4) {
+            // Transposed, so every register holds one channel of 4 texels
+            __m128 r = _mm_loadu_ps(src_rgba + i * 4);
+            __m128 g = _mm_loadu_ps(src_rgba + i * 4 + 4);
+            __m128 b = _mm_loadu_ps(src_rgba + i * 4 + 8);
+            __m128 a = _mm_loadu_ps(src_rgba + i * 4 + 12);
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+            __m128i const packed = format == EnvironmentFormat::RGB9E5 ? rgb9e5_x4(r, g, b) : r11g11b10f_x4(r, g, b);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_bytes + i * 4), packed);
+        }
+#endif
+        for (; i < count; ++i) {
+            uint32_t const packed = format == EnvironmentFormat::RGB9E5 ? float3_to_rgb9e5(src_rgba + i * 4) : float3_to_r11g11b10f(src_rgba + i * 4);
+            std::memcpy(dst_bytes + i * 4, &packed, sizeof(packed));
+        }
+        return;
+    }
+    default:
+        assert(false && "Texels can only be converted to a known format");
+    }
+}
+
+void convert_environment_texels(EnvironmentFormat format, void const* src, uint64_t count, float* dst_rgba) {
+    char const* src_bytes = reinterpret_cast<char const*>(src);
+    switch (format) {
+    case EnvironmentFormat::RGBA32F:
+        std::memcpy(dst_rgba, src, count * 4 * sizeof(float));
+        return;
+    case EnvironmentFormat::RGBA16F:
+        for (uint64_t i = 0; i < count * 4; ++i) {
+            uint16_t half;
+            std::memcpy(&half, src_bytes + i * 2, sizeof(half));
+            dst_rgba[i] = half_to_float(half);
+        }
+        return;
+    case EnvironmentFormat::RGB9E5:
+    case EnvironmentFormat::R11G11B10F:
+        for (uint64_t i = 0; i < count; ++i) {
+            uint32_t packed;
+            std::memcpy(&packed, src_bytes + i * 4, sizeof(packed));
+            if (format == EnvironmentFormat::RGB9E5) {
+                rgb9e5_to_float3(packed, dst_rgba + i * 4);
+            } else {
+                r11g11b10f_to_float3(packed, dst_rgba + i * 4);
+            }
+            dst_rgba[i * 4 + 3] = 1.0f;
+        }
+        return;
+    default:
+        assert(false && "Texels can only be converted from a known format");
+    }
+}
+
+// Real spherical harmonics basis of bands 0 to 2
+static void sh9_basis(float const d[3], float basis[9]) {
+    basis[0] = 0.282095f;
+    basis[1] = 0.488603f * d[1];
+    basis[2] = 0.488603f * d[2];
+    basis[3] = 0.488603f * d[0];
+    basis[4] = 1.092548f * d[0] * d[1];
+    basis[5] = 1.092548f * d[1] * d[2];
+    basis[6] = 0.315392f * (3.0f * d[2] * d[2] - 1.0f);
+    basis[7] = 1.092548f * d[0] * d[2];
+    basis[8] = 0.546274f * (d[0] * d[0] - d[1] * d[1]);
+}
+
+void compute_irradiance_sh9(EnvironmentInfo const& info, void const* hdr, float sh[9][3]) {
+    uint32_t const width = info.hdr_extents[0];
+    uint32_t const height = info.hdr_extents[1];
+    uint32_t const texel_size = environment_format_byte_size(info.format);
+    assert(texel_size != 0 && info.hdr_bytes == uint64_t(width) * height * texel_size && "SH irradiance needs an hdr map with a known format");
+
+    std::vector<float> cos_phi(width);
+    std::vector<float> sin_phi(width);
+    for (uint32_t x = 0; x < width; ++x) {
+        double const phi = 2.0 * std::numbers::pi * (x + 0.5) / width;
+        cos_phi[x] = float(std::cos(phi));
+        sin_phi[x] = float(std::sin(phi));
+    }
+
+    // Radiance projected onto the basis, every texel weighted by its solid angle
+    double sums[9][3]{};
+    double const texel_angle = (2.0 * std::numbers::pi / width) * (std::numbers::pi / height);
+    std::vector<float> row(uint64_t(width) * 4);
+    char const* hdr_bytes = reinterpret_cast<char const*>(hdr);
+    for (uint32_t y = 0; y < height; ++y) {
+        double const theta = std::numbers::pi * (y + 0.5) / height;
+        float const sin_theta = float(std::sin(theta));
+        float const cos_theta = float(std::cos(theta));
+        double const weight = texel_angle * sin_theta;
+        convert_environment_texels(info.format, hdr_bytes + uint64_t(y) * width * texel_size, width, row.data());
+        float row_sums[9][3]{};
+        for (uint32_t x = 0; x < width; ++x) {
+            float const direction[3] = { sin_theta * cos_phi[x], cos_theta, sin_theta * sin_phi[x] };
+            float basis[9];
+            sh9_basis(direction, basis);
+            for (int i = 0; i < 9; ++i) {
+                for (int c = 0; c < 3; ++c) row_sums[i][c] += basis[i] * row[x * 4 + c];
+            }
+        }
+        for (int i = 0; i < 9; ++i) {
+            for (int c = 0; c < 3; ++c) sums[i][c] += weight * row_sums[i][c];
+        }
+    }
+
+    // Convolution with the clamped cosine lobe, per band (Ramamoorthi and Hanrahan)
+    constexpr double band_factors[9] = { std::numbers::pi, 2.0 * std::numbers::pi / 3.0, 2.0 * std::numbers::pi / 3.0, 2.0 * std::numbers::pi / 3.0,
+        std::numbers::pi / 4.0, std::numbers::pi / 4.0, std::numbers::pi / 4.0, std::numbers::pi / 4.0, std::numbers::pi / 4.0 };
+    for (int i = 0; i < 9; ++i) {
+        for (int c = 0; c < 3; ++c) sh[i][c] = float(sums[i][c] * band_factors[i]);
+    }
+}
+
+void evaluate_irradiance_sh9(float const sh[9][3], float const direction[3], float irradiance[3]) {
+    float basis[9];
+    sh9_basis(direction, basis);
+    for (int c = 0; c < 3; ++c) {
+        irradiance[c] = 0.0f;
+        for (int i = 0; i < 9; ++i) irradiance[c] += sh[i][c] * basis[i];
+    }
+}
+
+// Since 2.2.0, environments with a known format address every face of every specular mip level on its own
+static bool has_specular_table(EnvironmentInfo const& info) {
+    return info.format != EnvironmentFormat::Unknown;
+}
+
+static uint32_t specular_mip_count(EnvironmentInfo const& info) {
+    return std::max(info.specular_mip_levels, 1u);
+}
+
+// Texels along the edge of a specular face
+static uint32_t specular_face_size(EnvironmentInfo const& info, uint32_t mip) {
+    return std::max(info.specular_size >> mip, 1u);
+}
+
+uint64_t environment_specular_face_byte_size(EnvironmentInfo const& info, uint32_t mip) {
+    assert(has_specular_table(info) && "Specular faces can only be addressed with a known format");
+    uint64_t const size = specular_face_size(info, mip);
+    return size * size * environment_format_byte_size(info.format);
+}
+
+// The chunked payload of a face of a specular mip level
+static bool specular_face_payload(EnvironmentInfo const& info, AssetFileView const& file, uint32_t mip, uint32_t face, std::span<const char>& payload) {
+    assert(has_specular_table(info) && mip < specular_mip_count(info) && face < cube_faces && "Specular face out of range");
+    std::span<const char> const blob = file.binary_blob;
+    uint32_t count;
+    if (blob.size() < uint64_t(info.specular_offset) + sizeof(uint32_t)) return false;
+    std::memcpy(&count, blob.data() + info.specular_offset, sizeof(uint32_t));
+    uint32_t const index = mip * cube_faces + face;
+    if (index >= count) return false;
+    uint64_t const entry_offset = uint64_t(info.specular_offset) + sizeof(uint32_t) + uint64_t(index) * sizeof(SpecularTableEntry);
+    if (blob.size() < entry_offset + sizeof(SpecularTableEntry)) return false;
+    SpecularTableEntry entry;
+    std::memcpy(&entry, blob.data() + entry_offset, sizeof(SpecularTableEntry));
+    if (uint64_t(entry.offset) + entry.stored_size > blob.size() || entry.byte_size != environment_specular_face_byte_size(info, mip)) return false;
+    payload = blob.subspan(entry.offset, entry.stored_size);
+    return true;
+}
+
 EnvironmentInfo read_environment_info(AssetFile const& file) {
-    assert(file.type[0] == 'I' && file.type[1] == 'E' && file.type[2] == 'N' && file.type[3] == 'V' && file.version == ienv_version && "Type/version mismatch");
+    return read_environment_info(make_view(file));
+}
+
+EnvironmentInfo read_environment_info(AssetFileView const& file) {
+    StageScope stage(LoadStage::InfoParse, file.type, file.metadata_json.size());
+    assert(file.type[0] == 'I' && file.type[1] == 'E' && file.type[2] == 'N' && file.type[3] == 'V' && major_version(file.version) >= 1 && file.version <= ienv_version && "Type/version mismatch");
 
     EnvironmentInfo info;
-    json::JSON json = json::JSON::Load(file.metadata_json);
+    if (file.version >= ienv_binary_info_version) {
+        EnvironmentBinaryInfo binary;
+        bool const ok = read_binary_info(file, &binary, sizeof(binary));
+        assert(ok && "Missing environment info");
+        info.compression = static_cast<CompressionMode>(binary.compression);
+        info.hdr_extents[0] = binary.hdr_extents[0];
+        info.hdr_extents[1] = binary.hdr_extents[1];
+        info.hdr_bytes = binary.hdr_bytes;
+        info.irradiance_size = binary.irradiance_size;
+        info.irradiance_bytes = binary.irradiance_bytes;
+        info.irradiance_offset = binary.irradiance_offset;
+        info.specular_size = binary.specular_size;
+        info.specular_bytes = binary.specular_bytes;
+        info.specular_offset = binary.specular_offset;
+        if (file.version >= ienv_format_version) {
+            info.format = static_cast<EnvironmentFormat>(binary.format);
+            info.specular_mip_levels = binary.specular_mip_levels;
+            info.irradiance_storage = static_cast<IrradianceStorage>(binary.irradiance_storage);
+            std::memcpy(info.irradiance_sh, binary.irradiance_sh, sizeof(info.irradiance_sh));
+        }
+        return info;
+    }
+
+    json::JSON json = json::JSON::Load(std::string(file.metadata_json));
     info.compression = parse_compression_mode(json["compression_mode"].ToString());
     info.hdr_extents[0] = json["hdr_extents"]["x"].ToInt();
     info.hdr_extents[1] = json["hdr_extents"]["y"].ToInt();
@@ -25,7 +359,34 @@ EnvironmentInfo read_environment_info(AssetFile const& file) {
     return info;
 }
 
-void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular) {
+void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular, Executor const& executor) {
+    unpack_environment(info, make_view(file), dst_hdr, dst_irradiance, dst_specular, executor);
+}
+
+void unpack_environment(EnvironmentInfo const& info, AssetFileView const& file, void* dst_hdr, void* dst_irradiance, void* dst_specular, Executor const& executor) {
+    StageScope stage(LoadStage::Unpack, file.type, file.binary_blob.size(), info.hdr_bytes + info.irradiance_bytes + info.specular_bytes);
+    if (file.version >= ienv_chunked_version) {
+        assert(info.irradiance_offset <= info.specular_offset && info.specular_offset <= file.binary_blob.size() && "Corrupted environment data");
+        std::span<const char> const blob = file.binary_blob;
+        bool ok = decompress_chunked(info.compression, blob.first(info.irradiance_offset), dst_hdr, info.hdr_bytes, executor);
+        ok = ok && decompress_chunked(info.compression, blob.subspan(info.irradiance_offset, info.specular_offset - info.irradiance_offset),
+            dst_irradiance, info.irradiance_bytes, executor);
+        assert(ok && "Corrupted environment data");
+        if (!has_specular_table(info)) {
+            ok = decompress_chunked(info.compression, blob.subspan(info.specular_offset), dst_specular, info.specular_bytes, executor);
+            assert(ok && "Corrupted environment data");
+            return;
+        }
+        // Faces are small, so they are spread over the executor instead of their chunks
+        char* specular_bytes = reinterpret_cast<char*>(dst_specular);
+        run_jobs(executor, specular_mip_count(info) * cube_faces, [&](uint32_t index) {
+            uint32_t const mip = index / cube_faces;
+            uint32_t const face = index % cube_faces;
+            unpack_environment_specular(info, file, mip, face, specular_bytes + environment_specular_face_offset(info, EnvironmentLayout{}, mip, face));
+        });
+        return;
+    }
+
     char const* start = file.binary_blob.data();
     if (info.compression == CompressionMode::LZ4) {
         LZ4_decompress_safe(start, reinterpret_cast<char*>(dst_hdr), info.irradiance_offset, info.hdr_bytes);
@@ -38,42 +399,430 @@ void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, void
     }
 }
 
-AssetFile pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular) {
-    AssetFile file{};
-    file.version = ienv_version;
-    file.type[0] = 'I'; file.type[1] = 'E'; file.type[2] = 'N'; file.type[3] = 'V';
+void unpack_environment_specular(EnvironmentInfo const& info, AssetFile const& file, uint32_t mip, uint32_t face, void* dst, Executor const& executor) {
+    unpack_environment_specular(info, make_view(file), mip, face, dst, executor);
+}
+
+void unpack_environment_specular(EnvironmentInfo const& info, AssetFileView const& file, uint32_t mip, uint32_t face, void* dst, Executor const& executor) {
+    std::span<const char> payload;
+    bool ok = specular_face_payload(info, file, mip, face, payload);
+    ok = ok && decompress_chunked(info.compression, payload, dst, environment_specular_face_byte_size(info, mip), executor);
+    assert(ok && "Corrupted environment data");
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Tightly packed rows of the hdr map and of the irradiance faces
+static uint64_t hdr_row_size(EnvironmentInfo const& info) {
+    assert(info.hdr_extents[1] != 0 && info.hdr_bytes % info.hdr_extents[1] == 0 && "hdr_bytes is not a whole number of rows");
+    return info.hdr_bytes / info.hdr_extents[1];
+}
+
+static uint64_t irradiance_row_size(EnvironmentInfo const& info) {
+    uint64_t const rows = uint64_t(cube_faces) * info.irradiance_size;
+    assert(rows != 0 && info.irradiance_bytes % rows == 0 && "irradiance_bytes is not a whole number of cube face rows");
+    return info.irradiance_bytes / rows;
+}
+
+uint64_t environment_hdr_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout) {
+    return align_up(hdr_row_size(info), layout.row_alignment);
+}
+
+uint64_t environment_irradiance_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout) {
+    return align_up(irradiance_row_size(info), layout.row_alignment);
+}
+
+uint64_t environment_irradiance_face_offset(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t face) {
+    uint64_t const face_size = environment_irradiance_row_pitch(info, layout) * info.irradiance_size;
+    return face * align_up(face_size, layout.face_alignment);
+}
+
+uint64_t environment_specular_row_pitch(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t mip) {
+    return align_up(uint64_t(specular_face_size(info, mip)) * environment_format_byte_size(info.format), layout.row_alignment);
+}
 
+uint64_t environment_specular_face_offset(EnvironmentInfo const& info, EnvironmentLayout const& layout, uint32_t mip, uint32_t face) {
+    assert(has_specular_table(info) && "Specular faces can only be addressed with a known format");
+    uint64_t offset = 0;
+    for (uint32_t level = 0; level <= mip; ++level) {
+        uint64_t const face_size = align_up(environment_specular_row_pitch(info, layout, level) * specular_face_size(info, level), layout.face_alignment);
+        offset += (level < mip ? cube_faces : face) * face_size;
+    }
+    return offset;
+}
+
+uint64_t environment_hdr_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout) {
+    return environment_hdr_row_pitch(info, layout) * info.hdr_extents[1];
+}
+
+uint64_t environment_irradiance_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout) {
+    if (info.irradiance_bytes == 0) return 0;
+    return environment_irradiance_face_offset(info, layout, cube_faces - 1) + environment_irradiance_row_pitch(info, layout) * info.irradiance_size;
+}
+
+uint64_t environment_specular_byte_size(EnvironmentInfo const& info, EnvironmentLayout const& layout) {
+    if (!has_specular_table(info)) return info.specular_bytes;
+    uint32_t const last_mip = specular_mip_count(info) - 1;
+    return environment_specular_face_offset(info, layout, last_mip, cube_faces - 1)
+        + environment_specular_row_pitch(info, layout, last_mip) * specular_face_size(info, last_mip);
+}
+
+// Places the pieces of a map made of rows of row_size bytes, row_address gives the destination of every row.
+template <typename RowAddress>
+static void scatter_rows(uint64_t row_size, RowAddress const& row_address, uint64_t offset, char const* data, size_t size) {
+    while (size > 0) {
+        uint64_t const within = offset % row_size;
+        size_t const count = std::min<uint64_t>(size, row_size - within);
+        std::memcpy(row_address(offset / row_size) + within, data, count);
+        offset += count;
+        data += count;
+        size -= count;
+    }
+}
+
+void unpack_environment(EnvironmentInfo const& info, AssetFile const& file, EnvironmentLayout const& layout, void* dst_hdr, void* dst_irradiance,
+    void* dst_specular, Executor const& executor) {
+    unpack_environment(info, make_view(file), layout, dst_hdr, dst_irradiance, dst_specular, executor);
+}
+
+void unpack_environment(EnvironmentInfo const& info, AssetFileView const& file, EnvironmentLayout const& layout, void* dst_hdr, void* dst_irradiance,
+    void* dst_specular, Executor const& executor) {
+    StageScope stage(LoadStage::Unpack, file.type, file.binary_blob.size(), info.hdr_bytes + info.irradiance_bytes + info.specular_bytes);
+    uint64_t const hdr_size = hdr_row_size(info);
+    uint64_t const hdr_pitch = environment_hdr_row_pitch(info, layout);
+    // There are no irradiance rows with SH irradiance
+    uint64_t const irradiance_size = info.irradiance_bytes != 0 ? irradiance_row_size(info) : 1;
+    uint64_t const irradiance_pitch = info.irradiance_bytes != 0 ? environment_irradiance_row_pitch(info, layout) : 0;
+    char* hdr_bytes = reinterpret_cast<char*>(dst_hdr);
+    char* irradiance_bytes = reinterpret_cast<char*>(dst_irradiance);
+    auto hdr_row = [&](uint64_t row) {
+        return hdr_bytes + row * hdr_pitch;
+    };
+    auto irradiance_row = [&](uint64_t row) {
+        uint32_t const face = row / info.irradiance_size;
+        return irradiance_bytes + environment_irradiance_face_offset(info, layout, face) + (row % info.irradiance_size) * irradiance_pitch;
+    };
+
+    if (file.version < ienv_chunked_version) {
+        std::vector<char> hdr(info.hdr_bytes);
+        std::vector<char> irradiance(info.irradiance_bytes);
+        unpack_environment(info, file, hdr.data(), irradiance.data(), dst_specular, executor);
+        scatter_rows(hdr_size, hdr_row, 0, hdr.data(), hdr.size());
+        scatter_rows(irradiance_size, irradiance_row, 0, irradiance.data(), irradiance.size());
+        return;
+    }
+
+    assert(info.irradiance_offset <= info.specular_offset && info.specular_offset <= file.binary_blob.size() && "Corrupted environment data");
+    std::span<const char> const blob = file.binary_blob;
+    bool ok = decompress_chunked(info.compression, blob.first(info.irradiance_offset), info.hdr_bytes,
+        [&](uint64_t offset, char const* data, size_t size) { scatter_rows(hdr_size, hdr_row, offset, data, size); }, executor);
+    ok = ok && decompress_chunked(info.compression, blob.subspan(info.irradiance_offset, info.specular_offset - info.irradiance_offset), info.irradiance_bytes,
+        [&](uint64_t offset, char const* data, size_t size) { scatter_rows(irradiance_size, irradiance_row, offset, data, size); }, executor);
+    assert(ok && "Corrupted environment data");
+    if (!has_specular_table(info)) {
+        ok = decompress_chunked(info.compression, blob.subspan(info.specular_offset), dst_specular, info.specular_bytes, executor);
+        assert(ok && "Corrupted environment data");
+        return;
+    }
+
+    char* specular_bytes = reinterpret_cast<char*>(dst_specular);
+    run_jobs(executor, specular_mip_count(info) * cube_faces, [&](uint32_t index) {
+        uint32_t const mip = index / cube_faces;
+        uint32_t const face = index % cube_faces;
+        uint64_t const row_size = uint64_t(specular_face_size(info, mip)) * environment_format_byte_size(info.format);
+        uint64_t const pitch = environment_specular_row_pitch(info, layout, mip);
+        char* const face_start = specular_bytes + environment_specular_face_offset(info, layout, mip, face);
+        auto face_row = [&](uint64_t row) {
+            return face_start + row * pitch;
+        };
+        std::span<const char> payload;
+        bool face_ok = specular_face_payload(info, file, mip, face, payload);
+        face_ok = face_ok && decompress_chunked(info.compression, payload, environment_specular_face_byte_size(info, mip),
+            [&](uint64_t offset, char const* data, size_t size) { scatter_rows(row_size, face_row, offset, data, size); });
+        assert(face_ok && "Corrupted environment data");
+    });
+}
+
+// Offsets into the binary blob are only stored in the binary info, so the json can be written before the blob is complete.
+static std::string environment_metadata(EnvironmentInfo const& info, CompressionMode compression, uint32_t irradiance_offset, uint32_t specular_offset) {
     json::JSON json{};
-    json["compression_mode"] = compression_to_string(CompressionMode::LZ4);
+    json["compression_mode"] = compression_to_string(compression);
     json["hdr_extents"]["x"] = info.hdr_extents[0]; json["hdr_extents"]["y"] = info.hdr_extents[1];
     json["hdr_bytes"] = info.hdr_bytes;
     json["irradiance_size"] = info.irradiance_size;
     json["irradiance_bytes"] = info.irradiance_bytes;
     json["specular_size"] = info.specular_size;
     json["specular_bytes"] = info.specular_bytes;
+    json["format"] = format_to_string(info.format);
+    json["specular_mip_levels"] = info.specular_mip_levels;
+    json["irradiance_storage"] = info.irradiance_storage == IrradianceStorage::SH9 ? "sh9" : "cubemap";
+
+    EnvironmentBinaryInfo binary;
+    binary.compression = static_cast<uint32_t>(compression);
+    binary.hdr_extents[0] = info.hdr_extents[0];
+    binary.hdr_extents[1] = info.hdr_extents[1];
+    binary.hdr_bytes = info.hdr_bytes;
+    binary.irradiance_size = info.irradiance_size;
+    binary.irradiance_bytes = info.irradiance_bytes;
+    binary.irradiance_offset = irradiance_offset;
+    binary.specular_size = info.specular_size;
+    binary.specular_bytes = info.specular_bytes;
+    binary.specular_offset = specular_offset;
+    binary.format = static_cast<uint32_t>(info.format);
+    binary.specular_mip_levels = info.specular_mip_levels;
+    binary.irradiance_storage = static_cast<uint32_t>(info.irradiance_storage);
+    std::memcpy(binary.irradiance_sh, info.irradiance_sh, sizeof(binary.irradiance_sh));
+    return make_metadata(&binary, sizeof(binary), json.dump(0, ""));
+}
+
+static void validate_sizes(EnvironmentInfo const& info) {
+    uint64_t const texel_size = environment_format_byte_size(info.format);
+    if (texel_size == 0) return;
+    assert(info.hdr_bytes == uint64_t(info.hdr_extents[0]) * info.hdr_extents[1] * texel_size && "hdr_bytes does not match the extents");
+    assert((info.irradiance_storage == IrradianceStorage::SH9
+        || info.irradiance_bytes == cube_faces * uint64_t(info.irradiance_size) * info.irradiance_size * texel_size) && "irradiance_bytes does not match the extents");
+    assert(specular_mip_count(info) <= uint32_t(std::bit_width(info.specular_size)) && "More specular mip levels than the extents allow");
+    assert(info.specular_bytes == environment_specular_byte_size(info, EnvironmentLayout{}) && "specular_bytes does not match the specular mip chain");
+}
 
-    // Compress the data pointers into the final binary blob
-    int staging_size = LZ4_compressBound(info.hdr_bytes);
-    file.binary_blob.resize(staging_size);
-    int compressed_size = LZ4_compress_default(reinterpret_cast<const char*>(hdr), file.binary_blob.data(), info.hdr_bytes, staging_size);
-    int offset = compressed_size;
-    json["irradiance_offset"] = offset;
-    file.binary_blob.resize(compressed_size);
-    // Compress again, this time at offset compressed_size in the file binary blob
-    staging_size = LZ4_compressBound(info.irradiance_bytes);
-    file.binary_blob.resize(offset + staging_size);
-    int compressed_irr_size = LZ4_compress_default(reinterpret_cast<const char*>(irradiance), file.binary_blob.data() + offset, info.irradiance_bytes, staging_size);
-    file.binary_blob.resize(compressed_irr_size + offset);
-    offset += compressed_irr_size;
-    json["specular_offset"] = offset;
-    // And again for specular, but now at offset compressed_irr_size + compressed_size
-    staging_size = LZ4_compressBound(info.specular_bytes);
-    file.binary_blob.resize(offset + staging_size);
-    int compressed_specular_size = LZ4_compress_default(reinterpret_cast<const char*>(specular), file.binary_blob.data() + offset, info.specular_bytes, staging_size);
-    file.binary_blob.resize(compressed_specular_size + offset);
-
-    file.metadata_json = json.dump(0, "");
+// With SH irradiance there is no irradiance map to store
+static EnvironmentInfo stored_info(EnvironmentInfo const& info) {
+    EnvironmentInfo result = info;
+    if (info.irradiance_storage == IrradianceStorage::SH9) {
+        result.irradiance_size = 0;
+        result.irradiance_bytes = 0;
+    }
+    return result;
+}
+
+// Writes the specular table followed by every face of every mip level, smallest mip first
+static void compress_specular_faces(EnvironmentInfo const& info, void const* specular, CompressionChoice compression, std::vector<char>& blob,
+    ScratchBuffer& staging) {
+    uint32_t const faces = specular_mip_count(info) * cube_faces;
+    std::vector<SpecularTableEntry> table(faces);
+    size_t const table_offset = blob.size();
+    blob.resize(table_offset + sizeof(uint32_t) + faces * sizeof(SpecularTableEntry));
+    for (uint32_t index = faces; index-- > 0;) {
+        uint32_t const mip = index / cube_faces;
+        SpecularTableEntry& entry = table[index];
+        entry.byte_size = environment_specular_face_byte_size(info, mip);
+        entry.offset = blob.size();
+        compress_chunked(compression, reinterpret_cast<char const*>(specular) + environment_specular_face_offset(info, EnvironmentLayout{}, mip, index % cube_faces),
+            entry.byte_size, default_chunk_size, blob, staging);
+        entry.stored_size = blob.size() - entry.offset;
+    }
+    std::memcpy(blob.data() + table_offset, &faces, sizeof(uint32_t));
+    std::memcpy(blob.data() + table_offset + sizeof(uint32_t), table.data(), faces * sizeof(SpecularTableEntry));
+}
+
+// Packs the maps as they are, info.irradiance_sh is stored as given
+static void pack_environment_maps(EnvironmentInfo const& info, void const* hdr, void const* irradiance, void const* specular, AssetFile& file,
+    PackScratch& scratch) {
+    validate_sizes(info);
+    file.version = ienv_version;
+    file.type[0] = 'I'; file.type[1] = 'E'; file.type[2] = 'N'; file.type[3] = 'V';
+    // Payloads are appended, keep the capacity but not the contents of whatever file held before
+    file.binary_blob.clear();
+
+    // Compress the data pointers into the final binary blob, one chunked payload after the other
+    std::span<const char> const payloads[] = {
+        { reinterpret_cast<char const*>(hdr), info.hdr_bytes },
+        { reinterpret_cast<char const*>(irradiance), info.irradiance_bytes },
+        { reinterpret_cast<char const*>(specular), info.specular_bytes }
+    };
+    CompressionChoice const compression = resolve_compression(info.compression, info.compression_level, payloads, {}, scratch.chunks);
+    compress_chunked(compression, hdr, info.hdr_bytes, default_chunk_size, file.binary_blob, scratch.chunks);
+    uint32_t const irradiance_offset = file.binary_blob.size();
+    compress_chunked(compression, irradiance, info.irradiance_bytes, default_chunk_size, file.binary_blob, scratch.chunks);
+    uint32_t const specular_offset = file.binary_blob.size();
+    if (has_specular_table(info)) {
+        compress_specular_faces(info, specular, compression, file.binary_blob, scratch.chunks);
+    } else {
+        compress_chunked(compression, specular, info.specular_bytes, default_chunk_size, file.binary_blob, scratch.chunks);
+    }
+
+    file.metadata_json = environment_metadata(info, compression.mode, irradiance_offset, specular_offset);
+}
+
+AssetFile pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular) {
+    AssetFile file{};
+    pack_environment(info, hdr, irradiance, specular, file);
+    return file;
+}
+
+void pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular, AssetFile& file) {
+    PackScratch scratch;
+    pack_environment(info, hdr, irradiance, specular, file, scratch);
+}
+
+void pack_environment(EnvironmentInfo const& info, void* hdr, void* irradiance, void* specular, AssetFile& file, PackScratch& scratch) {
+    EnvironmentInfo packed = stored_info(info);
+    if (info.irradiance_storage == IrradianceStorage::SH9) compute_irradiance_sh9(info, hdr, packed.irradiance_sh);
+    pack_environment_maps(packed, hdr, irradiance, specular, file, scratch);
+}
+
+AssetFile pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor) {
+    AssetFile file{};
+    pack_environment(info, hdr_rgba, irradiance_rgba, specular_rgba, executor, file);
     return file;
 }
 
+void pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor, AssetFile& file) {
+    PackScratch scratch;
+    pack_environment(info, hdr_rgba, irradiance_rgba, specular_rgba, executor, file, scratch);
+}
+
+void pack_environment(EnvironmentInfo const& info, float const* hdr_rgba, float const* irradiance_rgba, float const* specular_rgba,
+    Executor const& executor, AssetFile& file, PackScratch& scratch) {
+    uint32_t const texel_size = environment_format_byte_size(info.format);
+    assert(texel_size != 0 && "Maps can only be converted to a known format");
+    EnvironmentInfo packed = stored_info(info);
+    if (info.irradiance_storage == IrradianceStorage::SH9) {
+        // From the source texels, before any precision is lost
+        EnvironmentInfo source = info;
+        source.format = EnvironmentFormat::RGBA32F;
+        source.hdr_bytes = uint64_t(info.hdr_extents[0]) * info.hdr_extents[1] * environment_format_byte_size(source.format);
+        compute_irradiance_sh9(source, hdr_rgba, packed.irradiance_sh);
+    }
+
+    auto convert = [&](float const* src, uint32_t byte_size, ScratchBuffer& scratch) {
+        char* const result = scratch.reserve(byte_size);
+        assert((result || byte_size == 0) && "Out of memory for converted maps");
+        uint64_t const texels = byte_size / texel_size;
+        run_jobs(executor, (texels + texels_per_job - 1) / texels_per_job, [&](uint32_t job) {
+            uint64_t const first = job * texels_per_job;
+            uint64_t const count = std::min(texels - first, texels_per_job);
+            convert_environment_texels(info.format, src + first * 4, count, result + first * texel_size);
+        });
+        return result;
+    };
+    char const* const hdr = convert(hdr_rgba, packed.hdr_bytes, scratch.staging[0]);
+    char const* const irradiance = convert(irradiance_rgba, packed.irradiance_bytes, scratch.staging[1]);
+    char const* const specular = convert(specular_rgba, packed.specular_bytes, scratch.staging[2]);
+    pack_environment_maps(packed, hdr, irradiance, specular, file, scratch);
+}
+
+bool EnvironmentStreamPacker::open(std::filesystem::path const& path, EnvironmentInfo const& info) {
+    this->info = stored_info(info);
+    compression = resolve_compression(info.compression, info.compression_level, {});
+    if (!writer.open(path, "IENV", ienv_version, environment_metadata(this->info, compression.mode, 0, 0))) return false;
+    begin();
+    return true;
+}
+
+void EnvironmentStreamPacker::open(plib::binary_output_stream& out, EnvironmentInfo const& info) {
+    this->info = stored_info(info);
+    compression = resolve_compression(info.compression, info.compression_level, {});
+    writer.open(out, "IENV", ienv_version);
+    begin();
+}
+
+void EnvironmentStreamPacker::begin() {
+    ok = true;
+    current = Map::Hdr;
+    irradiance_offset = 0;
+    specular_offset = 0;
+    validate_sizes(info);
+    specular_table.assign(has_specular_table(info) ? specular_mip_count(info) * cube_faces : 0, SpecularTableEntry{});
+    for (uint32_t index = 0; index < specular_table.size(); ++index) {
+        specular_table[index].byte_size = environment_specular_face_byte_size(info, index / cube_faces);
+    }
+    current_face = 0;
+    remaining_in_face = 0;
+    payload.begin(writer, compression, info.hdr_bytes);
+}
+
+void EnvironmentStreamPacker::begin_specular_face() {
+    SpecularTableEntry& entry = specular_table[current_face];
+    payload.begin(writer, compression, entry.byte_size);
+    // The specular table holds 32 bit offsets, a blob that outgrew them can't be described
+    ok = ok && payload.offset() <= std::numeric_limits<uint32_t>::max();
+    entry.offset = payload.offset();
+    remaining_in_face = entry.byte_size;
+}
+
+void EnvironmentStreamPacker::advance_to(Map map) {
+    assert(map >= current && "Environment maps must be written in order: hdr, irradiance, specular");
+    while (current < map) {
+        ok = payload.end() && ok;
+        if (current == Map::Hdr) {
+            current = Map::Irradiance;
+            // Map offsets are stored in 32 bits
+            ok = ok && writer.blob_size() <= std::numeric_limits<uint32_t>::max();
+            irradiance_offset = writer.blob_size();
+            payload.begin(writer, compression, info.irradiance_bytes);
+        } else {
+            current = Map::Specular;
+            ok = ok && writer.blob_size() <= std::numeric_limits<uint32_t>::max();
+            specular_offset = writer.blob_size();
+            if (specular_table.empty()) {
+                payload.begin(writer, compression, info.specular_bytes);
+            } else {
+                // Reserve the specular table, it's patched in finish(). Faces are stored in the order they come in, largest mip first.
+                std::vector<char> table(sizeof(uint32_t) + specular_table.size() * sizeof(SpecularTableEntry));
+                writer.append(table.data(), table.size());
+                begin_specular_face();
+            }
+        }
+    }
+}
+
+void EnvironmentStreamPacker::write_hdr(void const* data, size_t size) {
+    advance_to(Map::Hdr);
+    payload.write(data, size);
+}
+
+void EnvironmentStreamPacker::write_irradiance(void const* data, size_t size) {
+    advance_to(Map::Irradiance);
+    payload.write(data, size);
+}
+
+void EnvironmentStreamPacker::write_specular(void const* data, size_t size) {
+    advance_to(Map::Specular);
+    if (specular_table.empty()) {
+        payload.write(data, size);
+        return;
+    }
+    char const* bytes = reinterpret_cast<char const*>(data);
+    while (size > 0) {
+        if (remaining_in_face == 0) {
+            // More data than the specular mip chain holds
+            if (current_face + 1 >= specular_table.size()) {
+                ok = false;
+                return;
+            }
+            ++current_face;
+            begin_specular_face();
+        }
+        uint64_t const count = std::min<uint64_t>(size, remaining_in_face);
+        payload.write(bytes, count);
+        bytes += count;
+        size -= count;
+        remaining_in_face -= count;
+        if (remaining_in_face == 0) {
+            ok = payload.end() && payload.stored_size() <= std::numeric_limits<uint32_t>::max() && ok;
+            specular_table[current_face].stored_size = payload.stored_size();
+        }
+    }
+}
+
+bool EnvironmentStreamPacker::finish() {
+    // Also ends any map that was never written to, which fails unless it is empty
+    advance_to(Map::Specular);
+    if (specular_table.empty()) {
+        ok = payload.end() && ok;
+    } else {
+        // Every face must have been written completely
+        if (current_face + 1 != specular_table.size() || remaining_in_face != 0) ok = false;
+        uint32_t const faces = specular_table.size();
+        writer.patch(specular_offset, &faces, sizeof(uint32_t));
+        writer.patch(specular_offset + sizeof(uint32_t), specular_table.data(), faces * sizeof(SpecularTableEntry));
+    }
+    return writer.finish(environment_metadata(info, compression.mode, irradiance_offset, specular_offset)) && ok;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <assetlib/instrumentation.hpp>
+
+#include "instrumentation_scope.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace assetlib {
+
+static Instrumentation& installed_instrumentation() {
+	static Instrumentation instrumentation;
+	return instrumentation;
+}
+
+// Checked by every measuring point before touching anything else
+static std::atomic<bool> instrumentation_enabled = false;
+
+char const* load_stage_name(LoadStage stage) {
+	switch (stage) {
+	case LoadStage::FileRead: return "FileRead";
+	case LoadStage::InfoParse: return "InfoParse";
+	case LoadStage::Decompress: return "Decompress";
+	case LoadStage::Unpack: return "Unpack";
+	}
+	return "Unknown";
+}
+
+void set_instrumentation(Instrumentation instrumentation) {
+	bool const enabled = static_cast<bool>(instrumentation.on_stage);
+	installed_instrumentation() = std::move(instrumentation);
+	instrumentation_enabled = enabled;
+}
+
+bool instrumentation_available() {
+#ifdef ASSETLIB_INSTRUMENTATION
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64_t instrumentation_now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef ASSETLIB_INSTRUMENTATION
+
+// Stages currently measured on this thread, one bit per LoadStage
+thread_local uint32_t active_stages = 0;
+thread_local std::string_view current_label;
+
+StageScope::StageScope(LoadStage stage, char const* type, uint64_t bytes_in, uint64_t bytes_out) {
+	uint32_t const bit = 1u << static_cast<uint32_t>(stage);
+	if (!instrumentation_enabled.load(std::memory_order_relaxed) || (active_stages & bit)) return;
+	active = true;
+	active_stages |= bit;
+	event.stage = stage;
+	set_type(type);
+	event.bytes_in = bytes_in;
+	event.bytes_out = bytes_out;
+	event.label = current_label;
+	event.begin_ns = instrumentation_now_ns();
+}
+
+StageScope::~StageScope() {
+	if (!active) return;
+	event.end_ns = instrumentation_now_ns();
+	active_stages &= ~(1u << static_cast<uint32_t>(event.stage));
+	if (Instrumentation const& instrumentation = installed_instrumentation(); instrumentation.on_stage) instrumentation.on_stage(event);
+}
+
+void StageScope::set_type(char const* type) {
+	if (active && type) std::memcpy(event.type, type, sizeof(event.type));
+}
+
+void StageScope::set_bytes(uint64_t bytes_in, uint64_t bytes_out) {
+	event.bytes_in = bytes_in;
+	event.bytes_out = bytes_out;
+}
+
+StageLabelScope::StageLabelScope(std::filesystem::path const& path) {
+	if (!instrumentation_enabled.load(std::memory_order_relaxed)) return;
+	active = true;
+	label = path.string();
+	previous = current_label;
+	current_label = label;
+}
+
+StageLabelScope::~StageLabelScope() {
+	if (active) current_label = previous;
+}
+
+#endif
+
+uint32_t InstrumentationStats::type_index(char const* type) {
+	char const* const known[] = { "ITEX", "MESH", "IENV" };
+	for (uint32_t i = 0; type && i < 3; ++i) {
+		if (std::memcmp(type, known[i], 4) == 0) return i;
+	}
+	return type_count - 1;
+}
+
+void InstrumentationStats::record(StageEvent const& event) {
+	uint64_t const duration = event.end_ns - event.begin_ns;
+	std::lock_guard lock(mutex);
+	StageTotals& totals = stats[type_index(event.type)][static_cast<uint32_t>(event.stage)];
+	++totals.count;
+	totals.total_ns += duration;
+	totals.max_ns = std::max(totals.max_ns, duration);
+	totals.bytes_in += event.bytes_in;
+	totals.bytes_out += event.bytes_out;
+}
+
+StageTotals InstrumentationStats::totals(char const* type, LoadStage stage) const {
+	std::lock_guard lock(mutex);
+	return stats[type_index(type)][static_cast<uint32_t>(stage)];
+}
+
+void InstrumentationStats::reset() {
+	std::lock_guard lock(mutex);
+	std::fill_n(&stats[0][0], type_count * load_stage_count, StageTotals{});
+}
+
+Instrumentation InstrumentationStats::callbacks() {
+	return Instrumentation{ [this](StageEvent const& event) { record(event); } };
+}
+
+ChromeTraceWriter::ChromeTraceWriter() : start_ns(instrumentation_now_ns()) {}
+
+void ChromeTraceWriter::record(StageEvent const& event) {
+	std::thread::id const id = std::this_thread::get_id();
+	std::lock_guard lock(mutex);
+	auto thread = std::find(threads.begin(), threads.end(), id);
+	if (thread == threads.end()) thread = threads.insert(threads.end(), id);
+	events.push_back(Event{ event, std::string(event.label), static_cast<uint32_t>(thread - threads.begin()) });
+	// The string_view would dangle once the callback returns
+	events.back().event.label = {};
+}
+
+void ChromeTraceWriter::clear() {
+	std::lock_guard lock(mutex);
+	events.clear();
+}
+
+std::string ChromeTraceWriter::json() const {
+	std::lock_guard lock(mutex);
+	json::JSON trace;
+	trace["displayTimeUnit"] = "ms";
+	trace["traceEvents"] = json::Array();
+	for (Event const& recorded : events) {
+		StageEvent const& event = recorded.event;
+		json::JSON entry;
+		std::string name = load_stage_name(event.stage);
+		if (!recorded.label.empty()) name += " " + recorded.label;
+		entry["name"] = name;
+		entry["cat"] = "assetlib";
+		// Complete event, timestamps in microseconds since the writer was created
+		entry["ph"] = "X";
+		entry["ts"] = double(int64_t(event.begin_ns - start_ns)) / 1000.0;
+		entry["dur"] = double(event.end_ns - event.begin_ns) / 1000.0;
+		entry["pid"] = 1;
+		entry["tid"] = recorded.thread;
+		if (event.type[0] != 0) entry["args"]["type"] = std::string(event.type, sizeof(event.type));
+		entry["args"]["bytes_in"] = event.bytes_in;
+		entry["args"]["bytes_out"] = event.bytes_out;
+		trace["traceEvents"].append(entry);
+	}
+	return trace.dump(0, "");
+}
+
+bool ChromeTraceWriter::write(std::filesystem::path const& path) const {
+	std::ofstream out(path, std::ios::binary);
+	if (!out) return false;
+	out << json();
+	return static_cast<bool>(out);
+}
+
+Instrumentation ChromeTraceWriter::callbacks() {
+	return Instrumentation{ [this](StageEvent const& event) { record(event); } };
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <assetlib/instrumentation.hpp>
+
+namespace assetlib {
+
+#ifdef ASSETLIB_INSTRUMENTATION
+
+// Measures a stage from construction to destruction and reports it to the installed callbacks.
+// A stage nested in another one of the same kind on the same thread, such as an unpack falling back to another
+// unpack function, is only reported once by the outer scope.
+class StageScope {
+public:
+	explicit StageScope(LoadStage stage, char const* type = nullptr, uint64_t bytes_in = 0, uint64_t bytes_out = 0);
+	StageScope(StageScope const&) = delete;
+	StageScope& operator=(StageScope const&) = delete;
+	~StageScope();
+
+	// For stages that only learn these while running
+	void set_type(char const* type);
+	void set_bytes(uint64_t bytes_in, uint64_t bytes_out);
+
+private:
+	bool active = false;
+	StageEvent event;
+};
+
+// Labels every stage that runs on this thread while it exists
+class StageLabelScope {
+public:
+	explicit StageLabelScope(std::filesystem::path const& path);
+	StageLabelScope(StageLabelScope const&) = delete;
+	StageLabelScope& operator=(StageLabelScope const&) = delete;
+	~StageLabelScope();
+
+private:
+	bool active = false;
+	std::string label;
+	std::string_view previous;
+};
+
+#else
+
+class StageScope {
+public:
+	explicit StageScope(LoadStage, char const* = nullptr, uint64_t = 0, uint64_t = 0) {}
+	void set_type(char const*) {}
+	void set_bytes(uint64_t, uint64_t) {}
+};
+
+class StageLabelScope {
+public:
+	explicit StageLabelScope(std::filesystem::path const&) {}
+};
+
+#endif
+
+}
@@ -1,23 +1,97 @@
 #include <assetlib/mesh.hpp>
+#include <assetlib/compression.hpp>
+#include <assetlib/meshlet.hpp>
+#include <assetlib/quantization.hpp>
 #include <json.hpp>
 #include <lz4.h>
 
+#include "instrumentation_scope.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 namespace assetlib {
 
-//	Current mesh parser version 0.0.1 has the following required fields:
+//	Since version 2.0.0 the metadata starts with a MeshBinaryInfo block, which is all the parser reads.
+//	It is followed by the json description below, which is only kept for tools and debugging.
+//	Offsets into the binary blob such as index_binary_offset are then only stored in the binary info block,
+//	so the json can be written before the blob is complete.
+//	The json description has the following required fields. Before 2.0.0 it was what the parser read:
 //	vertex_count: unsigned integer holding the number of vertices
 //	index_count: unsigned integer holding the number of indices
 //	index_bits: either 16 or 32, indicating how large one index is. Indices are unsigned integers of this width
-//	index_binary_offset: offset in the binary blob where indices start
+//	index_binary_offset: offset in the binary blob where indices start. Only present before 2.0.0, see above.
 //	vertex_format: a string describing the vertex format. Must be one of the following
 //		- PNTV32: Position (3) - Normal (3) - Tangent (3) - UV (2), all 32-bit float
+//		Since version 2.3.0 also the compact formats, see VertexFormat:
+//		- PNTV16N: snorm16 positions, octahedral normal and tangent, half float UV
+//		- PNTV16H: half float positions, octahedral normal and tangent, half float UV
+//	position_scale, position_offset: arrays of 3 floats holding the dequantization transform of the compact formats.
+//		Only present since 2.3.0, and only for the compact formats.
+//	meshlet_count, meshlet_vertex_count, meshlet_triangle_count: size of the meshlet section.
+//		Only present since 2.4.0, and only if the mesh has meshlets.
 //	compression_mode: compression mode used when packing the asset file. Must be None or LZ4
-//	TODO: Add field for mesh boundaries
+//		Since version 2.1.0 this can also be LZ4HC or a custom codec "Custom<N>".
+//	dictionary_id: hex string with the id of the dictionary the mesh was compressed with. Only present since 2.2.0,
+//		and only if a dictionary was used.
+//	aabb_min, aabb_max, sphere_center: arrays of 3 floats, sphere_radius: float. Bounds of the mesh, only present since 2.5.0.
+//	lod_count: number of levels of detail. Only present since 2.5.0, and only if the mesh has more than one.
+//		lods: array with an object per additional level holding vertex_count, index_count, error and screen_size.
+//	Since version 1.1.0 vertices and indices are each stored as a chunked payload (see compression.hpp).
+//	Since version 2.4.0 they can be followed by a meshlet section of 3 more chunked payloads: the Meshlet array,
+//	the meshlet vertex indices and the meshlet local triangle indices (see meshlet.hpp).
+//	Since version 2.5.0 a mesh with more than one level of detail starts with a LOD table: a MeshLod entry for every
+//	level but LOD 0, located at lod_table_offset. It is followed by the vertex and index payloads of each level,
+//	coarsest first, and then by LOD 0 starting at vertex_binary_offset. Before 2.5.0 LOD 0 always started at 0.
+//	Version 1.0.0 stored both as a single LZ4 block.
+
+constexpr uint32_t mesh_chunked_version = pack_version(1, 1, 0);
+constexpr uint32_t mesh_binary_info_version = pack_version(2, 0, 0);
+// Version 2.2.0 added dictionary_id to the binary info. Older files read it as 0, which means no dictionary.
+// Version 2.3.0 added the compact vertex formats and their dequantization transform.
+// Version 2.4.0 added the meshlet section.
+// Version 2.5.0 added the bounds and levels of detail. Older files read vertex_binary_offset as 0 and lod_count as 0,
+// which is treated as a single level.
+
+// Enums are stored by value, so their values may never change.
+struct MeshBinaryInfo {
+	BinaryInfoHeader header;
+	uint32_t format = 0;
+	uint32_t compression = 0;
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	uint32_t index_bits = 0;
+	uint32_t index_binary_offset = 0;
+	uint64_t dictionary_id = 0;
+	float position_scale[3]{};
+	float position_offset[3]{};
+	uint32_t meshlet_count = 0;
+	uint32_t meshlet_vertex_count = 0;
+	uint32_t meshlet_triangle_count = 0;
+	uint32_t meshlet_binary_offset = 0;
+	uint32_t meshlet_vertices_binary_offset = 0;
+	uint32_t meshlet_triangles_binary_offset = 0;
+	float aabb_min[3]{};
+	float aabb_max[3]{};
+	float sphere_center[3]{};
+	float sphere_radius = 0.0f;
+	uint32_t lod_count = 0;
+	uint32_t lod_table_offset = 0;
+	uint32_t vertex_binary_offset = 0;
+	uint32_t padding = 0;
+};
+
+static_assert(sizeof(MeshLod) == 32, "MeshLod must not contain padding");
+static_assert(sizeof(PNTV32Vertex) == 44 && sizeof(PNTV16NVertex) == 20 && sizeof(PNTV16HVertex) == 20, "Vertex structs must not contain padding");
 
 static VertexFormat parse_vertex_format(std::string const& format) {
 	if (format == "PNTV32") return VertexFormat::PNTV32;
+	if (format == "PNTV16N") return VertexFormat::PNTV16N;
+	if (format == "PNTV16H") return VertexFormat::PNTV16H;
 	return VertexFormat::Unknown;
 }
 
@@ -25,24 +99,200 @@ static std::string format_to_string(VertexFormat format) {
 	switch (format) {
 	case VertexFormat::PNTV32:
 		return "PNTV32";
+	case VertexFormat::PNTV16N:
+		return "PNTV16N";
+	case VertexFormat::PNTV16H:
+		return "PNTV16H";
 	default:
 		return "Unknown";
 	}
 }
 
-static uint32_t vertex_byte_size(VertexFormat format) {
+uint32_t vertex_byte_size(VertexFormat format) {
 	switch (format) {
 	case VertexFormat::PNTV32:
 		// Position + Normal + Tangent + UV
 		return (3 + 3 + 3 + 2) * sizeof(float);
+	case VertexFormat::PNTV16N:
+	case VertexFormat::PNTV16H:
+		// Padded position + Normal + Tangent + UV
+		return (4 + 2 + 2 + 2) * sizeof(uint16_t);
 	default:
 		return 0;
 	}
 }
 
+static bool is_compact_format(VertexFormat format) {
+	return format == VertexFormat::PNTV16N || format == VertexFormat::PNTV16H;
+}
+
+// Quantizes a single vertex. PNTV16NVertex and PNTV16HVertex share their layout, so the position is written as raw bits.
+// inv_scale and offset hold the quantization transform in their first 3 elements, the 4th element must be 0.
+#if ASSETLIB_SSE2
+static void quantize_vertex(PNTV32Vertex const& src, VertexFormat format, __m128 inv_scale, __m128 offset, PNTV16NVertex& dst) {
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const minus_one = _mm_set1_ps(-1.0f);
+	__m128 const snorm_max = _mm_set1_ps(32767.0f);
+	__m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	// The 4th lane loads normal[0], which is cancelled out by inv_scale.
+	__m128 const position = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src.position), offset), inv_scale);
+	if (format == VertexFormat::PNTV16N) {
+		__m128 const clamped = _mm_min_ps(_mm_max_ps(position, minus_one), one);
+		__m128i const quantized = _mm_cvtps_epi32(_mm_mul_ps(clamped, snorm_max));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst.position), _mm_packs_epi32(quantized, quantized));
+	} else {
+#if ASSETLIB_F16C
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst.position), _mm_cvtps_ph(position, _MM_FROUND_TO_NEAREST_INT));
+#else
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, position);
+		for (int i = 0; i < 4; ++i) dst.position[i] = static_cast<int16_t>(float_to_half(lanes[i]));
+#endif
+	}
+
+	// Octahedral encoding of normal and tangent at once: lanes hold normal.xy and tangent.xy
+	__m128 const xy = _mm_setr_ps(src.normal[0], src.normal[1], src.tangent[0], src.tangent[1]);
+	__m128 const z = _mm_setr_ps(src.normal[2], src.normal[2], src.tangent[2], src.tangent[2]);
+	__m128 const abs_xy = _mm_and_ps(xy, abs_mask);
+	__m128 const abs_yx = _mm_shuffle_ps(abs_xy, abs_xy, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 const l1 = _mm_add_ps(_mm_add_ps(abs_xy, abs_yx), _mm_and_ps(z, abs_mask));
+	__m128 const nonzero = _mm_cmpgt_ps(l1, _mm_setzero_ps());
+	__m128 const inv_l1 = _mm_and_ps(_mm_div_ps(one, l1), nonzero);
+	__m128 const projected = _mm_mul_ps(xy, inv_l1);
+	__m128 const abs_projected_yx = _mm_mul_ps(abs_yx, inv_l1);
+	__m128 const positive = _mm_cmpge_ps(projected, _mm_setzero_ps());
+	__m128 const sign = _mm_or_ps(_mm_and_ps(positive, one), _mm_andnot_ps(positive, minus_one));
+	__m128 const folded = _mm_mul_ps(_mm_sub_ps(one, abs_projected_yx), sign);
+	__m128 const lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+	__m128 const encoded = _mm_or_ps(_mm_and_ps(lower, folded), _mm_andnot_ps(lower, projected));
+	__m128i const encoded_snorm = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(encoded, minus_one), one), snorm_max));
+	// normal and tangent are adjacent
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(dst.normal), _mm_packs_epi32(encoded_snorm, encoded_snorm));
+
+#if ASSETLIB_F16C
+	__m128i const uv = _mm_cvtps_ph(_mm_setr_ps(src.uv[0], src.uv[1], 0.0f, 0.0f), _MM_FROUND_TO_NEAREST_INT);
+	uint32_t const uv_bits = static_cast<uint32_t>(_mm_cvtsi128_si32(uv));
+	std::memcpy(dst.uv, &uv_bits, sizeof(uv_bits));
+#else
+	dst.uv[0] = float_to_half(src.uv[0]);
+	dst.uv[1] = float_to_half(src.uv[1]);
+#endif
+}
+#else
+static void quantize_vertex(PNTV32Vertex const& src, VertexFormat format, float const inv_scale[3], float const offset[3], PNTV16NVertex& dst) {
+	for (int i = 0; i < 3; ++i) {
+		float const position = (src.position[i] - offset[i]) * inv_scale[i];
+		dst.position[i] = format == VertexFormat::PNTV16N ? float_to_snorm16(position) : static_cast<int16_t>(float_to_half(position));
+	}
+	dst.position[3] = 0;
+	encode_octahedral(src.normal, dst.normal);
+	encode_octahedral(src.tangent, dst.tangent);
+	dst.uv[0] = float_to_half(src.uv[0]);
+	dst.uv[1] = float_to_half(src.uv[1]);
+}
+#endif
+
+void quantize_vertices(MeshInfo& info, PNTV32Vertex const* src, void* dst) {
+	assert(is_compact_format(info.format) && "Vertices can only be quantized to a compact format");
+
+	float min[3]{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float max[3]{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		for (int i = 0; i < 3; ++i) {
+			min[i] = std::min(min[i], src[v].position[i]);
+			max[i] = std::max(max[i], src[v].position[i]);
+		}
+	}
+
+	float inv_scale[4]{};
+	float offset[4]{};
+	for (int i = 0; i < 3; ++i) {
+		offset[i] = info.vertex_count > 0 ? (min[i] + max[i]) * 0.5f : 0.0f;
+		// snorm16 positions span the bounds, half positions only need to be centered
+		float const scale = info.format == VertexFormat::PNTV16N ? std::max((max[i] - min[i]) * 0.5f, 0.0f) : 1.0f;
+		inv_scale[i] = scale > 0.0f ? 1.0f / scale : 0.0f;
+		info.position_scale[i] = scale;
+		info.position_offset[i] = offset[i];
+	}
+
+	PNTV16NVertex* dst_vertices = reinterpret_cast<PNTV16NVertex*>(dst);
+#if ASSETLIB_SSE2
+	__m128 const inv_scale_v = _mm_loadu_ps(inv_scale);
+	__m128 const offset_v = _mm_loadu_ps(offset);
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		quantize_vertex(src[v], info.format, inv_scale_v, offset_v, dst_vertices[v]);
+	}
+#else
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		quantize_vertex(src[v], info.format, inv_scale, offset, dst_vertices[v]);
+	}
+#endif
+}
+
+void dequantize_vertices(MeshInfo const& info, void const* src, PNTV32Vertex* dst) {
+	if (info.format == VertexFormat::PNTV32) {
+		std::memcpy(dst, src, uint64_t(info.vertex_count) * sizeof(PNTV32Vertex));
+		return;
+	}
+	assert(is_compact_format(info.format) && "Unknown vertex format");
+
+	PNTV16NVertex const* src_vertices = reinterpret_cast<PNTV16NVertex const*>(src);
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		PNTV16NVertex const& vertex = src_vertices[v];
+		for (int i = 0; i < 3; ++i) {
+			float const position = info.format == VertexFormat::PNTV16N
+				? snorm16_to_float(vertex.position[i]) : half_to_float(static_cast<uint16_t>(vertex.position[i]));
+			dst[v].position[i] = position * info.position_scale[i] + info.position_offset[i];
+		}
+		decode_octahedral(vertex.normal, dst[v].normal);
+		decode_octahedral(vertex.tangent, dst[v].tangent);
+		dst[v].uv[0] = half_to_float(vertex.uv[0]);
+		dst[v].uv[1] = half_to_float(vertex.uv[1]);
+	}
+}
+
 MeshInfo read_mesh_info(AssetFile const& file) {
+	return read_mesh_info(make_view(file));
+}
+
+MeshInfo read_mesh_info(AssetFileView const& file) {
+	StageScope stage(LoadStage::InfoParse, file.type, file.metadata_json.size());
+	assert(file.version <= mesh_version && "file version mismatches parser version");
+
 	MeshInfo info{};
-	json::JSON json = json::JSON::Load(file.metadata_json);
+	if (file.version >= mesh_binary_info_version) {
+		MeshBinaryInfo binary;
+		bool const ok = read_binary_info(file, &binary, sizeof(binary));
+		assert(ok && "Missing mesh info");
+		info.format = static_cast<VertexFormat>(binary.format);
+		info.compression = static_cast<CompressionMode>(binary.compression);
+		info.vertex_count = binary.vertex_count;
+		info.index_count = binary.index_count;
+		info.index_bits = binary.index_bits;
+		info.index_binary_offset = binary.index_binary_offset;
+		info.dictionary_id = binary.dictionary_id;
+		if (is_compact_format(info.format)) {
+			std::copy_n(binary.position_scale, 3, info.position_scale);
+			std::copy_n(binary.position_offset, 3, info.position_offset);
+		}
+		info.meshlet_count = binary.meshlet_count;
+		info.meshlet_vertex_count = binary.meshlet_vertex_count;
+		info.meshlet_triangle_count = binary.meshlet_triangle_count;
+		info.meshlet_binary_offset = binary.meshlet_binary_offset;
+		info.meshlet_vertices_binary_offset = binary.meshlet_vertices_binary_offset;
+		info.meshlet_triangles_binary_offset = binary.meshlet_triangles_binary_offset;
+		std::copy_n(binary.aabb_min, 3, info.aabb_min);
+		std::copy_n(binary.aabb_max, 3, info.aabb_max);
+		std::copy_n(binary.sphere_center, 3, info.sphere_center);
+		info.sphere_radius = binary.sphere_radius;
+		info.lod_count = std::max(binary.lod_count, 1u);
+		info.lod_table_offset = binary.lod_table_offset;
+		info.vertex_binary_offset = binary.vertex_binary_offset;
+		return info;
+	}
+
+	json::JSON json = json::JSON::Load(std::string(file.metadata_json));
 
 	info.vertex_count = json["vertex_count"].ToInt();
 	info.index_count = json["index_count"].ToInt();
@@ -55,8 +305,19 @@ MeshInfo read_mesh_info(AssetFile const& file) {
 }
 
 // Unpacks raw mesh data into destination buffers
-void unpack_mesh(MeshInfo const& info, AssetFile const& file, void* dst_vertices, void* dst_indices) {
+void unpack_mesh(MeshInfo const& info, AssetFile const& file, void* dst_vertices, void* dst_indices, Executor const& executor) {
+	unpack_mesh(info, make_view(file), dst_vertices, dst_indices, executor);
+}
+
+void unpack_mesh(MeshInfo const& info, AssetFileView const& file, void* dst_vertices, void* dst_indices, Executor const& executor) {
+	StageScope stage(LoadStage::Unpack, file.type, file.binary_blob.size(),
+		uint64_t(info.vertex_count) * vertex_byte_size(info.format) + uint64_t(info.index_count) * (info.index_bits / 8));
 	uint32_t bytes_per_index = info.index_bits / 8;
+	if (file.version >= mesh_chunked_version) {
+		unpack_mesh_lod(info, file, 0, dst_vertices, dst_indices, executor);
+		return;
+	}
+
 	const char* src_vertex_pointer = file.binary_blob.data();
 	const char* src_index_pointer = file.binary_blob.data() + info.index_binary_offset;
 	if (info.compression == CompressionMode::LZ4) {
@@ -72,6 +333,52 @@ void unpack_mesh(MeshInfo const& info, AssetFile const& file, void* dst_vertices
 	}
 }
 
+MeshLod read_mesh_lod(MeshInfo const& info, AssetFileView const& file, uint32_t lod) {
+	assert(lod < info.lod_count && "Invalid level of detail");
+	MeshLod result;
+	if (lod == 0) {
+		result.vertex_count = info.vertex_count;
+		result.index_count = info.index_count;
+		result.screen_size = std::numeric_limits<float>::max();
+		result.vertex_binary_offset = info.vertex_binary_offset;
+		result.index_binary_offset = info.index_binary_offset;
+		// The meshlet section follows the indices, if there is one
+		result.index_binary_end = info.meshlet_count != 0 ? info.meshlet_binary_offset : file.binary_blob.size();
+		return result;
+	}
+	uint64_t const entry_offset = info.lod_table_offset + uint64_t(lod - 1) * sizeof(MeshLod);
+	assert(entry_offset + sizeof(MeshLod) <= file.binary_blob.size() && "Corrupted mesh data");
+	std::memcpy(&result, file.binary_blob.data() + entry_offset, sizeof(MeshLod));
+	return result;
+}
+
+uint32_t select_mesh_lod(MeshInfo const& info, AssetFileView const& file, float screen_size) {
+	uint32_t lod = 0;
+	while (lod + 1 < info.lod_count && read_mesh_lod(info, file, lod + 1).screen_size >= screen_size) {
+		++lod;
+	}
+	return lod;
+}
+
+void unpack_mesh_lod(MeshInfo const& info, AssetFile const& file, uint32_t lod, void* dst_vertices, void* dst_indices, Executor const& executor) {
+	unpack_mesh_lod(info, make_view(file), lod, dst_vertices, dst_indices, executor);
+}
+
+void unpack_mesh_lod(MeshInfo const& info, AssetFileView const& file, uint32_t lod, void* dst_vertices, void* dst_indices, Executor const& executor) {
+	assert(file.version >= mesh_chunked_version && "Levels of detail need a chunked mesh");
+	MeshLod const entry = read_mesh_lod(info, file, lod);
+	assert(entry.vertex_binary_offset <= entry.index_binary_offset && entry.index_binary_offset <= entry.index_binary_end
+		&& entry.index_binary_end <= file.binary_blob.size() && "Corrupted mesh data");
+
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	std::span<const char> const blob = file.binary_blob;
+	bool ok = decompress_chunked(info.compression, blob.subspan(entry.vertex_binary_offset, entry.index_binary_offset - entry.vertex_binary_offset),
+		dst_vertices, uint64_t(entry.vertex_count) * vertex_byte_size(info.format), executor, dictionary_data(dictionary.get()));
+	ok = ok && decompress_chunked(info.compression, blob.subspan(entry.index_binary_offset, entry.index_binary_end - entry.index_binary_offset),
+		dst_indices, uint64_t(entry.index_count) * (info.index_bits / 8), executor, dictionary_data(dictionary.get()));
+	assert(ok && "Corrupted mesh data");
+}
+
 template<typename T, typename... Us>
 bool any_of(T val, Us... others) {
 	return ((val == others) || ...);
@@ -79,56 +386,286 @@ bool any_of(T val, Us... others) {
 
 static bool validate_mesh_info(MeshInfo const& info) {
 	if (!any_of(info.index_bits, 16, 32)) return false;
-	if (!any_of(info.compression, assetlib::CompressionMode::None, assetlib::CompressionMode::LZ4)) return false;
-	if (!any_of(info.format, assetlib::VertexFormat::PNTV32)) return false;
+	if (!any_of(info.compression, assetlib::CompressionMode::None, assetlib::CompressionMode::Auto) && !find_codec(info.compression)) return false;
+	if (!any_of(info.format, assetlib::VertexFormat::PNTV32, assetlib::VertexFormat::PNTV16N, assetlib::VertexFormat::PNTV16H)) return false;
 	if (info.index_count == 0) return false;
 	if (info.vertex_count == 0) return false;
 	return true;
 }
 
+// The dictionary id is only stored if the mesh was actually compressed with it.
+static std::string mesh_metadata(MeshInfo const& info, CompressionChoice const& compression, uint32_t index_binary_offset, std::span<MeshLod const> lods = {}) {
+	uint64_t const dictionary_id = compression.mode == CompressionMode::None || compression.dictionary.empty() ? 0 : info.dictionary_id;
+	json::JSON json;
+	json["vertex_count"] = info.vertex_count;
+	json["index_count"] = info.index_count;
+	json["index_bits"] = info.index_bits;
+	json["vertex_format"] = format_to_string(info.format);
+	json["compression_mode"] = compression_to_string(compression.mode);
+	if (dictionary_id != 0) {
+		json["dictionary_id"] = format_dictionary_id(dictionary_id);
+	}
+	if (is_compact_format(info.format)) {
+		for (unsigned i = 0; i < 3; ++i) {
+			json["position_scale"][i] = info.position_scale[i];
+			json["position_offset"][i] = info.position_offset[i];
+		}
+	}
+	if (info.meshlet_count != 0) {
+		json["meshlet_count"] = info.meshlet_count;
+		json["meshlet_vertex_count"] = info.meshlet_vertex_count;
+		json["meshlet_triangle_count"] = info.meshlet_triangle_count;
+	}
+	for (unsigned i = 0; i < 3; ++i) {
+		json["aabb_min"][i] = info.aabb_min[i];
+		json["aabb_max"][i] = info.aabb_max[i];
+		json["sphere_center"][i] = info.sphere_center[i];
+	}
+	json["sphere_radius"] = info.sphere_radius;
+	if (!lods.empty()) {
+		json["lod_count"] = lods.size() + 1;
+		for (unsigned i = 0; i < lods.size(); ++i) {
+			json["lods"][i]["vertex_count"] = lods[i].vertex_count;
+			json["lods"][i]["index_count"] = lods[i].index_count;
+			json["lods"][i]["error"] = lods[i].error;
+			json["lods"][i]["screen_size"] = lods[i].screen_size;
+		}
+	}
+
+	MeshBinaryInfo binary;
+	binary.format = static_cast<uint32_t>(info.format);
+	binary.compression = static_cast<uint32_t>(compression.mode);
+	binary.vertex_count = info.vertex_count;
+	binary.index_count = info.index_count;
+	binary.index_bits = info.index_bits;
+	binary.index_binary_offset = index_binary_offset;
+	binary.dictionary_id = dictionary_id;
+	std::copy_n(info.position_scale, 3, binary.position_scale);
+	std::copy_n(info.position_offset, 3, binary.position_offset);
+	if (info.meshlet_count != 0) {
+		binary.meshlet_count = info.meshlet_count;
+		binary.meshlet_vertex_count = info.meshlet_vertex_count;
+		binary.meshlet_triangle_count = info.meshlet_triangle_count;
+		binary.meshlet_binary_offset = info.meshlet_binary_offset;
+		binary.meshlet_vertices_binary_offset = info.meshlet_vertices_binary_offset;
+		binary.meshlet_triangles_binary_offset = info.meshlet_triangles_binary_offset;
+	}
+	std::copy_n(info.aabb_min, 3, binary.aabb_min);
+	std::copy_n(info.aabb_max, 3, binary.aabb_max);
+	std::copy_n(info.sphere_center, 3, binary.sphere_center);
+	binary.sphere_radius = info.sphere_radius;
+	binary.lod_count = 1 + lods.size();
+	binary.lod_table_offset = info.lod_table_offset;
+	binary.vertex_binary_offset = info.vertex_binary_offset;
+	return make_metadata(&binary, sizeof(binary), json.dump(0, ""));
+}
+
+// Ritter's bounding sphere: start with the two points furthest apart along an axis and grow to include every point.
+// For box-like meshes the sphere around the center of the bounding box is tighter, so the smaller of the two is kept.
+static void compute_mesh_bounds(MeshInfo& info, void const* vertices) {
+	std::vector<PNTV32Vertex> decoded;
+	PNTV32Vertex const* src = reinterpret_cast<PNTV32Vertex const*>(vertices);
+	if (info.format != VertexFormat::PNTV32) {
+		decoded.resize(info.vertex_count);
+		dequantize_vertices(info, vertices, decoded.data());
+		src = decoded.data();
+	}
+
+	uint32_t min_vertex[3]{};
+	uint32_t max_vertex[3]{};
+	for (int i = 0; i < 3; ++i) {
+		info.aabb_min[i] = src[0].position[i];
+		info.aabb_max[i] = src[0].position[i];
+	}
+	for (uint32_t v = 1; v < info.vertex_count; ++v) {
+		for (int i = 0; i < 3; ++i) {
+			if (src[v].position[i] < info.aabb_min[i]) {
+				info.aabb_min[i] = src[v].position[i];
+				min_vertex[i] = v;
+			}
+			if (src[v].position[i] > info.aabb_max[i]) {
+				info.aabb_max[i] = src[v].position[i];
+				max_vertex[i] = v;
+			}
+		}
+	}
+
+	auto distance_squared = [](float const* a, float const* b) {
+		return (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]);
+	};
+	int widest_axis = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (distance_squared(src[min_vertex[i]].position, src[max_vertex[i]].position) >
+			distance_squared(src[min_vertex[widest_axis]].position, src[max_vertex[widest_axis]].position)) {
+			widest_axis = i;
+		}
+	}
+	float const* a = src[min_vertex[widest_axis]].position;
+	float const* b = src[max_vertex[widest_axis]].position;
+	float center[3]{ (a[0] + b[0]) * 0.5f, (a[1] + b[1]) * 0.5f, (a[2] + b[2]) * 0.5f };
+	float radius = std::sqrt(distance_squared(a, b)) * 0.5f;
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		float const distance = std::sqrt(distance_squared(src[v].position, center));
+		if (distance > radius) {
+			float const new_radius = (radius + distance) * 0.5f;
+			for (int i = 0; i < 3; ++i) {
+				center[i] += (src[v].position[i] - center[i]) * (new_radius - radius) / distance;
+			}
+			radius = new_radius;
+		}
+	}
+
+	float const box_center[3]{ (info.aabb_min[0] + info.aabb_max[0]) * 0.5f, (info.aabb_min[1] + info.aabb_max[1]) * 0.5f, (info.aabb_min[2] + info.aabb_max[2]) * 0.5f };
+	float box_radius_squared = 0.0f;
+	for (uint32_t v = 0; v < info.vertex_count; ++v) {
+		box_radius_squared = std::max(box_radius_squared, distance_squared(src[v].position, box_center));
+	}
+	if (std::sqrt(box_radius_squared) < radius) {
+		std::copy_n(box_center, 3, center);
+		radius = std::sqrt(box_radius_squared);
+	}
+	std::copy_n(center, 3, info.sphere_center);
+	info.sphere_radius = radius;
+}
+
 // Packs raw mesh data into a binary asset file ready to save to disk
 AssetFile pack_mesh(MeshInfo const& info, void* vertices, void* indices) {
+	return pack_mesh_lods(info, vertices, indices, {});
+}
+
+void pack_mesh(MeshInfo const& info, void* vertices, void* indices, AssetFile& file) {
+	pack_mesh_lods(info, vertices, indices, {}, file);
+}
+
+void pack_mesh(MeshInfo const& info, void* vertices, void* indices, AssetFile& file, PackScratch& scratch) {
+	pack_mesh_lods(info, vertices, indices, {}, file, scratch);
+}
+
+AssetFile pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods) {
 	AssetFile file;
+	pack_mesh_lods(info, vertices, indices, lods, file);
+	return file;
+}
+
+void pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods, AssetFile& file) {
+	PackScratch scratch;
+	pack_mesh_lods(info, vertices, indices, lods, file, scratch);
+}
+
+void pack_mesh_lods(MeshInfo const& info, void* vertices, void* indices, std::span<MeshLodData const> lods, AssetFile& file, PackScratch& scratch) {
+	file.type[0] = 'M'; file.type[1] = 'E'; file.type[2] = 'S'; file.type[3] = 'H';
 	file.version = mesh_version;
 
 	assert(validate_mesh_info(info) && "Invalid mesh description");
 
-	json::JSON json;
-	json["vertex_count"] = info.vertex_count;
-	json["index_count"] = info.index_count;
-	json["index_bits"] = info.index_bits;
-	json["vertex_format"] = format_to_string(info.format);
-	json["compression_mode"] = compression_to_string(info.compression);
+	MeshInfo packed = info;
+	packed.meshlet_count = 0;
+	packed.lod_count = 1 + lods.size();
+	compute_mesh_bounds(packed, vertices);
 
 	uint32_t const vtx_byte_size = info.vertex_count * vertex_byte_size(info.format);
 	uint32_t const idx_byte_size = info.index_count * (info.index_bits / 8);
-	if (info.compression == CompressionMode::LZ4) {
-		// Compress vertex buffer
-		uint32_t compress_working_size = LZ4_compressBound(vtx_byte_size);
-		file.binary_blob.resize(compress_working_size);
-		uint32_t compressed_vtx_size = LZ4_compress_default(reinterpret_cast<const char*>(vertices), file.binary_blob.data(), vtx_byte_size, compress_working_size);
-		// The index offset is now compressed_vtx_size bytes
-		json["index_binary_offset"] = compressed_vtx_size;
-		// Compress indices
-		compress_working_size = LZ4_compressBound(idx_byte_size);
-		file.binary_blob.resize(compressed_vtx_size + compress_working_size);
-		uint32_t compressed_idx_size = LZ4_compress_default(reinterpret_cast<const char*>(indices), file.binary_blob.data() + compressed_vtx_size, idx_byte_size, compress_working_size);
-		// Resize binary blob down to correct size
-		file.binary_blob.resize(compressed_vtx_size + compressed_idx_size);
-		file.binary_blob.shrink_to_fit();
+	std::span<const char> const payloads[] = {
+		{ reinterpret_cast<char const*>(vertices), vtx_byte_size },
+		{ reinterpret_cast<char const*>(indices), idx_byte_size }
+	};
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	CompressionChoice const compression = resolve_compression(info.compression, info.compression_level, payloads, dictionary_data(dictionary.get()), scratch.chunks);
+
+	// LOD table, then the additional levels coarsest first. Resizing drops whatever file held before.
+	std::vector<MeshLod> lod_table(lods.size());
+	packed.lod_table_offset = 0;
+	file.binary_blob.resize(lod_table.size() * sizeof(MeshLod));
+	for (size_t lod = lods.size(); lod-- > 0;) {
+		MeshLodData const& src = lods[lod];
+		assert(src.vertex_count > 0 && src.index_count > 0 && "Invalid level of detail");
+		MeshLod& entry = lod_table[lod];
+		entry.vertex_count = src.vertex_count;
+		entry.index_count = src.index_count;
+		entry.error = src.error;
+		entry.screen_size = src.screen_size;
+		entry.vertex_binary_offset = file.binary_blob.size();
+		compress_chunked(compression, src.vertices, uint64_t(src.vertex_count) * vertex_byte_size(info.format), default_chunk_size, file.binary_blob, scratch.chunks);
+		entry.index_binary_offset = file.binary_blob.size();
+		compress_chunked(compression, src.indices, uint64_t(src.index_count) * (info.index_bits / 8), default_chunk_size, file.binary_blob, scratch.chunks);
+		entry.index_binary_end = file.binary_blob.size();
 	}
-	else if (info.compression == CompressionMode::None) {
-		// No compression, just two raw memcpy() calls
-		file.binary_blob.resize(vtx_byte_size + idx_byte_size);
-		json["index_binary_offset"] = vtx_byte_size;
-		memcpy(file.binary_blob.data(), reinterpret_cast<const char*>(vertices), vtx_byte_size);
-		memcpy(file.binary_blob.data() + vtx_byte_size, reinterpret_cast<const char*>(indices), idx_byte_size);
+	if (!lod_table.empty()) {
+		std::memcpy(file.binary_blob.data(), lod_table.data(), lod_table.size() * sizeof(MeshLod));
 	}
 
-	file.metadata_json = json.dump(0, "");
+	packed.vertex_binary_offset = file.binary_blob.size();
+	compress_chunked(compression, vertices, vtx_byte_size, default_chunk_size, file.binary_blob, scratch.chunks);
+	uint32_t const index_binary_offset = file.binary_blob.size();
+	compress_chunked(compression, indices, idx_byte_size, default_chunk_size, file.binary_blob, scratch.chunks);
 
-	return file;
+	if (info.max_meshlet_vertices != 0) {
+		uint32_t const max_triangles = info.max_meshlet_triangles != 0 ? info.max_meshlet_triangles : default_meshlet_triangles;
+		MeshletData const meshlets = build_meshlets(info, vertices, indices, info.max_meshlet_vertices, max_triangles);
+		packed.meshlet_count = meshlets.meshlets.size();
+		packed.meshlet_vertex_count = meshlets.vertices.size();
+		packed.meshlet_triangle_count = meshlets.triangles.size() / 3;
+		packed.meshlet_binary_offset = file.binary_blob.size();
+		compress_chunked(compression, meshlets.meshlets.data(), meshlets.meshlets.size() * sizeof(Meshlet), default_chunk_size, file.binary_blob, scratch.chunks);
+		packed.meshlet_vertices_binary_offset = file.binary_blob.size();
+		compress_chunked(compression, meshlets.vertices.data(), meshlets.vertices.size() * sizeof(uint32_t), default_chunk_size, file.binary_blob, scratch.chunks);
+		packed.meshlet_triangles_binary_offset = file.binary_blob.size();
+		compress_chunked(compression, meshlets.triangles.data(), meshlets.triangles.size(), default_chunk_size, file.binary_blob, scratch.chunks);
+	}
+
+	file.metadata_json = mesh_metadata(packed, compression, index_binary_offset, lod_table);
 }
 
+bool MeshStreamPacker::open(std::filesystem::path const& path, MeshInfo const& info) {
+	assert(validate_mesh_info(info) && "Invalid mesh description");
+	this->info = info;
+	this->info.meshlet_count = 0;
+	this->info.vertex_binary_offset = 0;
+	this->info.lod_table_offset = 0;
+	dictionary = require_dictionary(info.dictionary_id);
+	compression = resolve_compression(info.compression, info.compression_level, {}, dictionary_data(dictionary.get()));
+	if (!writer.open(path, "MESH", mesh_version, mesh_metadata(this->info, compression, 0))) return false;
+	begin_vertices();
+	return true;
+}
+
+void MeshStreamPacker::open(plib::binary_output_stream& out, MeshInfo const& info) {
+	assert(validate_mesh_info(info) && "Invalid mesh description");
+	this->info = info;
+	this->info.meshlet_count = 0;
+	this->info.vertex_binary_offset = 0;
+	this->info.lod_table_offset = 0;
+	dictionary = require_dictionary(info.dictionary_id);
+	compression = resolve_compression(info.compression, info.compression_level, {}, dictionary_data(dictionary.get()));
+	writer.open(out, "MESH", mesh_version);
+	begin_vertices();
+}
+
+void MeshStreamPacker::begin_vertices() {
+	ok = true;
+	writing_indices = false;
+	payload.begin(writer, compression, uint64_t(info.vertex_count) * vertex_byte_size(info.format));
+}
+
+void MeshStreamPacker::write_vertices(void const* data, size_t size) {
+	assert(!writing_indices && "All vertices must be written before the first index");
+	payload.write(data, size);
+}
+
+void MeshStreamPacker::write_indices(void const* data, size_t size) {
+	if (!writing_indices) {
+		// The index offset is stored in 32 bits
+		ok = payload.end() && writer.blob_size() <= std::numeric_limits<uint32_t>::max() && ok;
+		index_binary_offset = writer.blob_size();
+		payload.begin(writer, compression, uint64_t(info.index_count) * (info.index_bits / 8));
+		writing_indices = true;
+	}
+	payload.write(data, size);
+}
+
+bool MeshStreamPacker::finish() {
+	ok = writing_indices && payload.end() && ok;
+	return writer.finish(mesh_metadata(info, compression, index_binary_offset)) && ok;
+}
 
 }
\ No newline at end of file
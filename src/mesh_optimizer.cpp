@@ -0,0 +1,273 @@
+#include <assetlib/mesh_optimizer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace assetlib {
+
+VertexCacheStatistics analyze_vertex_cache(std::span<const uint32_t> indices, uint32_t vertex_count, uint32_t cache_size) {
+	VertexCacheStatistics result;
+	if (indices.empty()) return result;
+
+	// A vertex is in the cache if it was added less than cache_size misses ago.
+	std::vector<uint32_t> added_at(vertex_count, 0);
+	std::vector<bool> referenced(vertex_count, false);
+	uint32_t referenced_count = 0;
+	uint32_t time = cache_size + 1;
+	for (uint32_t index : indices) {
+		assert(index < vertex_count && "Index out of range");
+		if (time - added_at[index] > cache_size) {
+			added_at[index] = time++;
+			result.vertices_transformed += 1;
+		}
+		if (!referenced[index]) {
+			referenced[index] = true;
+			referenced_count += 1;
+		}
+	}
+	result.acmr = float(result.vertices_transformed) / float(indices.size() / 3);
+	result.atvr = float(result.vertices_transformed) / float(referenced_count);
+	return result;
+}
+
+// Tipsify, from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab, Barczak 2007).
+// Triangles are emitted by fanning around a vertex, then moving on to a vertex among the ones just emitted
+// that will still be in the cache once its remaining triangles are emitted.
+void optimize_vertex_cache(std::span<uint32_t> indices, uint32_t vertex_count, uint32_t cache_size, std::vector<uint32_t>* clusters) {
+	uint32_t const triangle_count = indices.size() / 3;
+	if (clusters) clusters->clear();
+	if (triangle_count == 0) return;
+
+	// Triangles using each vertex, as offsets into a single array
+	std::vector<uint32_t> live(vertex_count, 0);
+	for (uint32_t index : indices) {
+		assert(index < vertex_count && "Index out of range");
+		live[index] += 1;
+	}
+	std::vector<uint32_t> adjacency_offset(vertex_count + 1, 0);
+	std::partial_sum(live.begin(), live.end(), adjacency_offset.begin() + 1);
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+	for (uint32_t i = 0; i < indices.size(); ++i) {
+		adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	std::vector<uint32_t> added_at(vertex_count, 0);
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	uint32_t time = cache_size + 1;
+	uint32_t cursor = 0;
+
+	// Returns the next vertex with triangles left in input order, or vertex_count if there is none.
+	auto skip_dead_end = [&]() -> uint32_t {
+		while (!dead_end.empty()) {
+			uint32_t const vertex = dead_end.back();
+			dead_end.pop_back();
+			if (live[vertex] > 0) return vertex;
+		}
+		while (cursor < vertex_count && live[cursor] == 0) ++cursor;
+		return cursor;
+	};
+
+	uint32_t fanning = skip_dead_end();
+	if (clusters) clusters->push_back(0);
+	while (fanning < vertex_count) {
+		candidates.clear();
+		for (uint32_t a = adjacency_offset[fanning]; a < adjacency_offset[fanning + 1]; ++a) {
+			uint32_t const triangle = adjacency[a];
+			if (emitted[triangle]) continue;
+			for (uint32_t corner = 0; corner < 3; ++corner) {
+				uint32_t const vertex = indices[triangle * 3 + corner];
+				output.push_back(vertex);
+				dead_end.push_back(vertex);
+				candidates.push_back(vertex);
+				live[vertex] -= 1;
+				if (time - added_at[vertex] > cache_size) {
+					added_at[vertex] = time++;
+				}
+			}
+			emitted[triangle] = true;
+		}
+
+		// Pick the candidate that is the oldest in the cache while still staying in it after fanning around it
+		uint32_t next = vertex_count;
+		int64_t best_priority = -1;
+		for (uint32_t vertex : candidates) {
+			if (live[vertex] == 0) continue;
+			int64_t priority = 0;
+			if (time - added_at[vertex] + 2 * live[vertex] <= cache_size) {
+				priority = time - added_at[vertex];
+			}
+			if (priority > best_priority) {
+				best_priority = priority;
+				next = vertex;
+			}
+		}
+		if (next == vertex_count) {
+			next = skip_dead_end();
+			// Locality is lost, which is where a new cluster starts
+			if (clusters && next < vertex_count) clusters->push_back(output.size() / 3);
+		}
+		fanning = next;
+	}
+
+	assert(output.size() == indices.size() && "Not all triangles were emitted");
+	std::copy(output.begin(), output.end(), indices.begin());
+}
+
+// Sorts clusters by how much they face away from the center of the mesh. Drawing outward facing clusters first means
+// they occlude the others from most view directions.
+void optimize_overdraw(std::span<uint32_t> indices, std::span<const uint32_t> clusters, float const* positions, uint32_t stride,
+	uint32_t vertex_count, uint32_t cache_size, float threshold) {
+	uint32_t const triangle_count = indices.size() / 3;
+	if (clusters.size() < 2) return;
+
+	auto position = [&](uint32_t vertex) {
+		return reinterpret_cast<float const*>(reinterpret_cast<char const*>(positions) + uint64_t(vertex) * stride);
+	};
+
+	struct Cluster {
+		uint32_t begin = 0;
+		uint32_t end = 0;
+		float centroid[3]{};
+		float normal[3]{};
+		float area = 0.0f;
+		float sort_key = 0.0f;
+	};
+	std::vector<Cluster> sorted(clusters.size());
+	float mesh_centroid[3]{};
+	float mesh_area = 0.0f;
+	for (uint32_t c = 0; c < clusters.size(); ++c) {
+		Cluster& cluster = sorted[c];
+		cluster.begin = clusters[c];
+		cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+		for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+			float const* p0 = position(indices[t * 3 + 0]);
+			float const* p1 = position(indices[t * 3 + 1]);
+			float const* p2 = position(indices[t * 3 + 2]);
+			float const e1[3]{ p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float const e2[3]{ p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			// Twice the area weighted normal
+			float const n[3]{ e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float const area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int i = 0; i < 3; ++i) {
+				cluster.centroid[i] += (p0[i] + p1[i] + p2[i]) / 3.0f * area;
+				cluster.normal[i] += n[i];
+			}
+			cluster.area += area;
+		}
+		for (int i = 0; i < 3; ++i) mesh_centroid[i] += cluster.centroid[i];
+		mesh_area += cluster.area;
+	}
+	if (mesh_area <= 0.0f) return;
+	for (int i = 0; i < 3; ++i) mesh_centroid[i] /= mesh_area;
+
+	for (Cluster& cluster : sorted) {
+		if (cluster.area <= 0.0f) continue;
+		float const normal_length = std::sqrt(cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+		if (normal_length <= 0.0f) continue;
+		for (int i = 0; i < 3; ++i) {
+			cluster.sort_key += (cluster.centroid[i] / cluster.area - mesh_centroid[i]) * cluster.normal[i] / normal_length;
+		}
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const& lhs, Cluster const& rhs) {
+		return lhs.sort_key > rhs.sort_key;
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (Cluster const& cluster : sorted) {
+		output.insert(output.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+	}
+
+	// Every cluster boundary can cost a few cache misses, only keep the new order if that stays within the threshold
+	float const acmr_before = analyze_vertex_cache(indices, vertex_count, cache_size).acmr;
+	float const acmr_after = analyze_vertex_cache(output, vertex_count, cache_size).acmr;
+	if (acmr_after <= acmr_before * threshold) {
+		std::copy(output.begin(), output.end(), indices.begin());
+	}
+}
+
+uint32_t optimize_vertex_fetch(std::span<uint32_t> indices, void* vertices, uint32_t vertex_count, uint32_t vertex_size) {
+	constexpr uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(vertex_count, unused);
+	uint32_t used_count = 0;
+	for (uint32_t& index : indices) {
+		assert(index < vertex_count && "Index out of range");
+		if (remap[index] == unused) {
+			remap[index] = used_count++;
+		}
+		index = remap[index];
+	}
+
+	char* vertex_bytes = reinterpret_cast<char*>(vertices);
+	std::vector<char> reordered(uint64_t(used_count) * vertex_size);
+	for (uint32_t vertex = 0; vertex < vertex_count; ++vertex) {
+		if (remap[vertex] == unused) continue;
+		std::memcpy(reordered.data() + uint64_t(remap[vertex]) * vertex_size, vertex_bytes + uint64_t(vertex) * vertex_size, vertex_size);
+	}
+	std::memcpy(vertices, reordered.data(), reordered.size());
+	return used_count;
+}
+
+MeshOptimizeReport optimize_mesh(MeshInfo& info, void* vertices, void* indices, MeshOptimizeSettings const& settings) {
+	assert((info.index_bits == 16 || info.index_bits == 32) && "Invalid index size");
+
+	// The optimizations work on 32-bit indices
+	std::vector<uint32_t> indices32(info.index_count);
+	if (info.index_bits == 16) {
+		uint16_t const* src = reinterpret_cast<uint16_t const*>(indices);
+		std::copy(src, src + info.index_count, indices32.begin());
+	} else {
+		std::memcpy(indices32.data(), indices, indices32.size() * sizeof(uint32_t));
+	}
+
+	MeshOptimizeReport report;
+	report.before = analyze_vertex_cache(indices32, info.vertex_count, settings.cache_size);
+
+	if (settings.optimize_vertex_cache) {
+		std::vector<uint32_t> clusters;
+		optimize_vertex_cache(indices32, info.vertex_count, settings.cache_size, settings.optimize_overdraw ? &clusters : nullptr);
+		if (settings.optimize_overdraw) {
+			if (info.format == VertexFormat::PNTV32) {
+				optimize_overdraw(indices32, clusters, reinterpret_cast<PNTV32Vertex const*>(vertices)->position, sizeof(PNTV32Vertex),
+					info.vertex_count, settings.cache_size, settings.overdraw_threshold);
+			} else {
+				std::vector<PNTV32Vertex> decoded(info.vertex_count);
+				dequantize_vertices(info, vertices, decoded.data());
+				optimize_overdraw(indices32, clusters, decoded.data()->position, sizeof(PNTV32Vertex),
+					info.vertex_count, settings.cache_size, settings.overdraw_threshold);
+			}
+		}
+	}
+
+	if (settings.optimize_vertex_fetch) {
+		uint32_t const used_count = optimize_vertex_fetch(indices32, vertices, info.vertex_count, vertex_byte_size(info.format));
+		report.removed_vertices = info.vertex_count - used_count;
+		info.vertex_count = used_count;
+	}
+
+	report.after = analyze_vertex_cache(indices32, info.vertex_count, settings.cache_size);
+
+	if (info.index_bits == 16) {
+		std::copy(indices32.begin(), indices32.end(), reinterpret_cast<uint16_t*>(indices));
+	} else {
+		std::memcpy(indices, indices32.data(), indices32.size() * sizeof(uint32_t));
+	}
+	return report;
+}
+
+AssetFile pack_mesh(MeshInfo const& info, void* vertices, void* indices, MeshOptimizeSettings const& settings, MeshOptimizeReport* report) {
+	MeshInfo optimized = info;
+	MeshOptimizeReport const result = optimize_mesh(optimized, vertices, indices, settings);
+	if (report) *report = result;
+	return pack_mesh(optimized, vertices, indices);
+}
+
+}
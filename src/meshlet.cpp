@@ -0,0 +1,170 @@
+#include <assetlib/meshlet.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace assetlib {
+
+static_assert(sizeof(Meshlet) == 64, "Meshlet must not contain padding");
+
+// Cones wider than this are not worth testing, see meshoptimizer's meshopt_computeClusterBounds for the derivation.
+constexpr float min_cone_dot = 0.1f;
+
+static void compute_meshlet_bounds(Meshlet& meshlet, PNTV32Vertex const* vertices, uint32_t const* meshlet_vertices, uint8_t const* meshlet_triangles) {
+	uint32_t const* local_vertices = meshlet_vertices + meshlet.vertex_offset;
+	uint8_t const* local_triangles = meshlet_triangles + uint64_t(meshlet.triangle_offset) * 3;
+
+	// Sphere around the center of the bounding box
+	float min[3]{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float max[3]{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+	for (uint32_t v = 0; v < meshlet.vertex_count; ++v) {
+		float const* position = vertices[local_vertices[v]].position;
+		for (int i = 0; i < 3; ++i) {
+			min[i] = std::min(min[i], position[i]);
+			max[i] = std::max(max[i], position[i]);
+		}
+	}
+	for (int i = 0; i < 3; ++i) meshlet.center[i] = (min[i] + max[i]) * 0.5f;
+	float radius_squared = 0.0f;
+	for (uint32_t v = 0; v < meshlet.vertex_count; ++v) {
+		float const* position = vertices[local_vertices[v]].position;
+		float const d[3]{ position[0] - meshlet.center[0], position[1] - meshlet.center[1], position[2] - meshlet.center[2] };
+		radius_squared = std::max(radius_squared, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	meshlet.radius = std::sqrt(radius_squared);
+
+	// Normal cone around the average triangle normal
+	std::vector<float> normals;
+	normals.reserve(meshlet.triangle_count * 3);
+	float axis[3]{};
+	for (uint32_t t = 0; t < meshlet.triangle_count; ++t) {
+		float const* p0 = vertices[local_vertices[local_triangles[t * 3 + 0]]].position;
+		float const* p1 = vertices[local_vertices[local_triangles[t * 3 + 1]]].position;
+		float const* p2 = vertices[local_vertices[local_triangles[t * 3 + 2]]].position;
+		float const e1[3]{ p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float const e2[3]{ p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float n[3]{ e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		float const length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		// Degenerate triangles are never visible, so they don't constrain the cone
+		if (length == 0.0f) continue;
+		for (int i = 0; i < 3; ++i) {
+			n[i] /= length;
+			axis[i] += n[i];
+		}
+		normals.insert(normals.end(), { n[0], n[1], n[2], p0[0], p0[1], p0[2] });
+	}
+
+	float const axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	if (normals.empty() || axis_length == 0.0f) return;
+	for (int i = 0; i < 3; ++i) axis[i] /= axis_length;
+
+	float min_dot = 1.0f;
+	for (size_t n = 0; n < normals.size(); n += 6) {
+		min_dot = std::min(min_dot, normals[n] * axis[0] + normals[n + 1] * axis[1] + normals[n + 2] * axis[2]);
+	}
+	if (min_dot <= min_cone_dot) return;
+
+	// Move the apex back along the axis until it lies behind the plane of every triangle
+	float max_t = 0.0f;
+	for (size_t n = 0; n < normals.size(); n += 6) {
+		float const* normal = &normals[n];
+		float const* p0 = &normals[n + 3];
+		float const dc = (meshlet.center[0] - p0[0]) * normal[0] + (meshlet.center[1] - p0[1]) * normal[1] + (meshlet.center[2] - p0[2]) * normal[2];
+		float const dn = axis[0] * normal[0] + axis[1] * normal[1] + axis[2] * normal[2];
+		max_t = std::max(max_t, dc / dn);
+	}
+	for (int i = 0; i < 3; ++i) {
+		meshlet.cone_axis[i] = axis[i];
+		meshlet.cone_apex[i] = meshlet.center[i] - axis[i] * max_t;
+	}
+	meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+MeshletData build_meshlets(MeshInfo const& info, void const* vertices, void const* indices, uint32_t max_vertices, uint32_t max_triangles) {
+	assert(max_vertices >= 3 && max_vertices <= max_meshlet_vertices && max_triangles >= 1 && "Invalid meshlet limits");
+	assert((info.index_bits == 16 || info.index_bits == 32) && "Invalid index size");
+
+	auto index = [&](uint32_t i) -> uint32_t {
+		if (info.index_bits == 16) return reinterpret_cast<uint16_t const*>(indices)[i];
+		return reinterpret_cast<uint32_t const*>(indices)[i];
+	};
+
+	MeshletData result;
+	// Local index + 1 of every vertex in the current meshlet, 0 if it is not in it
+	std::vector<uint8_t> local_index(info.vertex_count, 0);
+	Meshlet current;
+
+	auto finish_meshlet = [&]() {
+		if (current.triangle_count == 0) return;
+		for (uint32_t v = current.vertex_offset; v < result.vertices.size(); ++v) {
+			local_index[result.vertices[v]] = 0;
+		}
+		result.meshlets.push_back(current);
+		current = Meshlet{};
+		current.vertex_offset = result.vertices.size();
+		current.triangle_offset = result.triangles.size() / 3;
+	};
+
+	for (uint32_t t = 0; t + 2 < info.index_count; t += 3) {
+		uint32_t const triangle[3]{ index(t), index(t + 1), index(t + 2) };
+		uint32_t new_vertices = 0;
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			assert(triangle[corner] < info.vertex_count && "Index out of range");
+			bool const repeated = (corner > 0 && triangle[corner] == triangle[0]) || (corner > 1 && triangle[corner] == triangle[1]);
+			if (local_index[triangle[corner]] == 0 && !repeated) new_vertices += 1;
+		}
+		if (current.vertex_count + new_vertices > max_vertices || current.triangle_count + 1 > max_triangles) {
+			finish_meshlet();
+		}
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			uint8_t& local = local_index[triangle[corner]];
+			if (local == 0) {
+				result.vertices.push_back(triangle[corner]);
+				local = static_cast<uint8_t>(++current.vertex_count);
+			}
+			result.triangles.push_back(local - 1);
+		}
+		current.triangle_count += 1;
+	}
+	finish_meshlet();
+
+	// Bounds need float positions
+	std::vector<PNTV32Vertex> decoded;
+	PNTV32Vertex const* positions = reinterpret_cast<PNTV32Vertex const*>(vertices);
+	if (info.format != VertexFormat::PNTV32) {
+		decoded.resize(info.vertex_count);
+		dequantize_vertices(info, vertices, decoded.data());
+		positions = decoded.data();
+	}
+	for (Meshlet& meshlet : result.meshlets) {
+		compute_meshlet_bounds(meshlet, positions, result.vertices.data(), result.triangles.data());
+	}
+	return result;
+}
+
+void unpack_meshlets(MeshInfo const& info, AssetFile const& file, Meshlet* dst_meshlets, uint32_t* dst_vertices, uint8_t* dst_triangles,
+	Executor const& executor) {
+	unpack_meshlets(info, make_view(file), dst_meshlets, dst_vertices, dst_triangles, executor);
+}
+
+void unpack_meshlets(MeshInfo const& info, AssetFileView const& file, Meshlet* dst_meshlets, uint32_t* dst_vertices, uint8_t* dst_triangles,
+	Executor const& executor) {
+	if (info.meshlet_count == 0) return;
+	assert(info.meshlet_binary_offset <= info.meshlet_vertices_binary_offset && info.meshlet_vertices_binary_offset <= info.meshlet_triangles_binary_offset
+		&& info.meshlet_triangles_binary_offset <= file.binary_blob.size() && "Corrupted mesh data");
+
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	std::span<const char> const blob = file.binary_blob;
+	bool ok = decompress_chunked(info.compression, blob.subspan(info.meshlet_binary_offset, info.meshlet_vertices_binary_offset - info.meshlet_binary_offset),
+		dst_meshlets, uint64_t(info.meshlet_count) * sizeof(Meshlet), executor, dictionary_data(dictionary.get()));
+	ok = ok && decompress_chunked(info.compression, blob.subspan(info.meshlet_vertices_binary_offset, info.meshlet_triangles_binary_offset - info.meshlet_vertices_binary_offset),
+		dst_vertices, uint64_t(info.meshlet_vertex_count) * sizeof(uint32_t), executor, dictionary_data(dictionary.get()));
+	ok = ok && decompress_chunked(info.compression, blob.subspan(info.meshlet_triangles_binary_offset),
+		dst_triangles, uint64_t(info.meshlet_triangle_count) * 3, executor, dictionary_data(dictionary.get()));
+	assert(ok && "Corrupted mesh data");
+}
+
+}
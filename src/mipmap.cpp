@@ -0,0 +1,226 @@
+#include <assetlib/mipmap.hpp>
+#include <assetlib/quantization.hpp>
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace assetlib {
+
+// Filtered texels are kept as 4 floats regardless of the format, so every kernel can work on a whole texel at once.
+constexpr uint32_t row_channels = 4;
+// Destination rows per job, so small rows don't drown in scheduling overhead
+constexpr uint32_t rows_per_job = 8;
+// Resolution of the table converting linear values back to sRGB. Fine enough that rounding matches the exact
+// conversion everywhere except right at the rounding boundaries.
+constexpr uint32_t linear_table_size = 65536;
+
+struct ConversionTables {
+	// 8-bit value to [0, 1], for linear and sRGB channels
+	float unorm_to_float[256];
+	float srgb_to_float[256];
+	uint8_t linear_to_srgb8[linear_table_size];
+
+	ConversionTables() {
+		for (uint32_t i = 0; i < 256; ++i) {
+			unorm_to_float[i] = float(i) / 255.0f;
+			srgb_to_float[i] = srgb_to_linear(float(i) / 255.0f);
+		}
+		for (uint32_t i = 0; i < linear_table_size; ++i) {
+			linear_to_srgb8[i] = static_cast<uint8_t>(std::lrint(linear_to_srgb(float(i) / float(linear_table_size - 1)) * 255.0f));
+		}
+	}
+};
+
+static ConversionTables const& conversion_tables() {
+	static ConversionTables const tables;
+	return tables;
+}
+
+// Source texels contributing to every destination texel along one axis, with normalized weights.
+struct FilterTaps {
+	// Taps of destination texel i are [offsets[i], offsets[i + 1])
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> indices;
+	std::vector<float> weights;
+};
+
+static double sinc(double x) {
+	if (x == 0.0) return 1.0;
+	x *= std::numbers::pi;
+	return std::sin(x) / x;
+}
+
+// Modified Bessel function of the first kind, order 0
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+static FilterTaps compute_taps(uint32_t src_size, uint32_t dst_size, MipSettings const& settings) {
+	FilterTaps taps;
+	taps.offsets.push_back(0);
+	double const scale = double(src_size) / double(dst_size);
+	for (uint32_t x = 0; x < dst_size; ++x) {
+		uint32_t const first = taps.indices.size();
+		if (settings.filter == MipFilter::Box) {
+			// Overlap of every source texel with the footprint of the destination texel
+			double const begin = x * scale;
+			double const end = (x + 1) * scale;
+			for (int64_t i = int64_t(std::floor(begin)); i < int64_t(std::ceil(end)); ++i) {
+				double const overlap = std::min(end, double(i + 1)) - std::max(begin, double(i));
+				if (overlap <= 0.0) continue;
+				taps.indices.push_back(std::min(uint32_t(i), src_size - 1));
+				taps.weights.push_back(float(overlap));
+			}
+		} else {
+			// Sampled at source texel centers, with the cutoff at the destination resolution
+			double const center = (x + 0.5) * scale;
+			double const radius = settings.kaiser_width * scale;
+			double const window_scale = 1.0 / bessel_i0(settings.kaiser_alpha);
+			for (int64_t i = int64_t(std::floor(center - radius)); i <= int64_t(std::ceil(center + radius)); ++i) {
+				double const u = (i + 0.5 - center) / scale;
+				double const r = u / settings.kaiser_width;
+				if (r <= -1.0 || r >= 1.0) continue;
+				double const weight = sinc(u) * bessel_i0(settings.kaiser_alpha * std::sqrt(1.0 - r * r)) * window_scale;
+				taps.indices.push_back(uint32_t(std::clamp<int64_t>(i, 0, src_size - 1)));
+				taps.weights.push_back(float(weight));
+			}
+		}
+
+		float sum = 0.0f;
+		for (uint32_t t = first; t < taps.indices.size(); ++t) sum += taps.weights[t];
+		if (sum == 0.0f) {
+			// Only possible for a degenerate window, fall back to the nearest texel
+			taps.indices.resize(first);
+			taps.weights.resize(first);
+			taps.indices.push_back(std::min(uint32_t((x + 0.5) * scale), src_size - 1));
+			taps.weights.push_back(1.0f);
+			sum = 1.0f;
+		}
+		for (uint32_t t = first; t < taps.indices.size(); ++t) taps.weights[t] /= sum;
+		taps.offsets.push_back(taps.indices.size());
+	}
+	return taps;
+}
+
+// Converts a row of 8-bit texels to linear floats, 4 per texel.
+static void load_row(uint8_t const* src, uint32_t width, uint32_t channels, float const* const* tables, float* dst) {
+	for (uint32_t x = 0; x < width; ++x) {
+		for (uint32_t c = 0; c < channels; ++c) {
+			dst[x * row_channels + c] = tables[c][src[x * channels + c]];
+		}
+	}
+}
+
+// dst += weight * src
+static void accumulate_row(float* dst, float const* src, float weight, uint32_t count) {
+	uint32_t i = 0;
+#ifdef ASSETLIB_SSE2
+	__m128 const w = _mm_set1_ps(weight);
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(w, _mm_loadu_ps(src + i))));
+	}
+#endif
+	for (; i < count; ++i) dst[i] += weight * src[i];
+}
+
+static void store_texel(float const* texel, uint32_t channels, uint32_t srgb_channels, uint8_t* dst) {
+	ConversionTables const& tables = conversion_tables();
+	int32_t unorm[4];
+	int32_t table_index[4];
+#ifdef ASSETLIB_SSE2
+	__m128 const value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(texel), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(unorm), _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(255.0f))));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(table_index), _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(float(linear_table_size - 1)))));
+#else
+	for (uint32_t c = 0; c < 4; ++c) {
+		float const value = std::min(std::max(texel[c], 0.0f), 1.0f);
+		unorm[c] = int32_t(std::lrint(value * 255.0f));
+		table_index[c] = int32_t(std::lrint(value * float(linear_table_size - 1)));
+	}
+#endif
+	for (uint32_t c = 0; c < channels; ++c) {
+		dst[c] = c < srgb_channels ? tables.linear_to_srgb8[table_index[c]] : static_cast<uint8_t>(unorm[c]);
+	}
+}
+
+void downsample_image(TextureFormat format, ColorSpace colorspace, void const* src, uint32_t src_width, uint32_t src_height,
+	void* dst, uint32_t dst_width, uint32_t dst_height, MipSettings const& settings, Executor const& executor) {
+	assert(!is_block_compressed(format) && texture_format_byte_size(format) != 0 && "Mips can only be generated for uncompressed formats");
+
+	uint32_t const channels = texture_format_byte_size(format);
+	// Alpha is the 4th channel, every other channel holds color
+	uint32_t const srgb_channels = colorspace == ColorSpace::sRGB ? std::min(channels, 3u) : 0;
+	ConversionTables const& tables = conversion_tables();
+	float const* channel_tables[4];
+	for (uint32_t c = 0; c < 4; ++c) {
+		channel_tables[c] = c < srgb_channels ? tables.srgb_to_float : tables.unorm_to_float;
+	}
+
+	FilterTaps const taps_x = compute_taps(src_width, dst_width, settings);
+	FilterTaps const taps_y = compute_taps(src_height, dst_height, settings);
+	uint8_t const* src_bytes = reinterpret_cast<uint8_t const*>(src);
+	uint8_t* dst_bytes = reinterpret_cast<uint8_t*>(dst);
+	uint64_t const src_pitch = uint64_t(src_width) * channels;
+	uint64_t const dst_pitch = uint64_t(dst_width) * channels;
+
+	run_jobs(executor, (dst_height + rows_per_job - 1) / rows_per_job, [&](uint32_t job) {
+		std::vector<float> source_row(uint64_t(src_width) * row_channels, 0.0f);
+		std::vector<float> filtered_row(uint64_t(src_width) * row_channels);
+		uint32_t const last_row = std::min((job + 1) * rows_per_job, dst_height);
+		for (uint32_t y = job * rows_per_job; y < last_row; ++y) {
+			// Vertical pass over whole source rows, then horizontal pass over the filtered row
+			std::fill(filtered_row.begin(), filtered_row.end(), 0.0f);
+			for (uint32_t t = taps_y.offsets[y]; t < taps_y.offsets[y + 1]; ++t) {
+				load_row(src_bytes + taps_y.indices[t] * src_pitch, src_width, channels, channel_tables, source_row.data());
+				accumulate_row(filtered_row.data(), source_row.data(), taps_y.weights[t], filtered_row.size());
+			}
+
+			uint8_t* dst_row = dst_bytes + y * dst_pitch;
+			for (uint32_t x = 0; x < dst_width; ++x) {
+				alignas(16) float texel[row_channels]{};
+				for (uint32_t t = taps_x.offsets[x]; t < taps_x.offsets[x + 1]; ++t) {
+					accumulate_row(texel, filtered_row.data() + uint64_t(taps_x.indices[t]) * row_channels, taps_x.weights[t], row_channels);
+				}
+				store_texel(texel, channels, srgb_channels, dst_row + uint64_t(x) * channels);
+			}
+		}
+	});
+}
+
+std::vector<char> generate_mips(TextureInfo& info, void const* pixel_data, MipSettings const& settings, Executor const& executor) {
+	TextureInfo result_info = info;
+	uint32_t const max_mips = texture_max_mip_levels(info);
+	result_info.mip_levels = settings.mip_levels == 0 ? max_mips : std::min(settings.mip_levels, max_mips);
+	result_info.byte_size = texture_mip_byte_offset(result_info, result_info.mip_levels);
+
+	std::vector<char> result(result_info.byte_size);
+	std::memcpy(result.data(), pixel_data, texture_mip_byte_size(result_info, 0));
+	for (uint32_t mip = 1; mip < result_info.mip_levels; ++mip) {
+		downsample_image(info.format, info.colorspace, result.data() + texture_mip_byte_offset(result_info, mip - 1),
+			std::max(info.extents[0] >> (mip - 1), 1u), std::max(info.extents[1] >> (mip - 1), 1u),
+			result.data() + texture_mip_byte_offset(result_info, mip),
+			std::max(info.extents[0] >> mip, 1u), std::max(info.extents[1] >> mip, 1u), settings, executor);
+	}
+	info = result_info;
+	return result;
+}
+
+AssetFile pack_texture(TextureInfo const& info, void* pixel_data, MipSettings const& settings, Executor const& executor) {
+	TextureInfo result_info = info;
+	std::vector<char> pixels = generate_mips(result_info, pixel_data, settings, executor);
+	return pack_texture(result_info, pixels.data());
+}
+
+}
@@ -0,0 +1,164 @@
+#include <assetlib/quantization.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace assetlib {
+
+uint16_t float_to_half(float value) {
+	uint32_t bits = std::bit_cast<uint32_t>(value);
+	uint32_t const sign = (bits >> 16) & 0x8000;
+	bits &= 0x7FFFFFFF;
+
+	// Infinity and NaN, NaN stays quiet
+	if (bits >= 0x7F800000) return sign | 0x7C00 | (bits > 0x7F800000 ? 0x200 : 0);
+	// Too large, becomes infinity
+	if (bits >= 0x47800000) return sign | 0x7C00;
+	if (bits < 0x38800000) {
+		// Subnormal half or zero. Adding 0.5 lines the half mantissa up with the float mantissa, so the FPU does the rounding.
+		float const shifted = std::bit_cast<float>(bits) + 0.5f;
+		return sign | (std::bit_cast<uint32_t>(shifted) - 0x3F000000);
+	}
+	// Rebias the exponent and round to nearest even
+	uint32_t const odd = (bits >> 13) & 1;
+	bits += 0xC8000FFF + odd;
+	return sign | (bits >> 13);
+}
+
+float half_to_float(uint16_t value) {
+	uint32_t const sign = uint32_t(value & 0x8000) << 16;
+	uint32_t bits = uint32_t(value & 0x7FFF) << 13;
+	uint32_t const exponent = bits & 0x0F800000;
+	bits += (127 - 15) << 23;
+	if (exponent == 0x0F800000) {
+		// Infinity and NaN
+		bits += (128 - 16) << 23;
+	} else if (exponent == 0) {
+		// Subnormal, renormalize through the FPU
+		bits += 1 << 23;
+		bits = std::bit_cast<uint32_t>(std::bit_cast<float>(bits) - std::bit_cast<float>(113u << 23));
+	}
+	return std::bit_cast<float>(bits | sign);
+}
+
+// Largest value of the shared exponent format: a mantissa of 511/512 with the largest exponent
+constexpr float rgb9e5_max = 65408.0f;
+
+uint32_t float3_to_rgb9e5(float const rgb[3]) {
+	float channels[3];
+	for (int c = 0; c < 3; ++c) {
+		// Written so NaN fails the comparison
+		channels[c] = rgb[c] > 0.0f ? std::min(rgb[c], rgb9e5_max) : 0.0f;
+	}
+	float const max_channel = std::max(std::max(channels[0], channels[1]), channels[2]);
+	// floor(log2(max_channel)), straight from the float exponent. The smallest shared exponent covers everything below 2^-16.
+	int32_t const exponent = max_channel < 0x1p-16f ? -16 : int32_t(std::bit_cast<uint32_t>(max_channel) >> 23) - 127;
+	uint32_t shared = uint32_t(exponent + 16);
+	// 2^-(shared - 15 - 9) is a power of two, so scaling is exact
+	float scale = std::bit_cast<float>((127u + 24u - shared) << 23);
+	if (uint32_t(max_channel * scale + 0.5f) == 512) {
+		// Rounding overflowed the mantissa, go one exponent up
+		++shared;
+		scale *= 0.5f;
+	}
+	uint32_t result = shared << 27;
+	for (int c = 0; c < 3; ++c) {
+		result |= uint32_t(channels[c] * scale + 0.5f) << (9 * c);
+	}
+	return result;
+}
+
+void rgb9e5_to_float3(uint32_t value, float rgb[3]) {
+	float const scale = std::bit_cast<float>((127u + (value >> 27) - 24u) << 23);
+	for (int c = 0; c < 3; ++c) {
+		rgb[c] = float((value >> (9 * c)) & 0x1FF) * scale;
+	}
+}
+
+// Unsigned float with a 5-bit exponent and mantissa_bits bits of mantissa, the channels of R11G11B10F
+static uint32_t float_to_small_float(float value, uint32_t mantissa_bits) {
+	// Negative, zero and NaN
+	if (!(value > 0.0f)) return 0;
+	uint32_t bits = std::bit_cast<uint32_t>(value);
+	if (bits < 0x38800000) {
+		// Subnormal, the same trick as for halfs. The added power of two lines its mantissa up with the subnormal steps.
+		float const magic = std::bit_cast<float>((136u - mantissa_bits) << 23);
+		return std::bit_cast<uint32_t>(value + magic) - std::bit_cast<uint32_t>(magic);
+	}
+	// Rebias the exponent and round to nearest even
+	uint32_t const shift = 23 - mantissa_bits;
+	uint32_t const odd = (bits >> shift) & 1;
+	bits = bits - (112u << 23) + (1u << (shift - 1)) - 1 + odd;
+	uint32_t const max_finite = (31u << mantissa_bits) - 1;
+	return std::min(bits >> shift, max_finite);
+}
+
+static float small_float_to_float(uint32_t value, uint32_t mantissa_bits) {
+	uint32_t const exponent = value >> mantissa_bits;
+	uint32_t const mantissa = value & ((1u << mantissa_bits) - 1);
+	if (exponent == 0) return std::ldexp(float(mantissa), -14 - int(mantissa_bits));
+	if (exponent == 31) return mantissa == 0 ? std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN();
+	return std::bit_cast<float>(((exponent + 112) << 23) | (mantissa << (23 - mantissa_bits)));
+}
+
+uint32_t float3_to_r11g11b10f(float const rgb[3]) {
+	return float_to_small_float(rgb[0], 6) | (float_to_small_float(rgb[1], 6) << 11) | (float_to_small_float(rgb[2], 5) << 22);
+}
+
+void r11g11b10f_to_float3(uint32_t value, float rgb[3]) {
+	rgb[0] = small_float_to_float(value & 0x7FF, 6);
+	rgb[1] = small_float_to_float((value >> 11) & 0x7FF, 6);
+	rgb[2] = small_float_to_float(value >> 22, 5);
+}
+
+int16_t float_to_snorm16(float value) {
+	return static_cast<int16_t>(std::lrint(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+float snorm16_to_float(int16_t value) {
+	// -32768 and -32767 both map to -1
+	return std::max(value / 32767.0f, -1.0f);
+}
+
+float srgb_to_linear(float value) {
+	if (value <= 0.04045f) return value / 12.92f;
+	return std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float value) {
+	if (value <= 0.0031308f) return value * 12.92f;
+	return 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+void encode_octahedral(float const direction[3], int16_t encoded[2]) {
+	float const l1 = std::abs(direction[0]) + std::abs(direction[1]) + std::abs(direction[2]);
+	float const inv_l1 = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+	float x = direction[0] * inv_l1;
+	float y = direction[1] * inv_l1;
+	if (direction[2] < 0.0f) {
+		// Fold the lower hemisphere over the diagonals
+		float const folded_x = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float const folded_y = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+	encoded[0] = float_to_snorm16(x);
+	encoded[1] = float_to_snorm16(y);
+}
+
+void decode_octahedral(int16_t const encoded[2], float direction[3]) {
+	float x = snorm16_to_float(encoded[0]);
+	float y = snorm16_to_float(encoded[1]);
+	float const z = 1.0f - std::abs(x) - std::abs(y);
+	float const t = std::max(-z, 0.0f);
+	x += x >= 0.0f ? -t : t;
+	y += y >= 0.0f ? -t : t;
+	float const inv_length = 1.0f / std::sqrt(x * x + y * y + z * z);
+	direction[0] = x * inv_length;
+	direction[1] = y * inv_length;
+	direction[2] = z * inv_length;
+}
+
+}
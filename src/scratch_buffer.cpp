@@ -0,0 +1,65 @@
+#include <assetlib/scratch_buffer.hpp>
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+namespace assetlib {
+
+ScratchBuffer::ScratchBuffer(Allocator allocator) : allocator(std::move(allocator)) {}
+
+ScratchBuffer::ScratchBuffer(ScratchBuffer&& rhs) noexcept :
+	allocator(std::move(rhs.allocator)), data_(std::exchange(rhs.data_, nullptr)), capacity_(std::exchange(rhs.capacity_, 0)) {}
+
+ScratchBuffer& ScratchBuffer::operator=(ScratchBuffer&& rhs) noexcept {
+	if (this != &rhs) {
+		release();
+		allocator = std::move(rhs.allocator);
+		data_ = std::exchange(rhs.data_, nullptr);
+		capacity_ = std::exchange(rhs.capacity_, 0);
+	}
+	return *this;
+}
+
+ScratchBuffer::~ScratchBuffer() {
+	release();
+}
+
+char* ScratchBuffer::reserve(size_t size) {
+	if (size <= capacity_) return data_;
+	// Grow geometrically, so a slowly growing stream of sizes doesn't reallocate every time
+	size_t const capacity = std::max(size, capacity_ + capacity_ / 2);
+	release();
+	void* memory = nullptr;
+	if (allocator.allocate) {
+		memory = allocator.allocate(capacity, alignment);
+	} else {
+		memory = ::operator new(capacity, std::align_val_t(alignment), std::nothrow);
+	}
+	if (!memory) return nullptr;
+	data_ = static_cast<char*>(memory);
+	capacity_ = capacity;
+	return data_;
+}
+
+void ScratchBuffer::release() {
+	if (!data_) return;
+	if (allocator.allocate) {
+		if (allocator.deallocate) allocator.deallocate(data_, capacity_);
+	} else {
+		::operator delete(data_, std::align_val_t(alignment));
+	}
+	data_ = nullptr;
+	capacity_ = 0;
+}
+
+PackScratch::PackScratch(Allocator const& allocator) : chunks(allocator), staging{ ScratchBuffer(allocator), ScratchBuffer(allocator), ScratchBuffer(allocator) } {}
+
+void PackScratch::release() {
+	chunks.release();
+	for (ScratchBuffer& buffer : staging) {
+		buffer.release();
+	}
+}
+
+}
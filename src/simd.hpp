@@ -0,0 +1,15 @@
+#pragma once
+
+// Instruction sets available to the SIMD kernels. These are only enabled when the compiler targets them,
+// there is no runtime dispatch.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASSETLIB_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// MSVC has no macro for F16C, but every CPU with AVX2 supports it.
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define ASSETLIB_F16C 1
+#include <immintrin.h>
+#endif
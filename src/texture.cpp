@@ -1,27 +1,235 @@
 #include <assetlib/texture.hpp>
+#include <assetlib/compression.hpp>
+
+#include "instrumentation_scope.hpp"
+
 #include <json.hpp>
 #include <lz4.h>
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <vector>
 
 namespace assetlib {
 
-//	Current texture parser version 1.0.1 has the following required fields:
-//	format: a string containing the texture format. Has to be RGBA8
+//	Since version 2.0.0 the metadata starts with a TextureBinaryInfo block, which is all the parser reads.
+//	It is followed by the json description below, which is only kept for tools and debugging.
+//	The json description has the following required fields. Before 2.0.0 it was what the parser read:
+//	format: a string containing the texture format. Has to be RGBA8, RGB8, RG8 or R8.
+//		Since version 2.3.0 also one of the block compressed formats BC1, BC3, BC4, BC5 or BC7.
 //	extents: an object with 2 required fields
 //		x: the width of the texture
 //		y: the height of the texture
 //	byte_size: the size in bytes of texture after decompression
 //	compression_mode: String with the compression mode used. "None" for no compression, "LZ4" for LZ4 compression.
+//		Since version 2.1.0 this can also be "LZ4HC" or a custom codec "Custom<N>".
 //	mip_levels: amount of mip levels stored in the file.
 // Following fields are optional
 // color_space: a string containing the color space. Has to be either sRGB or RGB. (default value is RGB)
+// dictionary_id: hex string with the id of the dictionary the texture was compressed with. Only present since 2.2.0,
+//	and only if a dictionary was used.
+// tile_size: edge length of the tiles in texels. Only present since 2.4.0, and only if the texture is tiled.
+//	Since version 1.2.0 every mip level is stored as its own chunked payload (see compression.hpp). The blob starts with a mip table:
+//		uint32_t mip_count
+//		for every mip level: uint32_t offset, uint32_t stored_size, uint32_t byte_size
+//	where offset is the start of the payload in the binary blob. Readers only locate mips through this table.
+//	pack_texture() stores the payloads smallest mip first, so a coarse version of the texture is available after reading
+//	only a small prefix of the file. TextureStreamPacker stores them in the order they come in.
+//	Version 1.1.0 stored all mip levels as a single chunked payload, version 1.0.1 as one LZ4 block.
+//	Since version 2.4.0 textures with a tile_size are split into tiles of tile_size x tile_size texels, and every tile is
+//	stored as its own chunked payload. The mip table is followed by a tile table:
+//		uint32_t tile_count
+//		for every tile: uint32_t offset, uint32_t stored_size
+//	with the tiles of every mip level in row major order, largest mip first. Tiles hold their rows tightly packed, tiles at the
+//	right and bottom edge are cut off at the edge of the mip. The mip table entries span the payloads of all tiles of a mip level.
+
+constexpr uint32_t itex_chunked_version = pack_version(1, 1, 0);
+constexpr uint32_t itex_mip_table_version = pack_version(1, 2, 0);
+constexpr uint32_t itex_binary_info_version = pack_version(2, 0, 0);
+// Version 2.2.0 added dictionary_id to the binary info. Older files read it as 0, which means no dictionary.
+// Version 2.3.0 added the block compressed formats.
+// Version 2.4.0 added tile_size to the binary info. Older files read it as 0, which means the texture is not tiled.
+
+// Enums are stored by value, so their values may never change.
+struct TextureBinaryInfo {
+	BinaryInfoHeader header;
+	uint64_t byte_size = 0;
+	uint32_t format = 0;
+	uint32_t colorspace = 0;
+	uint32_t compression = 0;
+	uint32_t extents[3]{};
+	uint32_t mip_levels = 0;
+	uint32_t padding = 0;
+	uint64_t dictionary_id = 0;
+	uint32_t tile_size = 0;
+	uint32_t padding2 = 0;
+};
+
+bool is_block_compressed(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::BC1:
+	case TextureFormat::BC3:
+	case TextureFormat::BC4:
+	case TextureFormat::BC5:
+	case TextureFormat::BC7:
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t texture_format_byte_size(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::R8:
+		return 1;
+	case TextureFormat::RG8:
+		return 2;
+	case TextureFormat::RGB8:
+		return 3;
+	case TextureFormat::RGBA8:
+		return 4;
+	case TextureFormat::BC1:
+	case TextureFormat::BC4:
+		return 8;
+	case TextureFormat::BC3:
+	case TextureFormat::BC5:
+	case TextureFormat::BC7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t mip_count(TextureInfo const& info) {
+	return std::max(info.mip_levels, 1u);
+}
+
+static bool read_mip_table_entry(AssetFileView const& file, uint32_t mip, MipTableEntry& entry) {
+	std::span<const char> const blob = file.binary_blob;
+	uint32_t count;
+	if (blob.size() < sizeof(uint32_t)) return false;
+	std::memcpy(&count, blob.data(), sizeof(uint32_t));
+	if (mip >= count) return false;
+	size_t const entry_offset = sizeof(uint32_t) + size_t(mip) * sizeof(MipTableEntry);
+	if (blob.size() < entry_offset + sizeof(MipTableEntry)) return false;
+	std::memcpy(&entry, blob.data() + entry_offset, sizeof(MipTableEntry));
+	return uint64_t(entry.offset) + entry.stored_size <= blob.size();
+}
+
+// Texels per addressable unit along x and y: 4 for the blocks of block compressed formats, 1 otherwise.
+static uint32_t unit_texels(TextureFormat format) {
+	return is_block_compressed(format) ? 4 : 1;
+}
+
+// Extents of a mip level in addressable units
+static void mip_units(TextureInfo const& info, uint32_t mip, uint32_t& width, uint32_t& height) {
+	uint32_t const unit = unit_texels(info.format);
+	width = (std::max(info.extents[0] >> mip, 1u) + unit - 1) / unit;
+	height = (std::max(info.extents[1] >> mip, 1u) + unit - 1) / unit;
+}
+
+// Position and extents of a tile in addressable units: x, y, width, height
+static void tile_rect(TextureInfo const& info, TextureTile const& tile, uint32_t rect[4]) {
+	uint32_t width, height;
+	mip_units(info, tile.mip, width, height);
+	if (info.tile_size == 0) {
+		rect[0] = 0;
+		rect[1] = 0;
+		rect[2] = width;
+		rect[3] = height;
+		return;
+	}
+	uint32_t const size = info.tile_size / unit_texels(info.format);
+	rect[0] = tile.x * size;
+	rect[1] = tile.y * size;
+	rect[2] = std::min(size, width - rect[0]);
+	rect[3] = std::min(size, height - rect[1]);
+}
+
+static uint32_t tile_index(TextureInfo const& info, TextureTile const& tile) {
+	uint32_t index = 0;
+	uint32_t tiles_x, tiles_y;
+	for (uint32_t mip = 0; mip < tile.mip; ++mip) {
+		texture_tile_count(info, mip, tiles_x, tiles_y);
+		index += tiles_x * tiles_y;
+	}
+	texture_tile_count(info, tile.mip, tiles_x, tiles_y);
+	assert(tile.x < tiles_x && tile.y < tiles_y && "Tile out of range");
+	return index + tile.y * tiles_x + tile.x;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Places the pieces of a payload that holds rows of width units in a mip level of a layout, starting at unit x, y.
+struct RowScatter {
+	// Start of the mip level
+	char* dst = nullptr;
+	uint64_t pitch = 0;
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint32_t width = 0;
+	// Bytes per unit in the payload and in the layout, which differ when expanding to RGBA
+	uint32_t src_unit_size = 0;
+	uint32_t dst_unit_size = 0;
+
+	void operator()(uint64_t offset, char const* data, size_t size) const {
+		uint64_t const row_size = uint64_t(width) * src_unit_size;
+		while (size > 0) {
+			uint64_t const row = offset / row_size;
+			uint64_t const within = offset % row_size;
+			size_t const count = std::min<uint64_t>(size, row_size - within);
+			char* row_dst = dst + (y + row) * pitch + uint64_t(x) * dst_unit_size;
+			if (src_unit_size == dst_unit_size) {
+				std::memcpy(row_dst + within, data, count);
+			} else {
+				for (size_t i = 0; i < count; ++i) {
+					uint64_t const position = within + i;
+					char* texel = row_dst + position / src_unit_size * dst_unit_size;
+					uint32_t const channel = position % src_unit_size;
+					texel[channel] = data[i];
+					if (channel == 0) {
+						for (uint32_t c = src_unit_size; c < dst_unit_size; ++c) texel[c] = c == 3 ? char(255) : char(0);
+					}
+				}
+			}
+			offset += count;
+			data += count;
+			size -= count;
+		}
+	}
+};
+
+static bool read_tile_table_entry(AssetFileView const& file, uint32_t index, TileTableEntry& entry) {
+	std::span<const char> const blob = file.binary_blob;
+	uint32_t mips;
+	uint32_t count;
+	if (blob.size() < sizeof(uint32_t)) return false;
+	std::memcpy(&mips, blob.data(), sizeof(uint32_t));
+	size_t const table_offset = sizeof(uint32_t) + size_t(mips) * sizeof(MipTableEntry);
+	if (blob.size() < table_offset + sizeof(uint32_t)) return false;
+	std::memcpy(&count, blob.data() + table_offset, sizeof(uint32_t));
+	if (index >= count) return false;
+	size_t const entry_offset = table_offset + sizeof(uint32_t) + size_t(index) * sizeof(TileTableEntry);
+	if (blob.size() < entry_offset + sizeof(TileTableEntry)) return false;
+	std::memcpy(&entry, blob.data() + entry_offset, sizeof(TileTableEntry));
+	return uint64_t(entry.offset) + entry.stored_size <= blob.size();
+}
 
 static TextureFormat parse_texture_format(std::string const& fmt_string) {
 	if (fmt_string == "RGBA8") { return TextureFormat::RGBA8; }
     if (fmt_string == "RGB8") { return TextureFormat::RGB8; }
     if (fmt_string == "RG8") { return TextureFormat::RG8; }
     if (fmt_string == "R8") { return TextureFormat::R8; }
+	if (fmt_string == "BC1") { return TextureFormat::BC1; }
+	if (fmt_string == "BC3") { return TextureFormat::BC3; }
+	if (fmt_string == "BC4") { return TextureFormat::BC4; }
+	if (fmt_string == "BC5") { return TextureFormat::BC5; }
+	if (fmt_string == "BC7") { return TextureFormat::BC7; }
 	return TextureFormat::Unknown;
 }
 
@@ -35,6 +243,16 @@ static std::string format_to_string(TextureFormat format) {
         return "RGB8";
 	case TextureFormat::RGBA8:
 		return "RGBA8";
+	case TextureFormat::BC1:
+		return "BC1";
+	case TextureFormat::BC3:
+		return "BC3";
+	case TextureFormat::BC4:
+		return "BC4";
+	case TextureFormat::BC5:
+		return "BC5";
+	case TextureFormat::BC7:
+		return "BC7";
 	default:
 		return "Unknown";
 	}
@@ -58,11 +276,31 @@ static std::string colorspace_to_string(ColorSpace space) {
 }
 
 TextureInfo read_texture_info(AssetFile const& file) {
+	return read_texture_info(make_view(file));
+}
+
+TextureInfo read_texture_info(AssetFileView const& file) {
+	StageScope stage(LoadStage::InfoParse, file.type, file.metadata_json.size());
 	// Verify version. TODO: proper error handling everywhere
-	assert(file.version == itex_version && "file version mismatches parser version");
+	assert(major_version(file.version) >= 1 && file.version <= itex_version && "file version mismatches parser version");
 
 	TextureInfo info;
-	json::JSON json = json::JSON::Load(file.metadata_json);
+	if (file.version >= itex_binary_info_version) {
+		TextureBinaryInfo binary;
+		bool const ok = read_binary_info(file, &binary, sizeof(binary));
+		assert(ok && "Missing texture info");
+		info.byte_size = binary.byte_size;
+		info.format = static_cast<TextureFormat>(binary.format);
+		info.colorspace = static_cast<ColorSpace>(binary.colorspace);
+		info.compression = static_cast<CompressionMode>(binary.compression);
+		std::copy_n(binary.extents, 3, info.extents);
+		info.mip_levels = binary.mip_levels;
+		info.dictionary_id = binary.dictionary_id;
+		info.tile_size = binary.tile_size;
+		return info;
+	}
+
+	json::JSON json = json::JSON::Load(std::string(file.metadata_json));
 
 	info.format = parse_texture_format(json["format"].ToString());
 	info.compression = parse_compression_mode(json["compression_mode"].ToString());
@@ -78,7 +316,85 @@ TextureInfo read_texture_info(AssetFile const& file) {
 	return info;
 }
 
-void unpack_texture(TextureInfo const& info, AssetFile const& file, void* dst) {
+void unpack_texture(TextureInfo const& info, AssetFile const& file, void* dst, Executor const& executor) {
+	unpack_texture(info, make_view(file), dst, executor);
+}
+
+uint64_t texture_mip_byte_size(TextureInfo const& info, uint32_t mip) {
+	uint64_t width = std::max(info.extents[0] >> mip, 1u);
+	uint64_t height = std::max(info.extents[1] >> mip, 1u);
+	if (is_block_compressed(info.format)) {
+		width = (width + 3) / 4;
+		height = (height + 3) / 4;
+	}
+	return width * height * texture_format_byte_size(info.format);
+}
+
+uint32_t texture_max_mip_levels(TextureInfo const& info) {
+	uint32_t const size = std::max({ info.extents[0], info.extents[1], 1u });
+	return std::bit_width(size);
+}
+
+uint64_t texture_mip_byte_offset(TextureInfo const& info, uint32_t mip) {
+	uint64_t offset = 0;
+	for (uint32_t i = 0; i < mip; ++i) {
+		offset += texture_mip_byte_size(info, i);
+	}
+	return offset;
+}
+
+void unpack_texture_mips(TextureInfo const& info, AssetFile const& file, uint32_t first_mip, uint32_t last_mip, void* dst, Executor const& executor) {
+	unpack_texture_mips(info, make_view(file), first_mip, last_mip, dst, executor);
+}
+
+void unpack_texture_mips(TextureInfo const& info, AssetFileView const& file, uint32_t first_mip, uint32_t last_mip, void* dst, Executor const& executor) {
+	assert(first_mip <= last_mip && last_mip < mip_count(info) && "Invalid mip range");
+
+	if (file.version < itex_mip_table_version) {
+		// Older files can only be decompressed as a whole
+		std::vector<char> pixels(info.byte_size);
+		unpack_texture(info, file, pixels.data(), executor);
+		uint64_t const begin = texture_mip_byte_offset(info, first_mip);
+		uint64_t const end = texture_mip_byte_offset(info, last_mip + 1);
+		assert(end <= pixels.size() && "Mip range out of bounds");
+		std::memcpy(dst, pixels.data() + begin, end - begin);
+		return;
+	}
+
+	char* dst_bytes = reinterpret_cast<char*>(dst);
+	if (info.tile_size != 0) {
+		for (uint32_t mip = first_mip; mip <= last_mip; ++mip) {
+			unpack_texture_region(info, file, mip, 0, 0, std::max(info.extents[0] >> mip, 1u), std::max(info.extents[1] >> mip, 1u),
+				dst_bytes, 0, executor);
+			dst_bytes += texture_mip_byte_size(info, mip);
+		}
+		return;
+	}
+
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	for (uint32_t mip = first_mip; mip <= last_mip; ++mip) {
+		MipTableEntry entry;
+		bool ok = read_mip_table_entry(file, mip, entry);
+		ok = ok && decompress_chunked(info.compression, file.binary_blob.subspan(entry.offset, entry.stored_size), dst_bytes, entry.byte_size, executor,
+			dictionary_data(dictionary.get()));
+		assert(ok && "Corrupted texture data");
+		dst_bytes += entry.byte_size;
+	}
+}
+
+void unpack_texture(TextureInfo const& info, AssetFileView const& file, void* dst, Executor const& executor) {
+	StageScope stage(LoadStage::Unpack, file.type, file.binary_blob.size(), info.byte_size);
+	if (file.version >= itex_mip_table_version) {
+		unpack_texture_mips(info, file, 0, mip_count(info) - 1, dst, executor);
+		return;
+	}
+
+	if (file.version >= itex_chunked_version) {
+		bool const ok = decompress_chunked(info.compression, file.binary_blob, dst, info.byte_size, executor);
+		assert(ok && "Corrupted texture data");
+		return;
+	}
+
 	if (info.compression == CompressionMode::LZ4) {
 		// Decompress data directly into destination buffer
 		LZ4_decompress_safe(file.binary_blob.data(), reinterpret_cast<char*>(dst),
@@ -89,9 +405,203 @@ void unpack_texture(TextureInfo const& info, AssetFile const& file, void* dst) {
 	}
 }
 
-AssetFile pack_texture(TextureInfo const& info, void* pixel_data) {
-	AssetFile file;
+static uint32_t layout_unit_size(TextureInfo const& info, TextureLayout const& layout) {
+	assert((!layout.expand_to_rgba || !is_block_compressed(info.format)) && "Only uncompressed formats can be expanded");
+	return layout.expand_to_rgba ? 4 : texture_format_byte_size(info.format);
+}
+
+uint64_t texture_layout_row_pitch(TextureInfo const& info, TextureLayout const& layout, uint32_t mip) {
+	uint32_t width, height;
+	mip_units(info, mip, width, height);
+	return align_up(uint64_t(width) * layout_unit_size(info, layout), layout.row_alignment);
+}
+
+static uint64_t layout_mip_byte_size(TextureInfo const& info, TextureLayout const& layout, uint32_t mip) {
+	uint32_t width, height;
+	mip_units(info, mip, width, height);
+	return texture_layout_row_pitch(info, layout, mip) * height;
+}
+
+uint64_t texture_layout_mip_offset(TextureInfo const& info, TextureLayout const& layout, uint32_t mip) {
+	if (!layout.mip_offsets.empty()) {
+		assert(mip < layout.mip_offsets.size() && "Missing mip offset");
+		return layout.mip_offsets[mip];
+	}
+	uint64_t offset = 0;
+	for (uint32_t i = 0; i < mip; ++i) {
+		offset = align_up(offset, layout.mip_alignment) + layout_mip_byte_size(info, layout, i);
+	}
+	return align_up(offset, layout.mip_alignment);
+}
+
+uint64_t texture_layout_byte_size(TextureInfo const& info, TextureLayout const& layout) {
+	uint64_t size = 0;
+	for (uint32_t mip = 0; mip < mip_count(info); ++mip) {
+		size = std::max(size, texture_layout_mip_offset(info, layout, mip) + layout_mip_byte_size(info, layout, mip));
+	}
+	return size;
+}
+
+void unpack_texture(TextureInfo const& info, AssetFile const& file, TextureLayout const& layout, void* dst, Executor const& executor) {
+	unpack_texture(info, make_view(file), layout, dst, executor);
+}
+
+void unpack_texture(TextureInfo const& info, AssetFileView const& file, TextureLayout const& layout, void* dst, Executor const& executor) {
+	StageScope stage(LoadStage::Unpack, file.type, file.binary_blob.size(), info.byte_size);
+	uint32_t const mips = mip_count(info);
+	uint32_t const src_unit_size = texture_format_byte_size(info.format);
+	uint32_t const dst_unit_size = layout_unit_size(info, layout);
+	char* dst_bytes = reinterpret_cast<char*>(dst);
+	auto scatter = [&](uint32_t mip, uint32_t x, uint32_t y, uint32_t width) {
+		return RowScatter{ dst_bytes + texture_layout_mip_offset(info, layout, mip), texture_layout_row_pitch(info, layout, mip),
+			x, y, width, src_unit_size, dst_unit_size };
+	};
+
+	if (file.version < itex_mip_table_version) {
+		// Older files can only be decompressed as a whole
+		std::vector<char> pixels(info.byte_size);
+		unpack_texture(info, file, pixels.data(), executor);
+		for (uint32_t mip = 0; mip < mips; ++mip) {
+			uint32_t width, height;
+			mip_units(info, mip, width, height);
+			scatter(mip, 0, 0, width)(0, pixels.data() + texture_mip_byte_offset(info, mip), texture_mip_byte_size(info, mip));
+		}
+		return;
+	}
+
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	if (info.tile_size == 0) {
+		for (uint32_t mip = 0; mip < mips; ++mip) {
+			uint32_t width, height;
+			mip_units(info, mip, width, height);
+			MipTableEntry entry;
+			bool ok = read_mip_table_entry(file, mip, entry);
+			ok = ok && decompress_chunked(info.compression, file.binary_blob.subspan(entry.offset, entry.stored_size), entry.byte_size,
+				scatter(mip, 0, 0, width), executor, dictionary_data(dictionary.get()));
+			assert(ok && "Corrupted texture data");
+		}
+		return;
+	}
+
+	std::vector<TextureTile> tiles;
+	for (uint32_t mip = 0; mip < mips; ++mip) {
+		uint32_t tiles_x, tiles_y;
+		texture_tile_count(info, mip, tiles_x, tiles_y);
+		for (uint32_t y = 0; y < tiles_y; ++y) {
+			for (uint32_t x = 0; x < tiles_x; ++x) tiles.push_back(TextureTile{ mip, x, y });
+		}
+	}
+	run_jobs(executor, tiles.size(), [&](uint32_t i) {
+		TextureTile const& tile = tiles[i];
+		uint32_t rect[4];
+		tile_rect(info, tile, rect);
+		TileTableEntry entry;
+		bool ok = read_tile_table_entry(file, tile_index(info, tile), entry);
+		ok = ok && decompress_chunked(info.compression, file.binary_blob.subspan(entry.offset, entry.stored_size), texture_tile_byte_size(info, tile),
+			scatter(tile.mip, rect[0], rect[1], rect[2]), {}, dictionary_data(dictionary.get()));
+		assert(ok && "Corrupted texture data");
+	});
+}
+
+void texture_tile_count(TextureInfo const& info, uint32_t mip, uint32_t& tiles_x, uint32_t& tiles_y) {
+	if (info.tile_size == 0) {
+		tiles_x = 1;
+		tiles_y = 1;
+		return;
+	}
+	uint32_t width, height;
+	mip_units(info, mip, width, height);
+	uint32_t const size = info.tile_size / unit_texels(info.format);
+	tiles_x = (width + size - 1) / size;
+	tiles_y = (height + size - 1) / size;
+}
+
+uint64_t texture_tile_byte_size(TextureInfo const& info, TextureTile const& tile) {
+	uint32_t rect[4];
+	tile_rect(info, tile, rect);
+	return uint64_t(rect[2]) * rect[3] * texture_format_byte_size(info.format);
+}
 
+void unpack_texture_tiles(TextureInfo const& info, AssetFile const& file, std::span<TextureTile const> tiles, void* dst, Executor const& executor) {
+	unpack_texture_tiles(info, make_view(file), tiles, dst, executor);
+}
+
+void unpack_texture_tiles(TextureInfo const& info, AssetFileView const& file, std::span<TextureTile const> tiles, void* dst, Executor const& executor) {
+	char* dst_bytes = reinterpret_cast<char*>(dst);
+	if (info.tile_size == 0) {
+		// Every tile is a whole mip level
+		for (TextureTile const& tile : tiles) {
+			assert(tile.x == 0 && tile.y == 0 && "Tile out of range");
+			unpack_texture_mips(info, file, tile.mip, tile.mip, dst_bytes, executor);
+			dst_bytes += texture_tile_byte_size(info, tile);
+		}
+		return;
+	}
+
+	std::vector<uint64_t> offsets(tiles.size() + 1, 0);
+	for (size_t i = 0; i < tiles.size(); ++i) {
+		offsets[i + 1] = offsets[i] + texture_tile_byte_size(info, tiles[i]);
+	}
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	run_jobs(executor, tiles.size(), [&](uint32_t i) {
+		TileTableEntry entry;
+		bool ok = read_tile_table_entry(file, tile_index(info, tiles[i]), entry);
+		ok = ok && decompress_chunked(info.compression, file.binary_blob.subspan(entry.offset, entry.stored_size), dst_bytes + offsets[i],
+			offsets[i + 1] - offsets[i], {}, dictionary_data(dictionary.get()));
+		assert(ok && "Corrupted texture data");
+	});
+}
+
+void unpack_texture_region(TextureInfo const& info, AssetFile const& file, uint32_t mip, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+	void* dst, uint64_t dst_row_pitch, Executor const& executor) {
+	unpack_texture_region(info, make_view(file), mip, x, y, width, height, dst, dst_row_pitch, executor);
+}
+
+void unpack_texture_region(TextureInfo const& info, AssetFileView const& file, uint32_t mip, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+	void* dst, uint64_t dst_row_pitch, Executor const& executor) {
+	uint32_t const unit = unit_texels(info.format);
+	assert(x % unit == 0 && y % unit == 0 && "Region must start on a block");
+	uint32_t mip_width, mip_height;
+	mip_units(info, mip, mip_width, mip_height);
+	// Region in addressable units
+	uint32_t const region[4]{ x / unit, y / unit, (width + unit - 1) / unit, (height + unit - 1) / unit };
+	assert(region[0] + region[2] <= mip_width && region[1] + region[3] <= mip_height && "Region out of bounds");
+	if (region[2] == 0 || region[3] == 0) return;
+
+	uint32_t const unit_size = texture_format_byte_size(info.format);
+	uint64_t const pitch = dst_row_pitch != 0 ? dst_row_pitch : uint64_t(region[2]) * unit_size;
+	uint32_t const tile_units = info.tile_size != 0 ? info.tile_size / unit : std::max(mip_width, mip_height);
+	uint32_t const first_x = region[0] / tile_units;
+	uint32_t const first_y = region[1] / tile_units;
+	uint32_t const tiles_x = (region[0] + region[2] - 1) / tile_units - first_x + 1;
+	uint32_t const tiles_y = (region[1] + region[3] - 1) / tile_units - first_y + 1;
+
+	// Every tile writes its own part of the region
+	char* dst_bytes = reinterpret_cast<char*>(dst);
+	run_jobs(executor, tiles_x * tiles_y, [&](uint32_t i) {
+		TextureTile const tile{ mip, first_x + i % tiles_x, first_y + i / tiles_x };
+		// One tile sized buffer per thread, reused by every region decoded on it
+		thread_local ScratchBuffer scratch;
+		char* const data = scratch.reserve(texture_tile_byte_size(info, tile));
+		assert(data && "Out of memory for tile decode");
+		unpack_texture_tiles(info, file, { &tile, 1 }, data);
+
+		uint32_t rect[4];
+		tile_rect(info, tile, rect);
+		uint32_t const begin_x = std::max(rect[0], region[0]);
+		uint32_t const end_x = std::min(rect[0] + rect[2], region[0] + region[2]);
+		uint32_t const begin_y = std::max(rect[1], region[1]);
+		uint32_t const end_y = std::min(rect[1] + rect[3], region[1] + region[3]);
+		for (uint32_t row = begin_y; row < end_y; ++row) {
+			std::memcpy(dst_bytes + (row - region[1]) * pitch + uint64_t(begin_x - region[0]) * unit_size,
+				data + (uint64_t(row - rect[1]) * rect[2] + (begin_x - rect[0])) * unit_size, uint64_t(end_x - begin_x) * unit_size);
+		}
+		// Untiled textures decode whole mips, which are not worth keeping around
+		if (scratch.capacity() > thread_scratch_limit) scratch.release();
+	});
+}
+
+static std::string texture_json(TextureInfo const& info, CompressionMode compression, uint64_t dictionary_id) {
 	json::JSON json;
 	json["format"] = format_to_string(info.format);
 	json["extents"]["x"] = info.extents[0];
@@ -99,7 +609,70 @@ AssetFile pack_texture(TextureInfo const& info, void* pixel_data) {
 	json["byte_size"] = info.byte_size;
 	json["mip_levels"] = info.mip_levels;
     json["color_space"] = colorspace_to_string(info.colorspace);
+	json["compression_mode"] = compression_to_string(compression);
+	if (dictionary_id != 0) {
+		json["dictionary_id"] = format_dictionary_id(dictionary_id);
+	}
+	if (info.tile_size != 0) {
+		json["tile_size"] = info.tile_size;
+	}
+	return json.dump(0, "");
+}
+
+// The dictionary id is only stored if the texture was actually compressed with it.
+static std::string texture_metadata(TextureInfo const& info, CompressionChoice const& compression) {
+	uint64_t const dictionary_id = compression.mode == CompressionMode::None || compression.dictionary.empty() ? 0 : info.dictionary_id;
+	TextureBinaryInfo binary;
+	binary.byte_size = info.byte_size;
+	binary.format = static_cast<uint32_t>(info.format);
+	binary.colorspace = static_cast<uint32_t>(info.colorspace);
+	binary.compression = static_cast<uint32_t>(compression.mode);
+	std::copy_n(info.extents, 3, binary.extents);
+	binary.mip_levels = info.mip_levels;
+	binary.dictionary_id = dictionary_id;
+	binary.tile_size = info.tile_size;
+	return make_metadata(&binary, sizeof(binary), texture_json(info, compression.mode, dictionary_id));
+}
+
+// Compresses every tile of a mip level on its own, in row major order
+static void compress_tiles(TextureInfo const& info, uint32_t mip, char const* src, CompressionChoice const& compression,
+	TileTableEntry* entries, std::vector<char>& blob, PackScratch& scratch) {
+	uint32_t tiles_x, tiles_y;
+	texture_tile_count(info, mip, tiles_x, tiles_y);
+	uint32_t mip_width, mip_height;
+	mip_units(info, mip, mip_width, mip_height);
+	uint32_t const unit_size = texture_format_byte_size(info.format);
+	for (uint32_t y = 0; y < tiles_y; ++y) {
+		for (uint32_t x = 0; x < tiles_x; ++x) {
+			uint32_t rect[4];
+			tile_rect(info, TextureTile{ mip, x, y }, rect);
+			uint64_t const row_size = uint64_t(rect[2]) * unit_size;
+			uint64_t const tile_size = row_size * rect[3];
+			char* const tile_data = scratch.staging[0].reserve(tile_size);
+			assert(tile_data && "Out of memory for tile staging");
+			for (uint32_t row = 0; row < rect[3]; ++row) {
+				std::memcpy(tile_data + row * row_size, src + (uint64_t(rect[1] + row) * mip_width + rect[0]) * unit_size, row_size);
+			}
+			TileTableEntry& entry = entries[y * tiles_x + x];
+			entry.offset = blob.size();
+			compress_chunked(compression, tile_data, tile_size, default_chunk_size, blob, scratch.chunks);
+			entry.stored_size = blob.size() - entry.offset;
+		}
+	}
+}
+
+AssetFile pack_texture(TextureInfo const& info, void* pixel_data) {
+	AssetFile file;
+	pack_texture(info, pixel_data, file);
+	return file;
+}
 
+void pack_texture(TextureInfo const& info, void* pixel_data, AssetFile& file) {
+	PackScratch scratch;
+	pack_texture(info, pixel_data, file, scratch);
+}
+
+void pack_texture(TextureInfo const& info, void* pixel_data, AssetFile& file, PackScratch& scratch) {
 	// File header
 	file.type[0] = 'I';
 	file.type[1] = 'T';
@@ -107,33 +680,147 @@ AssetFile pack_texture(TextureInfo const& info, void* pixel_data) {
 	file.type[3] = 'X';
 	file.version = itex_version;
 
-	CompressionMode compression = info.compression;
-	if (compression == CompressionMode::LZ4) {
+	uint32_t const mips = mip_count(info);
+	assert(mips <= texture_max_mip_levels(info) && "More mip levels than the extents allow");
+	std::vector<MipTableEntry> mip_table(mips);
+	uint64_t mip_offset = 0;
+	for (uint32_t mip = 0; mip < mips; ++mip) {
+		mip_table[mip].byte_size = texture_mip_byte_size(info, mip);
+		mip_offset += mip_table[mip].byte_size;
+	}
+	assert(mip_offset == info.byte_size && "byte_size does not match the size of the mip chain");
+	assert(info.tile_size % unit_texels(info.format) == 0 && "Tiles of block compressed textures must be a multiple of 4 texels");
+
+	// First tile of every mip level in the tile table
+	std::vector<uint32_t> first_tile(mips + 1, 0);
+	for (uint32_t mip = 0; info.tile_size != 0 && mip < mips; ++mip) {
+		uint32_t tiles_x, tiles_y;
+		texture_tile_count(info, mip, tiles_x, tiles_y);
+		first_tile[mip + 1] = first_tile[mip] + tiles_x * tiles_y;
+	}
+	uint32_t const tile_count = first_tile[mips];
+	std::vector<TileTableEntry> tile_table(tile_count);
+
+	// Writes the mip table (and tile table) followed by every mip level, smallest first
+	auto pack_mips = [&](CompressionChoice compression) {
+		size_t const mip_table_size = sizeof(uint32_t) + mips * sizeof(MipTableEntry);
+		size_t const tile_table_size = info.tile_size != 0 ? sizeof(uint32_t) + tile_count * sizeof(TileTableEntry) : 0;
+		file.binary_blob.resize(mip_table_size + tile_table_size);
+		for (uint32_t mip = mips; mip-- > 0;) {
+			MipTableEntry& entry = mip_table[mip];
+			char const* src = reinterpret_cast<char const*>(pixel_data) + texture_mip_byte_offset(info, mip);
+			entry.offset = file.binary_blob.size();
+			if (info.tile_size != 0) {
+				compress_tiles(info, mip, src, compression, tile_table.data() + first_tile[mip], file.binary_blob, scratch);
+			} else {
+				compress_chunked(compression, src, entry.byte_size, default_chunk_size, file.binary_blob, scratch.chunks);
+			}
+			entry.stored_size = file.binary_blob.size() - entry.offset;
+		}
+		std::memcpy(file.binary_blob.data(), &mips, sizeof(uint32_t));
+		std::memcpy(file.binary_blob.data() + sizeof(uint32_t), mip_table.data(), mips * sizeof(MipTableEntry));
+		if (info.tile_size != 0) {
+			std::memcpy(file.binary_blob.data() + mip_table_size, &tile_count, sizeof(uint32_t));
+			std::memcpy(file.binary_blob.data() + mip_table_size + sizeof(uint32_t), tile_table.data(), tile_count * sizeof(TileTableEntry));
+		}
+	};
 
-		const int compress_staging_size = LZ4_compressBound(info.byte_size);
-		file.binary_blob.resize(compress_staging_size);
-		const int compressed_size = LZ4_compress_default(reinterpret_cast<const char*>(pixel_data), file.binary_blob.data(),
-			info.byte_size, compress_staging_size);
-		file.binary_blob.resize(compressed_size);
+	std::span<const char> const pixels(reinterpret_cast<char const*>(pixel_data), info.byte_size);
+	std::shared_ptr<Dictionary const> const dictionary = require_dictionary(info.dictionary_id);
+	CompressionChoice compression = resolve_compression(info.compression, info.compression_level, { &pixels, 1 }, dictionary_data(dictionary.get()), scratch.chunks);
+	if (compression.mode != CompressionMode::None) {
+		pack_mips(compression);
 
-		const float compression_ratio = (float)compressed_size / (float)info.byte_size;
-		// Compression ratio of > 80% is not worth it
-		if (compression_ratio > 0.8) {
-			compression = CompressionMode::None;
+		const float compression_ratio = (float)file.binary_blob.size() / (float)info.byte_size;
+		// Compression ratio of > 80% is not worth it. Auto already weighed this against the disk bandwidth.
+		if (compression_ratio > 0.8 && info.compression != CompressionMode::Auto) {
+			compression = CompressionChoice{};
 		}
 	}
 	// No else, because the compression mode can change because of the previous if
-	if (compression == CompressionMode::None) {
-		// Use a raw pixel dump instead (memcpy)
-		file.binary_blob.resize(info.byte_size);
-		memcpy(file.binary_blob.data(), pixel_data, info.byte_size);
+	if (compression.mode == CompressionMode::None) {
+		// Store the raw pixels, still split in chunks so they can be copied in parallel
+		pack_mips(compression);
 	}
 
-	json["compression_mode"] = compression_to_string(compression);
+	file.metadata_json = texture_metadata(info, compression);
+}
 
-	file.metadata_json = json.dump(0, "");
+bool TextureStreamPacker::open(std::filesystem::path const& path, TextureInfo const& info) {
+	begin(info);
+	if (!writer.open(path, "ITEX", itex_version, texture_metadata(info, compression))) return false;
+	begin_blob();
+	return true;
+}
 
-	return file;
+void TextureStreamPacker::open(plib::binary_output_stream& out, TextureInfo const& info) {
+	begin(info);
+	writer.open(out, "ITEX", itex_version);
+	begin_blob();
+}
+
+void TextureStreamPacker::begin(TextureInfo const& info) {
+	assert(info.tile_size == 0 && "Tiled textures can't be stream packed");
+	this->info = info;
+	dictionary = require_dictionary(info.dictionary_id);
+	compression = resolve_compression(info.compression, info.compression_level, {}, dictionary_data(dictionary.get()));
+	mip_table.assign(mip_count(info), MipTableEntry{});
+	for (uint32_t mip = 0; mip < mip_table.size(); ++mip) {
+		mip_table[mip].byte_size = texture_mip_byte_size(info, mip);
+	}
+	current_mip = 0;
+	remaining_in_mip = 0;
+	ok = true;
+}
+
+void TextureStreamPacker::begin_blob() {
+	// Reserve the mip table, it's patched in finish(). Mips are stored in the order they come in, largest first.
+	std::vector<char> table(sizeof(uint32_t) + mip_table.size() * sizeof(MipTableEntry));
+	writer.append(table.data(), table.size());
+	begin_mip();
+}
+
+void TextureStreamPacker::begin_mip() {
+	MipTableEntry& entry = mip_table[current_mip];
+	payload.begin(writer, compression, entry.byte_size);
+	// The mip table holds 32 bit offsets, a blob that outgrew them can't be described
+	ok = ok && payload.offset() <= std::numeric_limits<uint32_t>::max();
+	entry.offset = payload.offset();
+	remaining_in_mip = entry.byte_size;
+}
+
+void TextureStreamPacker::write(void const* data, size_t size) {
+	char const* bytes = reinterpret_cast<char const*>(data);
+	while (size > 0) {
+		if (remaining_in_mip == 0) {
+			// More data than the mip chain holds
+			if (current_mip + 1 >= mip_table.size()) {
+				ok = false;
+				return;
+			}
+			++current_mip;
+			begin_mip();
+		}
+		uint64_t const count = std::min<uint64_t>(size, remaining_in_mip);
+		payload.write(bytes, count);
+		bytes += count;
+		size -= count;
+		remaining_in_mip -= count;
+		if (remaining_in_mip == 0) {
+			ok = payload.end() && payload.stored_size() <= std::numeric_limits<uint32_t>::max() && ok;
+			mip_table[current_mip].stored_size = payload.stored_size();
+		}
+	}
+}
+
+bool TextureStreamPacker::finish() {
+	// Every mip must have been written completely
+	if (current_mip + 1 != mip_table.size() || remaining_in_mip != 0) ok = false;
+
+	uint32_t const mips = mip_table.size();
+	writer.patch(0, &mips, sizeof(uint32_t));
+	writer.patch(sizeof(uint32_t), mip_table.data(), mips * sizeof(MipTableEntry));
+	return writer.finish(texture_metadata(info, compression)) && ok;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include <assetlib/thread_pool.hpp>
+
+#include <algorithm>
+#include <memory>
+
+namespace assetlib {
+
+void run_jobs(Executor const& executor, uint32_t count, std::function<void(uint32_t)> const& job) {
+	if (count == 0) return;
+	if (executor && count > 1) {
+		executor(count, job);
+	} else {
+		for (uint32_t i = 0; i < count; ++i) {
+			job(i);
+		}
+	}
+}
+
+ThreadPool::ThreadPool(uint32_t threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	workers.reserve(threads);
+	for (uint32_t i = 0; i < threads; ++i) {
+		workers.emplace_back([this] { worker_main(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	task_available.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	{
+		std::lock_guard lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	task_available.notify_one();
+}
+
+void ThreadPool::worker_main() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock lock(mutex);
+			task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty()) return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallel_for(uint32_t count, std::function<void(uint32_t)> const& job) {
+	if (count == 0) return;
+
+	// Shared with the helper tasks, which may only get to run after this call returned.
+	// Helpers never touch job once all indices have been claimed, so it's safe to reference it here.
+	struct State {
+		std::function<void(uint32_t)> const* job;
+		uint32_t count;
+		std::atomic<uint32_t> next{ 0 };
+		std::atomic<uint32_t> done{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto state = std::make_shared<State>();
+	state->job = &job;
+	state->count = count;
+
+	auto work = [](State& s) {
+		uint32_t completed = 0;
+		for (uint32_t i = s.next++; i < s.count; i = s.next++) {
+			(*s.job)(i);
+			++completed;
+		}
+		if (completed != 0 && s.done.fetch_add(completed) + completed == s.count) {
+			std::lock_guard lock(s.mutex);
+			s.finished.notify_all();
+		}
+	};
+
+	uint32_t const helpers = std::min(count - 1, thread_count());
+	for (uint32_t i = 0; i < helpers; ++i) {
+		submit([state, work] { work(*state); });
+	}
+	work(*state);
+
+	std::unique_lock lock(state->mutex);
+	state->finished.wait(lock, [&] { return state->done.load() == state->count; });
+}
+
+Executor ThreadPool::executor() {
+	return [this](uint32_t count, std::function<void(uint32_t)> const& job) {
+		parallel_for(count, job);
+	};
+}
+
+}